@@ -0,0 +1,544 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "platform.h"
+#include "minirisc.h"
+#include "console.h"
+#include "elf_loader.h"
+#include "sched.h"
+
+#define BATCH_LINE_MAX    4096
+#define BATCH_MESSAGE_MAX 160
+#define BATCH_POLL_NS     10000000 // Periode de surveillance des delais (10 ms)
+
+/**
+ * Mot memoire attendu a la fin de l'execution.
+ */
+typedef struct {
+    uint32_t addr;
+    uint32_t value;
+} batch_mem_t;
+
+/**
+ * Une ligne du manifeste, puis son resultat.
+ */
+typedef struct {
+    char        *name;        // Chemin tel qu'ecrit dans le manifeste
+    char        *image;       // Chemin resolu
+    uint32_t    reg_mask;     // Registres a verifier
+    uint32_t    regs[32];
+    int         check_pc;
+    uint32_t    pc;
+    batch_mem_t *mems;
+    int         n_mems;
+
+    minirisc_t  *mr;          // Processeur en cours d'execution (protege par batch_t.lock)
+    uint64_t    start_us;
+    int         timed_out;
+
+    int         passed;
+    uint64_t    time_us;
+    uint64_t    instructions; // Instructions executees
+    char        message[BATCH_MESSAGE_MAX];
+} batch_job_t;
+
+typedef struct {
+    const batch_config_t *config;
+    batch_job_t     *jobs;
+    int             n_jobs;
+    int             next;     // Prochaine image a lancer
+    int             done;     // Images terminees
+    int             null_fd;  // /dev/null, sortie des consoles : stdout ne porte que le rapport
+    pthread_mutex_t lock;
+} batch_t;
+
+static const char *batch_abi_names[32] = {
+    "zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2",
+    "s0", "s1", "a0", "a1", "a2", "a3", "a4", "a5",
+    "a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7",
+    "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6"
+};
+
+static uint64_t batch_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+}
+
+/**
+ * Numero du registre name (x0-x31, fp ou nom ABI), -1 s'il est inconnu.
+ */
+static int batch_parse_reg(const char *name) {
+    if (name[0] == 'x' && name[1] != '\0') {
+        char *end;
+        long n = strtol(name + 1, &end, 10);
+        return (*end == '\0' && n >= 0 && n < 32) ? (int) n : -1;
+    }
+    if (strcmp(name, "fp") == 0) {
+        return 8;
+    }
+    for (int i = 0; i < 32; i++) {
+        if (strcmp(name, batch_abi_names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int batch_parse_value(const char *text, uint32_t *value) {
+    char *end;
+    if (*text == '\0') {
+        return -1;
+    }
+    *value = (uint32_t) strtoll(text, &end, 0);
+    return *end == '\0' ? 0 : -1;
+}
+
+/**
+ * Analyse une attente `cle=valeur` de la ligne du manifeste.
+ */
+static int batch_parse_check(batch_job_t *job, char *token) {
+    char *equal = strchr(token, '=');
+    uint32_t value;
+    if (equal == NULL || batch_parse_value(equal + 1, &value) != 0) {
+        return -1;
+    }
+    *equal = '\0';
+
+    if (strncmp(token, "mem:", 4) == 0) {
+        uint32_t addr;
+        if (batch_parse_value(token + 4, &addr) != 0) {
+            *equal = '='; // Pour le message d'erreur
+            return -1;
+        }
+        job->mems = (batch_mem_t*) realloc(job->mems, (job->n_mems + 1) * sizeof(batch_mem_t));
+        job->mems[job->n_mems].addr = addr;
+        job->mems[job->n_mems].value = value;
+        job->n_mems++;
+    }
+    else if (strcmp(token, "pc") == 0) {
+        job->check_pc = 1;
+        job->pc = value;
+    }
+    else {
+        int reg = batch_parse_reg(token);
+        if (reg < 0) {
+            *equal = '=';
+            return -1;
+        }
+        job->reg_mask |= 1u << reg;
+        job->regs[reg] = value;
+    }
+    return 0;
+}
+
+static void batch_free_jobs(batch_job_t *jobs, int n_jobs) {
+    for (int i = 0; i < n_jobs; i++) {
+        free(jobs[i].name);
+        free(jobs[i].image);
+        free(jobs[i].mems);
+    }
+    free(jobs);
+}
+
+/**
+ * Lit le manifeste. Renvoie le nombre d'images, -1 en cas d'erreur.
+ */
+static int batch_parse_manifest(const char *manifest, batch_job_t **jobs) {
+    FILE *f = fopen(manifest, "r");
+    if (f == NULL) {
+        fprintf(stderr, "Erreur: manifeste introuvable: %s\n", manifest);
+        return -1;
+    }
+
+    // Les chemins relatifs partent du repertoire du manifeste.
+    const char *slash = strrchr(manifest, '/');
+    size_t dir_len = slash != NULL ? (size_t) (slash - manifest) + 1 : 0;
+
+    char line[BATCH_LINE_MAX];
+    int n_jobs = 0, line_number = 0;
+    *jobs = NULL;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        line_number++;
+        char *comment = strchr(line, '#');
+        if (comment != NULL) {
+            *comment = '\0';
+        }
+        char *saveptr;
+        char *token = strtok_r(line, " \t\r\n", &saveptr);
+        if (token == NULL) {
+            continue;
+        }
+
+        *jobs = (batch_job_t*) realloc(*jobs, (n_jobs + 1) * sizeof(batch_job_t));
+        batch_job_t *job = &(*jobs)[n_jobs++];
+        memset(job, 0, sizeof(*job));
+        job->name = strdup(token);
+        if (token[0] == '/') {
+            job->image = strdup(token);
+        }
+        else {
+            job->image = (char*) malloc(dir_len + strlen(token) + 1);
+            memcpy(job->image, manifest, dir_len);
+            strcpy(job->image + dir_len, token);
+        }
+
+        while ((token = strtok_r(NULL, " \t\r\n", &saveptr)) != NULL) {
+            if (batch_parse_check(job, token) != 0) {
+                fprintf(stderr, "Erreur: %s:%d: attente invalide: %s\n", manifest, line_number, token);
+                fclose(f);
+                batch_free_jobs(*jobs, n_jobs);
+                return -1;
+            }
+        }
+    }
+    fclose(f);
+    return n_jobs;
+}
+
+/**
+ * Compare l'etat final du processeur aux attentes de job.
+ */
+static void batch_check(batch_job_t *job, minirisc_t *mr) {
+    job->passed = 0;
+    if (job->timed_out) {
+        snprintf(job->message, sizeof(job->message), "timeout");
+        return;
+    }
+    for (int i = 0; i < 32; i++) {
+        if ((job->reg_mask & (1u << i)) && mr->regs[i] != job->regs[i]) {
+            snprintf(job->message, sizeof(job->message), "x%d=0x%x expected 0x%x", i, mr->regs[i], job->regs[i]);
+            return;
+        }
+    }
+    if (job->check_pc && mr->PC != job->pc) {
+        snprintf(job->message, sizeof(job->message), "pc=0x%x expected 0x%x", mr->PC, job->pc);
+        return;
+    }
+    for (int i = 0; i < job->n_mems; i++) {
+        uint32_t value;
+        if (platform_read(mr->platform, ACCESS_WORD, job->mems[i].addr, &value) != 0) {
+            snprintf(job->message, sizeof(job->message), "mem:0x%x unreadable", job->mems[i].addr);
+            return;
+        }
+        if (value != job->mems[i].value) {
+            snprintf(job->message, sizeof(job->message), "mem:0x%x=0x%x expected 0x%x",
+                     job->mems[i].addr, value, job->mems[i].value);
+            return;
+        }
+    }
+    job->passed = 1;
+}
+
+/**
+ * Compare l'etat du processeur et de sa memoire a expected.
+ * @return 0 s'ils sont identiques, -1 sinon (message dans job).
+ */
+static int batch_compare(batch_job_t *job, minirisc_t *mr, const minirisc_snapshot_t *expected, const char *what) {
+    const char *field = NULL;
+    uint32_t addr;
+    for (int i = 0; i < 32; i++) {
+        if (mr->regs[i] != expected->regs[i]) {
+            snprintf(job->message, sizeof(job->message), "%s: x%d=0x%x expected 0x%x", what, i, mr->regs[i], expected->regs[i]);
+            return -1;
+        }
+    }
+    if (mr->PC != expected->PC) {
+        field = "pc";
+    }
+    else if (memcmp(&mr->csr, &expected->csr, sizeof(csr_t)) != 0) {
+        field = "csr";
+    }
+    else if (memcmp(&mr->counters, &expected->counters, sizeof(minirisc_counters_t)) != 0
+             || mr->platform->mmio_accesses != expected->mmio_accesses) {
+        field = "counters";
+    }
+    else if (platform_snapshot_compare(mr->platform, expected->memory, &addr) != 0) {
+        snprintf(job->message, sizeof(job->message), "%s: memory differs in page 0x%x", what, addr);
+        return -1;
+    }
+    if (field != NULL) {
+        snprintf(job->message, sizeof(job->message), "%s: %s differs", what, field);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Arrete le processeur donne en argument : evenement de mi-parcours de
+ * batch_check_snapshots().
+ */
+static void batch_stop(void *opaque, uint64_t now) {
+    (void) now;
+    ((minirisc_t*) opaque)->halt = 1;
+}
+
+/**
+ * Relance mr, sous la surveillance du delai.
+ * @return 0, ou -1 si le delai est depasse (message dans job).
+ */
+static int batch_rerun(batch_t *b, batch_job_t *job, minirisc_t *mr) {
+    pthread_mutex_lock(&b->lock);
+    job->mr = mr;
+    job->start_us = batch_now_us();
+    pthread_mutex_unlock(&b->lock);
+
+    minirisc_run(mr);
+
+    pthread_mutex_lock(&b->lock);
+    job->mr = NULL;
+    pthread_mutex_unlock(&b->lock);
+    if (job->timed_out) {
+        snprintf(job->message, sizeof(job->message), "snapshot: timeout");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Verifie, apres une premiere execution reussie, que les sauvegardes
+ * restaurent exactement l'etat de la machine (voir batch_run()). start est
+ * l'etat avant la premiere instruction.
+ */
+static void batch_check_snapshots(batch_t *b, batch_job_t *job, minirisc_t *mr, const minirisc_snapshot_t *start) {
+    platform_t *plt = mr->platform;
+    minirisc_snapshot_t *end = minirisc_snapshot(mr);
+    minirisc_snapshot_t *middle = NULL;
+    uint64_t end_time = platform_time(plt);
+    sched_event_t stop;
+
+    job->passed = 0;
+    if (end == NULL) {
+        snprintf(job->message, sizeof(job->message), "snapshot: cannot save");
+        return;
+    }
+    sched_event_init(&stop, batch_stop, mr);
+    minirisc_restore(mr, start);
+    platform_schedule(plt, &stop, end_time / 2);
+    if (batch_rerun(b, job, mr) != 0) {
+        goto out;
+    }
+    if (stop.index >= 0) {
+        // Fini avant que le moteur n'examine l'echeance (code sans saut) :
+        // seule la reprise depuis le debut est verifiee.
+        if (batch_compare(job, mr, end, "snapshot: rerun") == 0) {
+            job->passed = 1;
+        }
+        goto out;
+    }
+    // Arrete par l'evenement, pas par le programme : la suite doit reprendre,
+    // y compris la prise d'interruption que halt a empechee.
+    mr->halt = 0;
+    platform_kick(plt);
+    middle = minirisc_snapshot(mr);
+    if (middle == NULL) {
+        snprintf(job->message, sizeof(job->message), "snapshot: cannot save");
+        goto out;
+    }
+    if (batch_rerun(b, job, mr) != 0 || batch_compare(job, mr, end, "snapshot: run on") != 0) {
+        goto out;
+    }
+    minirisc_restore(mr, middle);
+    if (batch_rerun(b, job, mr) != 0 || batch_compare(job, mr, end, "snapshot: restored") != 0) {
+        goto out;
+    }
+    job->passed = 1;
+
+out:
+    platform_cancel(plt, &stop);
+    if (middle != NULL) {
+        minirisc_snapshot_free(mr, middle);
+    }
+    minirisc_snapshot_free(mr, end);
+}
+
+/**
+ * Execute une image dans sa propre plateforme.
+ */
+static void batch_run_job(batch_t *b, batch_job_t *job) {
+    const batch_config_t *config = b->config;
+    platform_t *platform = platform_new();
+    minirisc_t *minirisc = minirisc_new(PLATFORM_RAM_BASE, platform);
+    hle_t *hle = NULL;
+    minirisc_snapshot_t *start_state = NULL;
+    int status = 0;
+
+    if (platform->console != NULL) {
+        console_set_output(platform->console, b->null_fd);
+    }
+
+    if (config->engine != NULL) {
+        minirisc_set_engine(minirisc, config->engine);
+    }
+    if (config->jit_threshold >= 0) {
+        minirisc_set_jit(minirisc, (uint32_t) config->jit_threshold);
+    }
+    if (elf_loader_is_elf(job->image)) {
+        status = elf_loader_load(platform, job->image, &minirisc->PC);
+        if (status == 0 && config->hle != NULL) {
+            hle = hle_new(platform, config->hle, job->image);
+            minirisc_set_hle(minirisc, hle);
+        }
+    }
+    else {
+        status = platform_load_program(platform, job->image);
+    }
+    if (status == 0 && config->snapshots) {
+        start_state = minirisc_snapshot(minirisc);
+    }
+
+    uint64_t start = batch_now_us();
+    if (status == 0) {
+        pthread_mutex_lock(&b->lock);
+        job->mr = minirisc;
+        job->start_us = start;
+        pthread_mutex_unlock(&b->lock);
+
+        minirisc_run(minirisc);
+
+        pthread_mutex_lock(&b->lock);
+        job->mr = NULL;
+        pthread_mutex_unlock(&b->lock);
+    }
+    job->time_us = batch_now_us() - start;
+    job->instructions = minirisc->counters.instret;
+
+    if (status == 0) {
+        batch_check(job, minirisc);
+        if (job->passed && config->snapshots) {
+            if (start_state != NULL) {
+                batch_check_snapshots(b, job, minirisc, start_state);
+            }
+            else {
+                job->passed = 0;
+                snprintf(job->message, sizeof(job->message), "snapshot: cannot save");
+            }
+        }
+    }
+    else {
+        job->passed = 0;
+        snprintf(job->message, sizeof(job->message), "cannot load image");
+    }
+
+    if (start_state != NULL) {
+        minirisc_snapshot_free(minirisc, start_state);
+    }
+    minirisc_free(minirisc);
+    if (hle != NULL) {
+        hle_free(hle);
+    }
+    platform_free(platform);
+}
+
+static void* batch_worker(void *arg) {
+    batch_t *b = (batch_t*) arg;
+    for (;;) {
+        pthread_mutex_lock(&b->lock);
+        int i = b->next++;
+        pthread_mutex_unlock(&b->lock);
+        if (i >= b->n_jobs) {
+            return NULL;
+        }
+        batch_run_job(b, &b->jobs[i]);
+        pthread_mutex_lock(&b->lock);
+        b->done++;
+        pthread_mutex_unlock(&b->lock);
+    }
+}
+
+/**
+ * Arrete les images qui depassent le delai, jusqu'a ce que toutes soient finies.
+ */
+static void batch_watchdog(batch_t *b) {
+    const struct timespec period = { 0, BATCH_POLL_NS };
+    for (;;) {
+        nanosleep(&period, NULL);
+        uint64_t now = batch_now_us();
+        pthread_mutex_lock(&b->lock);
+        int finished = b->done == b->n_jobs;
+        for (int i = 0; i < b->n_jobs && !finished; i++) {
+            batch_job_t *job = &b->jobs[i];
+            if (job->mr != NULL && !job->timed_out && now - job->start_us > (uint64_t) b->config->timeout_ms * 1000) {
+                job->timed_out = 1;
+                __atomic_store_n(&job->mr->halt, 1, __ATOMIC_RELAXED); // Vu a la prochaine frontiere de bloc
+            }
+        }
+        pthread_mutex_unlock(&b->lock);
+        if (finished) {
+            return;
+        }
+    }
+}
+
+static void batch_print_string(FILE *out, const char *s) {
+    fputc('"', out);
+    for (; *s != '\0'; s++) {
+        if (*s == '"' || *s == '\\') {
+            fputc('\\', out);
+        }
+        fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+int batch_run(const char *manifest, const batch_config_t *config) {
+    batch_t b;
+    b.config = config;
+    b.n_jobs = batch_parse_manifest(manifest, &b.jobs);
+    if (b.n_jobs < 0) {
+        return -1;
+    }
+    b.next = 0;
+    b.done = 0;
+    b.null_fd = open("/dev/null", O_WRONLY);
+    if (b.null_fd < 0) {
+        fprintf(stderr, "Erreur : impossible d'ouvrir /dev/null\n");
+        batch_free_jobs(b.jobs, b.n_jobs);
+        return -1;
+    }
+    pthread_mutex_init(&b.lock, NULL);
+
+    int n_threads = config->n_threads < 1 ? 1 : config->n_threads;
+    pthread_t *threads = (pthread_t*) malloc(n_threads * sizeof(pthread_t));
+    uint64_t start = batch_now_us();
+    for (int i = 0; i < n_threads; i++) {
+        pthread_create(&threads[i], NULL, batch_worker, &b);
+    }
+    if (config->timeout_ms != 0) {
+        batch_watchdog(&b);
+    }
+    for (int i = 0; i < n_threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    uint64_t wall = batch_now_us() - start;
+
+    int failed = 0;
+    for (int i = 0; i < b.n_jobs; i++) {
+        batch_job_t *job = &b.jobs[i];
+        fprintf(config->out, "{\"image\":");
+        batch_print_string(config->out, job->name);
+        fprintf(config->out, ",\"status\":\"%s\",\"time_us\":%" PRIu64 ",\"instructions\":%" PRIu64 ",\"mips\":%.2f",
+                job->passed ? "pass" : "fail", job->time_us, job->instructions,
+                job->time_us ? (double) job->instructions / job->time_us : 0.0);
+        if (!job->passed) {
+            fprintf(config->out, ",\"message\":");
+            batch_print_string(config->out, job->message);
+            failed++;
+        }
+        fprintf(config->out, "}\n");
+    }
+    fprintf(config->out, "{\"summary\":{\"total\":%d,\"passed\":%d,\"failed\":%d,\"threads\":%d,\"wall_us\":%" PRIu64 "}}\n",
+            b.n_jobs, b.n_jobs - failed, failed, n_threads, wall);
+    fflush(config->out);
+
+    pthread_mutex_destroy(&b.lock);
+    close(b.null_fd);
+    free(threads);
+    batch_free_jobs(b.jobs, b.n_jobs);
+    return failed;
+}
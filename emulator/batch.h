@@ -0,0 +1,55 @@
+#ifndef BATCH_H
+#define BATCH_H
+#include <inttypes.h>
+#include <stdio.h>
+#include "hle.h"
+
+/**
+ * Options of a batch run.
+ */
+typedef struct {
+    int         n_threads;     // Worker threads (at least 1)
+    const char *engine;        // Engine name for minirisc_set_engine(), NULL for the default
+    int64_t     jit_threshold; // Argument of minirisc_set_jit(), -1 to keep the default
+    uint32_t    timeout_ms;    // An image still running after this long fails (0: no limit)
+    FILE       *out;           // Where the report is written
+    const hle_config_t *hle;   // Cost of the routines emulated on the host in ELF images (see hle.h), NULL: none
+    int         snapshots;     // Also check that snapshots restore the exact machine state (see batch_run())
+} batch_config_t;
+
+/**
+ * Run every image listed in a manifest, each in its own platform and core,
+ * on a pool of threads, and check its final state.
+ *
+ * The manifest has one image per line ('#' starts a comment):
+ *
+ *     path [reg=value]... [pc=value] [mem:addr=value]...
+ *
+ * `path` is an ELF or raw image, relative to the manifest's directory unless
+ * absolute. `reg` is x0-x31 or an ABI name (ra, sp, a0...), `mem:addr` a
+ * word in memory; values are C integer literals, possibly negative.
+ *
+ * The report has one JSON object per line and per image, in manifest order,
+ * then a summary object:
+ *
+ *     {"image":"...","status":"pass","time_us":12,"instructions":30,"mips":2.50}
+ *     {"image":"...","status":"fail","time_us":40,"instructions":95,"mips":2.38,"message":"x3=0x5 expected 0x6"}
+ *     {"summary":{"total":2,"passed":1,"failed":1,"threads":4,"wall_us":45}}
+ *
+ * time_us covers minirisc_run() only, not the loading of the image;
+ * instructions is the number of instructions it retired.
+ * The guests' console output is discarded: the report is the only output.
+ *
+ * With config->snapshots, an image that passes is run again from a
+ * snapshot taken before its first instruction: the run is stopped halfway
+ * in virtual time, a second snapshot is taken and the run goes on to the
+ * end; then the second snapshot is restored and the end is run again. Both
+ * ends must match the first one bit for bit (registers, PC, CSRs, counters
+ * and RAM), otherwise the image fails. An image that ends before the engine
+ * looks at the halfway deadline (see minirisc_run()) is only checked once.
+ * The timeout applies to each run separately.
+ * @return The number of failed images, or -1 if the manifest cannot be read
+ *         (or /dev/null cannot be opened).
+ */
+int batch_run(const char *manifest, const batch_config_t *config);
+#endif
@@ -0,0 +1,286 @@
+/*
+ * Micro-benchmarks of the emulator's layers, independently of any guest
+ * program: decode and execution per opcode class, platform_read() and
+ * platform_write() per access width on RAM and on a device, and
+ * platform_load_program() per image size.
+ *
+ * Usage: microbench [result.json]
+ * Results are written as JSON (stdout by default) to be compared between
+ * commits; every measure is the best of MICROBENCH_RUNS runs.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "minirisc.h"
+#include "platform.h"
+
+#define MICROBENCH_RUNS    5
+#define MICROBENCH_STREAM  4096      // Instructions d'un flux synthetique
+#define MICROBENCH_INSNS   (1 << 22) // Instructions executees par mesure
+#define MICROBENCH_ACCESS  (1 << 22) // Acces memoire par mesure
+#define MICROBENCH_WINDOW  0x10000   // Octets parcourus par les acces a la RAM
+#define MICROBENCH_DEVICE  0x20000000 // Peripherique sans effet des acces MMIO
+#define MICROBENCH_BASE    5         // Registre de base des acces memoire (t0)
+
+static uint64_t microbench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/**
+ * Classe d'opcodes : ses instructions sont tirees au hasard parmi
+ * opcodes[0..n_opcodes[.
+ */
+typedef struct {
+    const char    *name;
+    const uint8_t *opcodes;
+    int           n_opcodes;
+} microbench_class_t;
+
+static const uint8_t class_upper[]  = { 1, 2 };
+static const uint8_t class_jump[]   = { 3, 4 };
+static const uint8_t class_branch[] = { 5, 6, 7, 8, 9, 10 };
+static const uint8_t class_load[]   = { 11, 12, 13, 14, 15 };
+static const uint8_t class_store[]  = { 16, 17, 18 };
+static const uint8_t class_imm[]    = { 19, 20, 21, 22, 23, 24, 25, 26, 27 };
+static const uint8_t class_reg[]    = { 28, 29, 30, 31, 32, 33, 34, 35, 36, 37 };
+static const uint8_t class_csr[]    = { 42, 43, 44, 45, 46, 47 };
+static const uint8_t class_mul[]    = { 56, 57, 58, 59 };
+static const uint8_t class_div[]    = { 60, 61, 62, 63 };
+
+#define CLASS(name, opcodes) { name, opcodes, sizeof(opcodes) }
+
+static const microbench_class_t microbench_classes[] = {
+    CLASS("upper", class_upper),
+    CLASS("jump", class_jump),
+    CLASS("branch", class_branch),
+    CLASS("load", class_load),
+    CLASS("store", class_store),
+    CLASS("alu_imm", class_imm),
+    CLASS("alu_reg", class_reg),
+    CLASS("csr", class_csr),
+    CLASS("mul", class_mul),
+    CLASS("div", class_div),
+};
+
+/**
+ * Encode une instruction aleatoire de l'opcode donne. Les registres lus et
+ * ecrits sont a0-a5 ; les acces memoire et JALR partent de t0, qui pointe
+ * en RAM et n'est jamais ecrit, avec un deplacement aligne pour toutes les
+ * largeurs.
+ */
+static uint32_t microbench_encode(uint32_t opcode) {
+    uint32_t rd = 10 + rand() % 6;
+    uint32_t rs1 = 10 + rand() % 6;
+    uint32_t rs2 = 10 + rand() % 6;
+    uint32_t imm = (uint32_t) (rand() % 4096);
+
+    if (opcode >= 11 && opcode <= 18) {
+        rs1 = MICROBENCH_BASE;
+        imm = (uint32_t) (rand() % 512) * 4;
+    }
+    if (opcode == 4) {
+        rs1 = MICROBENCH_BASE;
+        imm = 0;
+    }
+    if (opcode >= 25 && opcode <= 27) {
+        imm = (uint32_t) (rand() % 32);
+    }
+    if (opcode >= 42 && opcode <= 47) {
+        if (opcode == 42 || opcode == 45) {
+            imm = 0x341; // mepc : une ecriture est sans effet sur l'execution
+        }
+        else {
+            imm = rand() % 2 ? 0x341 : 0xB02; // mepc, minstret
+            rs1 = 0; // Lecture seule
+        }
+    }
+    if (opcode >= 16 && opcode <= 18) {
+        rd = rs2; // Les stockages lisent rs2 dans le champ rd
+    }
+    if ((opcode >= 28 && opcode <= 37) || opcode >= 56) {
+        return opcode | (rd << 7) | (rs1 << 12) | (rs2 << 17);
+    }
+    return opcode | (rd << 7) | (rs1 << 12) | (imm << 20);
+}
+
+static void microbench_decode_execute(FILE *out) {
+    platform_t *platform = platform_new();
+    minirisc_t *mr = minirisc_new(PLATFORM_RAM_BASE, platform);
+    uint32_t *stream = (uint32_t*) malloc(MICROBENCH_STREAM * sizeof(uint32_t));
+    int n_classes = sizeof(microbench_classes) / sizeof(microbench_classes[0]);
+
+    fprintf(out, "  \"decode_execute\": [\n");
+    for (int c = 0; c < n_classes; c++) {
+        const microbench_class_t *class = &microbench_classes[c];
+        srand(c + 1);
+        for (int i = 0; i < MICROBENCH_STREAM; i++) {
+            stream[i] = microbench_encode(class->opcodes[rand() % class->n_opcodes]);
+        }
+
+        uint64_t best = UINT64_MAX;
+        for (int run = 0; run < MICROBENCH_RUNS; run++) {
+            for (int r = 1; r < 32; r++) {
+                mr->regs[r] = (uint32_t) r * 0x01010101 + 1; // Pas de division par zero
+            }
+            mr->regs[MICROBENCH_BASE] = PLATFORM_RAM_BASE + 0x1000;
+            uint64_t start = microbench_now_ns();
+            for (int n = 0; n < MICROBENCH_INSNS; n += MICROBENCH_STREAM) {
+                for (int i = 0; i < MICROBENCH_STREAM; i++) {
+                    mr->IR = stream[i];
+                    mr->PC = PLATFORM_RAM_BASE; // Les sauts ne sont pas suivis
+                    minirisc_decode_and_execute(mr);
+                }
+            }
+            uint64_t elapsed = microbench_now_ns() - start;
+            best = elapsed < best ? elapsed : best;
+        }
+        fprintf(out, "    {\"class\": \"%s\", \"instructions\": %d, \"ns_per_insn\": %.3f, \"mips\": %.2f}%s\n",
+                class->name, MICROBENCH_INSNS, (double) best / MICROBENCH_INSNS, MICROBENCH_INSNS * 1000.0 / best,
+                c + 1 < n_classes ? "," : "");
+    }
+    fprintf(out, "  ],\n");
+
+    free(stream);
+    minirisc_free(mr);
+    platform_free(platform);
+}
+
+static int microbench_device_read(void *opaque, access_type_t access_type, uint32_t offset, uint32_t *data) {
+    (void) opaque;
+    (void) access_type;
+    *data = offset;
+    return 0;
+}
+
+static int microbench_device_write(void *opaque, access_type_t access_type, uint32_t offset, uint32_t data) {
+    (void) opaque;
+    (void) access_type;
+    (void) offset;
+    (void) data;
+    return 0;
+}
+
+static void microbench_memory(FILE *out) {
+    static const struct {
+        access_type_t type;
+        uint32_t      width;
+    } widths[] = { { ACCESS_BYTE, 1 }, { ACCESS_HALF, 2 }, { ACCESS_WORD, 4 } };
+    static const struct {
+        const char *name;
+        uint32_t   base;
+        uint32_t   window;
+    } targets[] = { { "ram", PLATFORM_RAM_BASE, MICROBENCH_WINDOW }, { "mmio", MICROBENCH_DEVICE, PLATFORM_PAGE_SIZE } };
+    platform_t *platform = platform_new();
+    uint32_t sum = 0;
+    int first = 1;
+
+    platform_add_device(platform, "microbench", MICROBENCH_DEVICE, PLATFORM_PAGE_SIZE,
+                        microbench_device_read, microbench_device_write, NULL, NULL);
+
+    fprintf(out, "  \"memory\": [");
+    for (int t = 0; t < 2; t++) {
+        for (int w = 0; w < 3; w++) {
+            for (int write = 0; write <= 1; write++) {
+                uint32_t mask = (targets[t].window - 1) & ~(widths[w].width - 1);
+                uint64_t best = UINT64_MAX;
+                for (int run = 0; run < MICROBENCH_RUNS; run++) {
+                    uint64_t start = microbench_now_ns();
+                    for (uint32_t i = 0; i < MICROBENCH_ACCESS; i++) {
+                        uint32_t addr = targets[t].base + ((i * widths[w].width) & mask);
+                        if (write) {
+                            platform_write(platform, widths[w].type, addr, i);
+                        }
+                        else {
+                            uint32_t data;
+                            platform_read(platform, widths[w].type, addr, &data);
+                            sum += data;
+                        }
+                    }
+                    uint64_t elapsed = microbench_now_ns() - start;
+                    best = elapsed < best ? elapsed : best;
+                }
+                fprintf(out, "%s\n    {\"op\": \"%s\", \"target\": \"%s\", \"width\": %u, \"accesses\": %d, \"ns_per_access\": %.3f}",
+                        first ? "" : ",", write ? "write" : "read", targets[t].name, widths[w].width,
+                        MICROBENCH_ACCESS, (double) best / MICROBENCH_ACCESS);
+                first = 0;
+            }
+        }
+    }
+    fprintf(out, "\n  ],\n");
+    if (sum == 0x12345678) {
+        fprintf(stderr, "%u\n", sum); // Garde les lectures
+    }
+    platform_free(platform);
+}
+
+static void microbench_load_program(FILE *out) {
+    static const uint32_t sizes[] = { 4096, 65536, 1 << 20, 16 << 20 };
+    int n_sizes = sizeof(sizes) / sizeof(sizes[0]);
+    char path[] = "/tmp/microbench-XXXXXX";
+    int fd = mkstemp(path);
+    uint8_t *image = (uint8_t*) malloc(sizes[n_sizes - 1]);
+
+    if (fd < 0 || image == NULL) {
+        fprintf(stderr, "Erreur : impossible de creer l'image de test\n");
+        fprintf(out, "  \"load_program\": []\n");
+        free(image);
+        return;
+    }
+    for (uint32_t i = 0; i < sizes[n_sizes - 1]; i++) {
+        image[i] = (uint8_t) (i * 2654435761u >> 24);
+    }
+
+    // Le processeur branche sur la plateforme voit chaque chargement (code_write).
+    platform_t *platform = platform_new();
+    minirisc_t *mr = minirisc_new(PLATFORM_RAM_BASE, platform);
+    fprintf(out, "  \"load_program\": [");
+    for (int s = 0; s < n_sizes; s++) {
+        if (ftruncate(fd, 0) != 0 || pwrite(fd, image, sizes[s], 0) != (ssize_t) sizes[s]) {
+            fprintf(stderr, "Erreur : ecriture de l'image de test\n");
+            break;
+        }
+        uint64_t best = UINT64_MAX;
+        for (int run = 0; run < MICROBENCH_RUNS; run++) {
+            uint64_t start = microbench_now_ns();
+            platform_load_program(platform, path);
+            uint64_t elapsed = microbench_now_ns() - start;
+            best = elapsed < best ? elapsed : best;
+        }
+        // Separateur avant chaque entree : une erreur laisse un JSON valide.
+        fprintf(out, "%s\n    {\"bytes\": %u, \"us\": %.1f, \"mb_per_s\": %.1f}", s == 0 ? "" : ",", sizes[s],
+                best / 1000.0, sizes[s] * 1000.0 / best);
+    }
+    fprintf(out, "\n  ]\n");
+
+    minirisc_free(mr);
+    platform_free(platform);
+    close(fd);
+    unlink(path);
+    free(image);
+}
+
+int main(int argc, char **argv) {
+    FILE *out = stdout;
+    if (argc > 1) {
+        out = fopen(argv[1], "w");
+        if (out == NULL) {
+            fprintf(stderr, "Erreur : impossible d'ouvrir %s\n", argv[1]);
+            return 1;
+        }
+    }
+
+    fprintf(out, "{\n");
+    microbench_decode_execute(out);
+    microbench_memory(out);
+    microbench_load_program(out);
+    fprintf(out, "}\n");
+
+    if (out != stdout) {
+        fclose(out);
+    }
+    return 0;
+}
@@ -0,0 +1,308 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "bpred.h"
+
+#define BPRED_DEFAULT_BITS 12
+#define BPRED_MAX_BITS     24
+
+static const char * const bpred_names[] = { "nottaken", "bimodal", "gshare", "tournament" };
+
+static uint8_t* bpred_counters(uint32_t bits) {
+    uint8_t *table = (uint8_t*) malloc((size_t) 1 << bits);
+    memset(table, 1, (size_t) 1 << bits); // Faiblement non pris
+    return table;
+}
+
+static void bpred_add_model(bpred_t *bp, bpred_kind_t kind, uint32_t bits) {
+    bpred_model_t *model = &bp->models[bp->n_models++];
+    model->kind = kind;
+    model->bits = kind == BPRED_NOT_TAKEN ? 0 : bits;
+    model->mask = (1u << model->bits) - 1;
+    if (kind == BPRED_BIMODAL || kind == BPRED_TOURNAMENT) {
+        model->bimodal = bpred_counters(bits);
+    }
+    if (kind == BPRED_GSHARE || kind == BPRED_TOURNAMENT) {
+        model->gshare = bpred_counters(bits);
+    }
+    if (kind == BPRED_TOURNAMENT) {
+        model->chooser = bpred_counters(bits);
+    }
+}
+
+/**
+ * Analyse un element de la specification. Renvoie 0, -1 s'il est invalide.
+ */
+static int bpred_parse(bpred_t *bp, const char *item, size_t length, uint32_t *btb, uint32_t *ras) {
+    const char *colon = memchr(item, ':', length);
+    size_t name_length = colon != NULL ? (size_t) (colon - item) : length;
+    uint32_t value = 0;
+
+    if (colon != NULL) {
+        char *end;
+        value = (uint32_t) strtoul(colon + 1, &end, 0);
+        if (end != item + length || end == colon + 1) {
+            return -1;
+        }
+    }
+    if (name_length == 3 && strncmp(item, "all", 3) == 0 && colon == NULL) {
+        for (int kind = BPRED_NOT_TAKEN; kind <= BPRED_TOURNAMENT; kind++) {
+            if (bp->n_models == BPRED_MAX_MODELS) {
+                return -1;
+            }
+            bpred_add_model(bp, (bpred_kind_t) kind, BPRED_DEFAULT_BITS);
+        }
+        return 0;
+    }
+    if (name_length == 3 && strncmp(item, "btb", 3) == 0) {
+        *btb = value;
+        return value != 0 && (value & (value - 1)) == 0 ? 0 : -1;
+    }
+    if (name_length == 3 && strncmp(item, "ras", 3) == 0) {
+        *ras = value;
+        return value != 0 ? 0 : -1;
+    }
+    for (int kind = BPRED_NOT_TAKEN; kind <= BPRED_TOURNAMENT; kind++) {
+        if (strlen(bpred_names[kind]) == name_length && strncmp(item, bpred_names[kind], name_length) == 0) {
+            uint32_t bits = colon != NULL ? value : BPRED_DEFAULT_BITS;
+            if (bp->n_models == BPRED_MAX_MODELS || bits == 0 || bits > BPRED_MAX_BITS
+                || (kind == BPRED_NOT_TAKEN && colon != NULL)) {
+                return -1;
+            }
+            bpred_add_model(bp, (bpred_kind_t) kind, bits);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+bpred_t* bpred_new(const char *spec) {
+    bpred_t *bp = (bpred_t*) calloc(1, sizeof(bpred_t));
+    uint32_t btb = 512;
+    uint32_t ras = 16;
+
+    while (*spec != '\0') {
+        size_t length = strcspn(spec, ",");
+        if (bpred_parse(bp, spec, length, &btb, &ras) != 0) {
+            bpred_free(bp);
+            return NULL;
+        }
+        spec += length;
+        if (*spec == ',') {
+            spec++;
+        }
+    }
+    bp->btb_tags = (uint32_t*) calloc(btb, sizeof(uint32_t));
+    bp->btb_targets = (uint32_t*) calloc(btb, sizeof(uint32_t));
+    bp->btb_mask = btb - 1;
+    bp->ras = (uint32_t*) calloc(ras, sizeof(uint32_t));
+    bp->ras_size = ras;
+    bp->capacity = 1024;
+    bp->table = (bpred_branch_t*) calloc(bp->capacity, sizeof(bpred_branch_t));
+    return bp;
+}
+
+void bpred_free(bpred_t *bp) {
+    for (int i = 0; i < bp->n_models; i++) {
+        free(bp->models[i].bimodal);
+        free(bp->models[i].gshare);
+        free(bp->models[i].chooser);
+    }
+    free(bp->btb_tags);
+    free(bp->btb_targets);
+    free(bp->ras);
+    free(bp->table);
+    free(bp);
+}
+
+static inline void bpred_train(uint8_t *counter, int taken) {
+    if (taken) {
+        if (*counter < 3) {
+            (*counter)++;
+        }
+    }
+    else if (*counter > 0) {
+        (*counter)--;
+    }
+}
+
+/**
+ * Predit le branchement a PC puis apprend son issue. Renvoie 1 si la
+ * prediction etait fausse.
+ */
+static int bpred_predict(bpred_model_t *model, uint32_t PC, int taken) {
+    uint32_t index = (PC >> 2) & model->mask;
+    uint32_t global = ((PC >> 2) ^ model->history) & model->mask;
+    int prediction;
+
+    switch (model->kind) {
+        case BPRED_BIMODAL:
+            prediction = model->bimodal[index] >= 2;
+            bpred_train(&model->bimodal[index], taken);
+            break;
+        case BPRED_GSHARE:
+            prediction = model->gshare[global] >= 2;
+            bpred_train(&model->gshare[global], taken);
+            break;
+        case BPRED_TOURNAMENT: {
+            int local = model->bimodal[index] >= 2;
+            int shared = model->gshare[global] >= 2;
+            prediction = model->chooser[index] >= 2 ? shared : local;
+            if (local != shared) {
+                bpred_train(&model->chooser[index], shared == taken);
+            }
+            bpred_train(&model->bimodal[index], taken);
+            bpred_train(&model->gshare[global], taken);
+            break;
+        }
+        default:
+            prediction = 0;
+            break;
+    }
+    model->history = (model->history << 1) | (taken != 0);
+    return prediction != taken;
+}
+
+static void bpred_grow(bpred_t *bp) {
+    bpred_branch_t *old = bp->table;
+    uint32_t old_capacity = bp->capacity;
+
+    bp->capacity *= 2;
+    bp->table = (bpred_branch_t*) calloc(bp->capacity, sizeof(bpred_branch_t));
+    for (uint32_t i = 0; i < old_capacity; i++) {
+        if (old[i].executions != 0) {
+            uint32_t j = (old[i].PC >> 2) & (bp->capacity - 1);
+            while (bp->table[j].executions != 0) {
+                j = (j + 1) & (bp->capacity - 1);
+            }
+            bp->table[j] = old[i];
+        }
+    }
+    free(old);
+}
+
+void bpred_branch(bpred_t *bp, uint32_t PC, int taken) {
+    if (2 * (bp->n_branches + 1) > bp->capacity) {
+        bpred_grow(bp);
+    }
+    uint32_t j = (PC >> 2) & (bp->capacity - 1);
+    while (bp->table[j].executions != 0 && bp->table[j].PC != PC) {
+        j = (j + 1) & (bp->capacity - 1);
+    }
+    bpred_branch_t *branch = &bp->table[j];
+    if (branch->executions == 0) {
+        branch->PC = PC;
+        bp->n_branches++;
+    }
+    branch->executions++;
+    branch->taken += taken != 0;
+    bp->branches++;
+    bp->taken += taken != 0;
+
+    for (int i = 0; i < bp->n_models; i++) {
+        if (bpred_predict(&bp->models[i], PC, taken)) {
+            bp->models[i].mispredicts++;
+            branch->mispredicts[i]++;
+        }
+    }
+}
+
+void bpred_jump(bpred_t *bp, uint32_t PC, uint32_t target, int is_call, int is_return) {
+    if (is_return) {
+        bp->returns++;
+        if (bp->ras_depth == 0 || bp->ras[(bp->ras_top - 1) % bp->ras_size] != target) {
+            bp->ras_mispredicts++;
+        }
+        if (bp->ras_depth > 0) {
+            bp->ras_top--;
+            bp->ras_depth--;
+        }
+        return;
+    }
+
+    bp->jumps++;
+    uint32_t index = (PC >> 2) & bp->btb_mask;
+    if (bp->btb_tags[index] != PC || bp->btb_targets[index] != target) {
+        bp->btb_mispredicts++;
+        bp->btb_tags[index] = PC;
+        bp->btb_targets[index] = target;
+    }
+    if (is_call) {
+        bp->ras[bp->ras_top % bp->ras_size] = PC + 4;
+        bp->ras_top++;
+        if (bp->ras_depth < bp->ras_size) {
+            bp->ras_depth++;
+        }
+    }
+}
+
+typedef struct {
+    const bpred_branch_t *branch;
+    uint64_t errors; // Erreurs de tous les modeles
+} bpred_rank_t;
+
+static int bpred_rank_compare(const void *a, const void *b) {
+    const bpred_rank_t *x = (const bpred_rank_t*) a;
+    const bpred_rank_t *y = (const bpred_rank_t*) b;
+    if (x->errors != y->errors) {
+        return x->errors < y->errors ? 1 : -1;
+    }
+    return x->branch->PC < y->branch->PC ? -1 : x->branch->PC > y->branch->PC;
+}
+
+static double bpred_mpki(uint64_t mispredicts, uint64_t instructions) {
+    return instructions ? 1000.0 * mispredicts / instructions : 0.0;
+}
+
+void bpred_report(const bpred_t *bp, uint64_t instructions, FILE *out) {
+    char name[32];
+
+    fprintf(out, "Predicteurs : %" PRIu64 " instructions, %" PRIu64 " branchements conditionnels (%.2f %% pris)\n",
+            instructions, bp->branches, bp->branches ? 100.0 * bp->taken / bp->branches : 0.0);
+    fprintf(out, "  modele             erreurs     taux      MPKI\n");
+    for (int i = 0; i < bp->n_models; i++) {
+        const bpred_model_t *model = &bp->models[i];
+        if (model->kind == BPRED_NOT_TAKEN) {
+            snprintf(name, sizeof(name), "%s", bpred_names[model->kind]);
+        }
+        else {
+            snprintf(name, sizeof(name), "%s:%u", bpred_names[model->kind], model->bits);
+        }
+        fprintf(out, "  %-14s %11" PRIu64 "  %6.2f %%  %8.3f\n", name, model->mispredicts,
+                bp->branches ? 100.0 * model->mispredicts / bp->branches : 0.0, bpred_mpki(model->mispredicts, instructions));
+    }
+    fprintf(out, "  BTB %u entrees : %" PRIu64 " sauts, %" PRIu64 " erreurs (%.2f %%, MPKI %.3f)\n",
+            bp->btb_mask + 1, bp->jumps, bp->btb_mispredicts,
+            bp->jumps ? 100.0 * bp->btb_mispredicts / bp->jumps : 0.0, bpred_mpki(bp->btb_mispredicts, instructions));
+    fprintf(out, "  RAS %u entrees : %" PRIu64 " retours, %" PRIu64 " erreurs (%.2f %%, MPKI %.3f)\n",
+            bp->ras_size, bp->returns, bp->ras_mispredicts,
+            bp->returns ? 100.0 * bp->ras_mispredicts / bp->returns : 0.0, bpred_mpki(bp->ras_mispredicts, instructions));
+
+    if (bp->n_models == 0) {
+        return;
+    }
+    bpred_rank_t *ranks = (bpred_rank_t*) malloc((bp->n_branches + 1) * sizeof(bpred_rank_t));
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < bp->capacity; i++) {
+        if (bp->table[i].executions != 0) {
+            ranks[n].branch = &bp->table[i];
+            ranks[n].errors = 0;
+            for (int j = 0; j < bp->n_models; j++) {
+                ranks[n].errors += bp->table[i].mispredicts[j];
+            }
+            n++;
+        }
+    }
+    qsort(ranks, n, sizeof(bpred_rank_t), bpred_rank_compare);
+
+    fprintf(out, "  PC        executions   %% pris  erreurs par modele\n");
+    for (uint32_t i = 0; i < n && i < BPRED_TOP; i++) {
+        const bpred_branch_t *branch = ranks[i].branch;
+        fprintf(out, "  %08x  %10" PRIu64 "  %6.2f ", branch->PC, branch->executions, 100.0 * branch->taken / branch->executions);
+        for (int j = 0; j < bp->n_models; j++) {
+            fprintf(out, " %10" PRIu64, branch->mispredicts[j]);
+        }
+        fprintf(out, "\n");
+    }
+    free(ranks);
+}
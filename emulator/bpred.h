@@ -0,0 +1,106 @@
+#ifndef BPRED_H
+#define BPRED_H
+#include <inttypes.h>
+#include <stdio.h>
+
+/*
+ * Evaluation de predicteurs de branchement. Plusieurs modeles observent en
+ * parallele les memes branchements conditionnels (BEQ a BGEU) : une seule
+ * execution suffit pour les comparer. Les sauts (JAL/JALR) sont predits par
+ * un BTB, les retours par une pile d'adresses de retour (RAS).
+ */
+
+#define BPRED_MAX_MODELS 8
+#define BPRED_TOP        20 // Branchements du classement du rapport
+
+typedef enum {
+    BPRED_NOT_TAKEN = 0, // Static: never taken
+    BPRED_BIMODAL = 1,   // 2-bit counters indexed by PC
+    BPRED_GSHARE = 2,    // 2-bit counters indexed by PC xor global history
+    BPRED_TOURNAMENT = 3 // Bimodal and gshare, with a per-PC chooser
+} bpred_kind_t;
+
+/**
+ * One conditional branch predictor. Tables hold 2-bit saturating counters
+ * (0-1: not taken, 2-3: taken).
+ */
+typedef struct {
+    bpred_kind_t kind;
+    uint32_t bits;       // log2 des entrees de chaque table
+    uint32_t mask;
+    uint32_t history;    // Historique global (gshare, tournament)
+    uint8_t  *bimodal;   // BPRED_BIMODAL, BPRED_TOURNAMENT
+    uint8_t  *gshare;    // BPRED_GSHARE, BPRED_TOURNAMENT
+    uint8_t  *chooser;   // BPRED_TOURNAMENT : 2-3 suit gshare, 0-1 suit bimodal
+    uint64_t mispredicts;
+} bpred_model_t;
+
+/**
+ * Statistics of one static branch.
+ */
+typedef struct {
+    uint32_t PC;
+    uint64_t executions; // 0 : entree libre
+    uint64_t taken;
+    uint64_t mispredicts[BPRED_MAX_MODELS];
+} bpred_branch_t;
+
+/**
+ * Predictors of a core and their statistics.
+ */
+typedef struct bpred {
+    bpred_model_t models[BPRED_MAX_MODELS];
+    int n_models;
+    uint32_t *btb_tags;     // PC du saut de chaque entree (0 : vide)
+    uint32_t *btb_targets;
+    uint32_t btb_mask;      // Entrees du BTB - 1
+    uint32_t *ras;
+    uint32_t ras_size;
+    uint32_t ras_top;       // Adresses empilees depuis le debut (la pile deborde en anneau)
+    uint32_t ras_depth;     // Entrees valides, au plus ras_size
+    uint64_t branches;
+    uint64_t taken;
+    uint64_t jumps;         // JAL/JALR hors retours
+    uint64_t btb_mispredicts;
+    uint64_t returns;
+    uint64_t ras_mispredicts;
+    bpred_branch_t *table;  // Table de hachage des branchements par PC
+    uint32_t n_branches;
+    uint32_t capacity;      // Puissance de 2
+} bpred_t;
+
+/**
+ * Create the predictors described by spec, a comma-separated list of
+ *   nottaken | bimodal[:BITS] | gshare[:BITS] | tournament[:BITS]
+ *   btb:ENTRIES | ras:DEPTH
+ * where BITS is log2 of the entries of each counter table (12 by default).
+ * "all" stands for one model of each kind. The BTB (512 entries) and the
+ * RAS (16 entries) are always simulated.
+ * @return The predictors, or NULL if spec is invalid.
+ */
+bpred_t* bpred_new(const char *spec);
+
+/**
+ * Free the predictors.
+ */
+void bpred_free(bpred_t *bp);
+
+/**
+ * Resolve the conditional branch at PC: every model predicts it, then
+ * learns the outcome.
+ */
+void bpred_branch(bpred_t *bp, uint32_t PC, int taken);
+
+/**
+ * Resolve the jump at PC to target. A call pushes PC + 4 on the RAS, a
+ * return is predicted by popping it; other jumps are predicted by the BTB.
+ */
+void bpred_jump(bpred_t *bp, uint32_t PC, uint32_t target, int is_call, int is_return);
+
+/**
+ * Print misprediction rates and MPKI per model, then the branches that
+ * were mispredicted the most.
+ * @param instructions Instructions executed while the predictors were set.
+ */
+void bpred_report(const bpred_t *bp, uint64_t instructions, FILE *out);
+#endif
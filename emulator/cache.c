@@ -0,0 +1,377 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+
+static const char * const cache_policy_names[] = { "lru", "fifo", "random" };
+
+void cache_setup_default(cache_setup_t *setup) {
+    memset(setup, 0, sizeof(cache_setup_t));
+    setup->l1i = (cache_config_t) { 16 * 1024, 2, 32, CACHE_LRU, 1, 0 };
+    setup->l1d = (cache_config_t) { 16 * 1024, 4, 32, CACHE_LRU, 1, 0 };
+    setup->l2 = (cache_config_t) { 0, 8, 64, CACHE_LRU, 1, 10 };
+    setup->memory_latency = 50;
+}
+
+static int cache_power_of_2(uint32_t n) {
+    return n != 0 && (n & (n - 1)) == 0;
+}
+
+static uint32_t cache_log2(uint32_t n) {
+    uint32_t log = 0;
+    while ((1u << log) < n) {
+        log++;
+    }
+    return log;
+}
+
+/**
+ * Lit un nombre avec un suffixe K ou M optionnel. Renvoie le caractere qui
+ * le suit, NULL si aucun nombre n'est lu.
+ */
+static const char* cache_parse_number(const char *s, uint32_t *value) {
+    char *end;
+    unsigned long n = strtoul(s, &end, 0);
+    if (end == s) {
+        return NULL;
+    }
+    if (*end == 'K' || *end == 'k') {
+        n *= 1024;
+        end++;
+    }
+    else if (*end == 'M' || *end == 'm') {
+        n *= 1024 * 1024;
+        end++;
+    }
+    *value = (uint32_t) n;
+    return end;
+}
+
+int cache_setup_parse(cache_setup_t *setup, const char *spec) {
+    cache_config_t config;
+    cache_config_t *level;
+    const char *s;
+
+    if (strncmp(spec, "mem=", 4) == 0) {
+        s = cache_parse_number(spec + 4, &setup->memory_latency);
+        return s != NULL && *s == '\0' ? 0 : -1;
+    }
+    if (strncmp(spec, "l1i=", 4) == 0) {
+        level = &setup->l1i;
+        s = spec + 4;
+    }
+    else if (strncmp(spec, "l1d=", 4) == 0) {
+        level = &setup->l1d;
+        s = spec + 4;
+    }
+    else if (strncmp(spec, "l2=", 3) == 0) {
+        level = &setup->l2;
+        s = spec + 3;
+    }
+    else {
+        return -1;
+    }
+
+    config = *level;
+    if ((s = cache_parse_number(s, &config.size)) == NULL || *s++ != ':'
+        || (s = cache_parse_number(s, &config.ways)) == NULL || *s++ != ':'
+        || (s = cache_parse_number(s, &config.line)) == NULL) {
+        return -1;
+    }
+    while (*s == ':') {
+        s++;
+        size_t length = strcspn(s, ":");
+        int found = 0;
+        for (int i = 0; i < 3; i++) {
+            if (strlen(cache_policy_names[i]) == length && strncmp(s, cache_policy_names[i], length) == 0) {
+                config.policy = (cache_policy_t) i;
+                found = 1;
+            }
+        }
+        if (length == 2 && (strncmp(s, "wb", 2) == 0 || strncmp(s, "wt", 2) == 0) && level != &setup->l1i) {
+            config.write_back = s[1] == 'b';
+            found = 1;
+        }
+        if (!found && level == &setup->l2) {
+            const char *end = cache_parse_number(s, &config.latency);
+            found = end == s + length;
+        }
+        if (!found) {
+            return -1;
+        }
+        s += length;
+    }
+    if (*s != '\0' || !cache_power_of_2(config.size) || !cache_power_of_2(config.ways)
+        || !cache_power_of_2(config.line) || config.line < 4 || config.ways * config.line > config.size) {
+        return -1;
+    }
+    *level = config;
+    return 0;
+}
+
+static void cache_init(cache_t *c, const char *name, const cache_config_t *config) {
+    uint32_t sets = config->size ? config->size / (config->ways * config->line) : 0;
+    c->config = *config;
+    c->name = name;
+    c->set_mask = sets - 1;
+    c->line_shift = cache_log2(config->line);
+    c->tags = (uint32_t*) calloc((size_t) sets * config->ways + 1, sizeof(uint32_t));
+    c->dirty = (uint8_t*) calloc((size_t) sets * config->ways + 1, sizeof(uint8_t));
+    c->random = 0x2545F491;
+}
+
+cache_model_t* cache_model_new(platform_t *plt, const cache_setup_t *setup) {
+    cache_model_t *model = (cache_model_t*) calloc(1, sizeof(cache_model_t));
+    cache_init(&model->l1i, "L1I", &setup->l1i);
+    cache_init(&model->l1d, "L1D", &setup->l1d);
+    cache_init(&model->l2, "L2", &setup->l2);
+    model->memory_latency = setup->memory_latency;
+    model->plt = plt;
+    model->pcs_capacity = 1024;
+    model->pcs = (cache_pc_t*) calloc(model->pcs_capacity, sizeof(cache_pc_t));
+    return model;
+}
+
+void cache_model_free(cache_model_t *model) {
+    cache_t *caches[] = { &model->l1i, &model->l1d, &model->l2 };
+    for (int i = 0; i < 3; i++) {
+        free(caches[i]->tags);
+        free(caches[i]->dirty);
+    }
+    free(model->pcs);
+    free(model);
+}
+
+static uint32_t cache_access(cache_model_t *model, cache_t *c, uint32_t addr, int write);
+
+/**
+ * Acces au niveau suivant c : le L2 s'il existe et que c est un L1, sinon
+ * la memoire. Renvoie sa latence pour une lecture ; une ecriture passe par
+ * le tampon d'ecriture et ne coute rien.
+ */
+static uint32_t cache_next(cache_model_t *model, cache_t *c, uint32_t addr, int write) {
+    if (c != &model->l2 && model->l2.config.size != 0) {
+        uint32_t stalls = model->l2.config.latency + cache_access(model, &model->l2, addr, write);
+        return write ? 0 : stalls;
+    }
+    return write ? 0 : model->memory_latency;
+}
+
+/**
+ * Acces a la ligne contenant addr dans c. Renvoie les cycles de penalite.
+ */
+static uint32_t cache_access(cache_model_t *model, cache_t *c, uint32_t addr, int write) {
+    uint32_t ways = c->config.ways;
+    uint32_t line = addr >> c->line_shift;
+    uint32_t *tags = &c->tags[(line & c->set_mask) * ways];
+    uint8_t *dirty = &c->dirty[(line & c->set_mask) * ways];
+    uint32_t tag = line + 1;
+    uint32_t i;
+
+    c->accesses++;
+    for (i = 0; i < ways; i++) {
+        if (tags[i] == tag) {
+            break;
+        }
+    }
+
+    if (i < ways) {
+        uint8_t was_dirty = dirty[i];
+        if (c->config.policy == CACHE_LRU && i > 0) {
+            // Ligne remise en tete de l'ensemble
+            memmove(&tags[1], &tags[0], i * sizeof(uint32_t));
+            memmove(&dirty[1], &dirty[0], i);
+            tags[0] = tag;
+            dirty[0] = was_dirty;
+            i = 0;
+        }
+        if (write) {
+            if (c->config.write_back) {
+                dirty[i] = 1;
+            }
+            else {
+                cache_next(model, c, addr, 1);
+            }
+        }
+        return 0;
+    }
+
+    c->misses++;
+    if (write && !c->config.write_back) {
+        cache_next(model, c, addr, 1); // Pas d'allocation sur ecriture
+        return 0;
+    }
+
+    uint32_t victim = ways - 1;
+    if (c->config.policy == CACHE_RANDOM) {
+        c->random ^= c->random << 13;
+        c->random ^= c->random >> 17;
+        c->random ^= c->random << 5;
+        victim = c->random & (ways - 1);
+    }
+    if (tags[victim] != 0 && dirty[victim]) {
+        c->writebacks++;
+        cache_next(model, c, (tags[victim] - 1) << c->line_shift, 1);
+    }
+    uint32_t stalls = cache_next(model, c, addr, 0);
+
+    memmove(&tags[1], &tags[0], victim * sizeof(uint32_t));
+    memmove(&dirty[1], &dirty[0], victim);
+    tags[0] = tag;
+    dirty[0] = write != 0;
+    return stalls;
+}
+
+/**
+ * Region de RAM contenant addr, CACHE_REGIONS - 1 pour les peripheriques.
+ */
+static uint32_t cache_region(const cache_model_t *model, uint32_t addr) {
+    const platform_t *plt = model->plt;
+    for (int i = 0; i < plt->n_rams; i++) {
+        if (addr - plt->rams[i].base < plt->rams[i].size) {
+            return i;
+        }
+    }
+    return CACHE_REGIONS - 1;
+}
+
+static void cache_grow_pcs(cache_model_t *model) {
+    cache_pc_t *old = model->pcs;
+    uint32_t old_capacity = model->pcs_capacity;
+
+    model->pcs_capacity *= 2;
+    model->pcs = (cache_pc_t*) calloc(model->pcs_capacity, sizeof(cache_pc_t));
+    for (uint32_t i = 0; i < old_capacity; i++) {
+        if (old[i].misses != 0) {
+            uint32_t j = (old[i].PC >> 2) & (model->pcs_capacity - 1);
+            while (model->pcs[j].misses != 0) {
+                j = (j + 1) & (model->pcs_capacity - 1);
+            }
+            model->pcs[j] = old[i];
+        }
+    }
+    free(old);
+}
+
+/**
+ * Impute un defaut et ses cycles de penalite a PC et a la region de addr.
+ */
+static void cache_miss(cache_model_t *model, uint32_t PC, cache_region_t *region, uint32_t stalls) {
+    region->misses++;
+    region->stalls += stalls;
+    model->stalls += stalls;
+
+    if (2 * (model->n_pcs + 1) > model->pcs_capacity) {
+        cache_grow_pcs(model);
+    }
+    // Une entree est utilisee des qu'elle a un defaut
+    uint32_t j = (PC >> 2) & (model->pcs_capacity - 1);
+    while (model->pcs[j].misses != 0 && model->pcs[j].PC != PC) {
+        j = (j + 1) & (model->pcs_capacity - 1);
+    }
+    if (model->pcs[j].misses == 0) {
+        model->pcs[j].PC = PC;
+        model->n_pcs++;
+    }
+    model->pcs[j].misses++;
+    model->pcs[j].stalls += stalls;
+}
+
+uint32_t cache_fetch(cache_model_t *model, uint32_t PC) {
+    cache_region_t *region = &model->regions[cache_region(model, PC)];
+    uint64_t misses = model->l1i.misses;
+
+    region->accesses++;
+    uint32_t stalls = cache_access(model, &model->l1i, PC, 0);
+    if (model->l1i.misses != misses) {
+        cache_miss(model, PC, region, stalls);
+    }
+    return stalls;
+}
+
+uint32_t cache_data(cache_model_t *model, uint32_t PC, uint32_t addr, int write) {
+    uint32_t index = cache_region(model, addr);
+    cache_region_t *region = &model->regions[index];
+    uint64_t misses = model->l1d.misses;
+
+    region->accesses++;
+    if (index == CACHE_REGIONS - 1) {
+        return 0; // Peripherique : acces non cache
+    }
+    uint32_t stalls = cache_access(model, &model->l1d, addr, write);
+    if (model->l1d.misses != misses) {
+        cache_miss(model, PC, region, stalls);
+    }
+    return stalls;
+}
+
+static void cache_report_level(const cache_t *c, FILE *out) {
+    if (c->config.size == 0) {
+        return;
+    }
+    char size[16];
+    if (c->config.size >= 1024) {
+        snprintf(size, sizeof(size), "%u Ko", c->config.size / 1024);
+    }
+    else {
+        snprintf(size, sizeof(size), "%u o", c->config.size);
+    }
+    fprintf(out, "  %-3s %7s, %u voies, lignes de %u o, %s%s : %" PRIu64 " acces, %" PRIu64 " defauts (%.2f %%)",
+            c->name, size, c->config.ways, c->config.line, cache_policy_names[c->config.policy],
+            strcmp(c->name, "L1I") == 0 ? "" : c->config.write_back ? ", ecriture differee" : ", ecriture immediate",
+            c->accesses, c->misses, c->accesses ? 100.0 * c->misses / c->accesses : 0.0);
+    if (c->writebacks > 0) {
+        fprintf(out, ", %" PRIu64 " lignes reecrites", c->writebacks);
+    }
+    fprintf(out, "\n");
+}
+
+static int cache_pc_compare(const void *a, const void *b) {
+    const cache_pc_t *x = (const cache_pc_t*) a;
+    const cache_pc_t *y = (const cache_pc_t*) b;
+    if (x->stalls != y->stalls) {
+        return x->stalls < y->stalls ? 1 : -1;
+    }
+    return x->PC < y->PC ? -1 : x->PC > y->PC;
+}
+
+void cache_report(const cache_model_t *model, FILE *out) {
+    fprintf(out, "Caches : %" PRIu64 " cycles de penalite (memoire : %u cycles", model->stalls, model->memory_latency);
+    if (model->l2.config.size != 0) {
+        fprintf(out, ", L2 : %u cycles", model->l2.config.latency);
+    }
+    fprintf(out, ")\n");
+    cache_report_level(&model->l1i, out);
+    cache_report_level(&model->l1d, out);
+    cache_report_level(&model->l2, out);
+
+    fprintf(out, "  region                    acces       defauts L1   cycles de penalite\n");
+    for (int i = 0; i < CACHE_REGIONS; i++) {
+        const cache_region_t *region = &model->regions[i];
+        if (region->accesses == 0) {
+            continue;
+        }
+        if (i == CACHE_REGIONS - 1) {
+            fprintf(out, "  %-21s", "peripheriques");
+        }
+        else {
+            const platform_ram_t *ram = &model->plt->rams[i];
+            fprintf(out, "  %08x-%08x     ", ram->base, ram->base + ram->size - 1);
+        }
+        fprintf(out, "  %12" PRIu64 "  %12" PRIu64 "  %14" PRIu64 "\n", region->accesses, region->misses, region->stalls);
+    }
+
+    cache_pc_t *pcs = (cache_pc_t*) malloc((model->n_pcs + 1) * sizeof(cache_pc_t));
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < model->pcs_capacity; i++) {
+        if (model->pcs[i].misses != 0) {
+            pcs[n++] = model->pcs[i];
+        }
+    }
+    qsort(pcs, n, sizeof(cache_pc_t), cache_pc_compare);
+    fprintf(out, "  PC          defauts   cycles de penalite\n");
+    for (uint32_t i = 0; i < n && i < CACHE_TOP; i++) {
+        fprintf(out, "  %08x  %9" PRIu64 "  %14" PRIu64 "\n", pcs[i].PC, pcs[i].misses, pcs[i].stalls);
+    }
+    free(pcs);
+}
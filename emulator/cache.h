@@ -0,0 +1,139 @@
+#ifndef CACHE_H
+#define CACHE_H
+#include <inttypes.h>
+#include <stdio.h>
+#include "platform.h"
+
+/*
+ * Modele de caches : L1 instructions, L1 donnees et L2 unifie optionnel,
+ * simules sur les acces du coeur (voir minirisc_set_caches()). Le modele ne
+ * garde que les etiquettes, les donnees restent dans la RAM de la plateforme.
+ *
+ * Temps : un acces servi par L1 ne coute rien de plus que l'instruction. Un
+ * defaut de L1 coute la latence du L2, plus celle de la memoire si le L2 est
+ * absent ou manque aussi. Les ecritures vers le niveau suivant (ecriture
+ * immediate, lignes modifiees evincees) passent par un tampon d'ecriture et
+ * ne bloquent pas le coeur.
+ */
+
+#define CACHE_REGIONS (PLATFORM_MAX_RAMS + 1) // Regions de RAM, puis les peripheriques (jamais caches)
+#define CACHE_TOP     20                      // PC du classement du rapport
+
+typedef enum {
+    CACHE_LRU = 0,   // Least recently used
+    CACHE_FIFO = 1,  // Oldest line first
+    CACHE_RANDOM = 2 // Pseudo-random victim
+} cache_policy_t;
+
+/**
+ * Geometry and behaviour of one cache level.
+ */
+typedef struct {
+    uint32_t size;         // Bytes, 0 when the level is absent
+    uint32_t ways;         // Associativity
+    uint32_t line;         // Line size in bytes
+    cache_policy_t policy;
+    int      write_back;   // 1: write-back and write-allocate, 0: write-through without write-allocate
+    uint32_t latency;      // Cycles to get a line from this level (L2 only, L1 hits are free)
+} cache_config_t;
+
+/**
+ * Configuration of the whole hierarchy, filled by cache_setup_parse().
+ */
+typedef struct {
+    cache_config_t l1i;
+    cache_config_t l1d;
+    cache_config_t l2;
+    uint32_t memory_latency; // Cycles to get a line from memory
+} cache_setup_t;
+
+/**
+ * One simulated cache. For each set, `tags` holds the lines present, most
+ * recently used (LRU) or most recently filled (FIFO) first.
+ */
+typedef struct cache {
+    cache_config_t config;
+    const char *name;
+    uint32_t set_mask;
+    uint32_t line_shift;
+    uint32_t *tags;     // sets * ways : numero de ligne + 1, 0 si l'emplacement est vide
+    uint8_t  *dirty;    // sets * ways
+    uint32_t random;    // Etat du generateur pour CACHE_RANDOM
+    uint64_t accesses;
+    uint64_t misses;
+    uint64_t writebacks; // Lignes modifiees evincees
+} cache_t;
+
+typedef struct {
+    uint64_t accesses;
+    uint64_t misses;   // Defauts de L1
+    uint64_t stalls;   // Cycles de penalite
+} cache_region_t;
+
+typedef struct {
+    uint32_t PC;
+    uint64_t misses;
+    uint64_t stalls;
+} cache_pc_t;
+
+/**
+ * Cache hierarchy of a core, with its statistics.
+ */
+typedef struct cache_model {
+    cache_t  l1i;
+    cache_t  l1d;
+    cache_t  l2;              // l2.config.size == 0 : pas de L2
+    uint32_t memory_latency;
+    platform_t *plt;          // Pour classer les adresses par region
+    uint64_t stalls;          // Cycles de penalite au total
+    cache_region_t regions[CACHE_REGIONS];
+    cache_pc_t *pcs;          // Table de hachage des PC ayant cause un defaut
+    uint32_t n_pcs;
+    uint32_t pcs_capacity;    // Puissance de 2
+} cache_model_t;
+
+/**
+ * Default hierarchy: 16 KB 2-way L1I and 16 KB 4-way write-back L1D with
+ * 32-byte lines, no L2, 50-cycle memory.
+ */
+void cache_setup_default(cache_setup_t *setup);
+
+/**
+ * Change one level of setup from a specification:
+ *   l1i=SIZE:WAYS:LINE[:lru|fifo|random]
+ *   l1d=SIZE:WAYS:LINE[:lru|fifo|random][:wb|wt]
+ *   l2=SIZE:WAYS:LINE[:lru|fifo|random][:wb|wt][:LATENCY]
+ *   mem=LATENCY
+ * SIZE accepts a K or M suffix. Sizes, ways and lines must be powers of 2.
+ * @return 0 on success, -1 if the specification is invalid.
+ */
+int cache_setup_parse(cache_setup_t *setup, const char *spec);
+
+/**
+ * Create empty caches for the cores of plt.
+ */
+cache_model_t* cache_model_new(platform_t *plt, const cache_setup_t *setup);
+
+/**
+ * Free the caches.
+ */
+void cache_model_free(cache_model_t *model);
+
+/**
+ * Simulate the fetch of the instruction at PC.
+ * @return The stall cycles it costs.
+ */
+uint32_t cache_fetch(cache_model_t *model, uint32_t PC);
+
+/**
+ * Simulate a load (write == 0) or a store made by the instruction at PC.
+ * @return The stall cycles it costs.
+ */
+uint32_t cache_data(cache_model_t *model, uint32_t PC, uint32_t addr, int write);
+
+/**
+ * Print hit and miss rates per cache, then stall cycles per memory region
+ * and for the PCs that cost the most.
+ */
+void cache_report(const cache_model_t *model, FILE *out);
+#endif
@@ -0,0 +1,304 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "console.h"
+
+static uint64_t console_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+/**
+ * Ecrit n octets sur fd en entier, malgre les ecritures partielles.
+ */
+static void console_write_all(int fd, const char *data, uint32_t n) {
+    uint32_t done = 0;
+    if (fd == STDOUT_FILENO) {
+        fflush(stdout); // Ce que l'emulateur a deja ecrit via stdio doit passer avant
+    }
+    while (done < n) {
+        ssize_t written = write(fd, data + done, n - done);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            break; // Sortie fermee ou pleine : la suite est perdue, comme avec printf
+        }
+        done += (uint32_t) written;
+    }
+}
+
+/**
+ * Attend que le thread libere de la place dans l'anneau, plein a head.
+ */
+static void console_wait_room(console_t *console, uint32_t head) {
+    pthread_mutex_lock(&console->lock);
+    __atomic_store_n(&console->waiting, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (head - __atomic_load_n(&console->ring_tail, __ATOMIC_RELAXED) == CONSOLE_RING_SIZE) {
+        pthread_cond_wait(&console->drained, &console->lock);
+    }
+    __atomic_store_n(&console->waiting, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&console->lock);
+}
+
+/**
+ * Publie n octets dans l'anneau (cote coeur) et reveille le thread s'il dort.
+ * Si l'anneau est plein, attend que le thread le vide, ou perd l'exces si
+ * console->drop.
+ */
+static void console_push(console_t *console, const char *data, uint32_t n) {
+    while (n > 0) {
+        uint32_t head = console->ring_head;
+        uint32_t room = CONSOLE_RING_SIZE - (head - __atomic_load_n(&console->ring_tail, __ATOMIC_ACQUIRE));
+        uint32_t index = head & (CONSOLE_RING_SIZE - 1);
+        uint32_t chunk, first;
+
+        if (room == 0) {
+            if (console->drop) {
+                console->dropped += n;
+                return;
+            }
+            console_wait_room(console, head);
+            continue;
+        }
+        chunk = n < room ? n : room;
+        first = chunk < CONSOLE_RING_SIZE - index ? chunk : CONSOLE_RING_SIZE - index;
+        memcpy(console->ring + index, data, first);
+        memcpy(console->ring, data + first, chunk - first);
+        __atomic_store_n(&console->ring_head, head + chunk, __ATOMIC_RELEASE);
+        data += chunk;
+        n -= chunk;
+
+        // Le thread publie sleeping puis relit ring_head : l'un des deux voit forcement l'autre.
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&console->sleeping, __ATOMIC_RELAXED)) {
+            pthread_mutex_lock(&console->lock);
+            pthread_cond_signal(&console->wake);
+            pthread_mutex_unlock(&console->lock);
+        }
+    }
+}
+
+static void* console_writer(void *arg) {
+    console_t *console = (console_t*) arg;
+    uint32_t tail = console->ring_tail;
+
+    for (;;) {
+        uint32_t head = __atomic_load_n(&console->ring_head, __ATOMIC_ACQUIRE);
+        if (head != tail) {
+            // Jusqu'a la fin de l'anneau au plus : le reste part au tour suivant.
+            uint32_t index = tail & (CONSOLE_RING_SIZE - 1);
+            uint32_t n = head - tail < CONSOLE_RING_SIZE - index ? head - tail : CONSOLE_RING_SIZE - index;
+            console_write_all(console->fd, console->ring + index, n);
+            tail += n;
+            __atomic_store_n(&console->ring_tail, tail, __ATOMIC_RELEASE);
+            // Meme protocole que sleeping, dans l'autre sens.
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&console->waiting, __ATOMIC_RELAXED)) {
+                pthread_mutex_lock(&console->lock);
+                pthread_cond_signal(&console->drained);
+                pthread_mutex_unlock(&console->lock);
+            }
+            continue;
+        }
+        if (__atomic_load_n(&console->stop, __ATOMIC_ACQUIRE)) {
+            if (__atomic_load_n(&console->ring_head, __ATOMIC_ACQUIRE) == tail) {
+                return NULL;
+            }
+            continue;
+        }
+        pthread_mutex_lock(&console->lock);
+        __atomic_store_n(&console->sleeping, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&console->ring_head, __ATOMIC_RELAXED) == tail
+            && !__atomic_load_n(&console->stop, __ATOMIC_RELAXED)) {
+            pthread_cond_wait(&console->wake, &console->lock);
+        }
+        __atomic_store_n(&console->sleeping, 0, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&console->lock);
+    }
+}
+
+void console_flush(console_t *console) {
+    if (console->length == 0) {
+        return;
+    }
+    if (console->ring != NULL) {
+        console_push(console, console->buffer, console->length);
+    }
+    else {
+        console_write_all(console->fd, console->buffer, console->length);
+    }
+    console->length = 0;
+}
+
+/**
+ * Ajoute n octets au tampon et le vide si une des conditions d'envoi est remplie.
+ */
+static void console_put(console_t *console, const char *s, uint32_t n) {
+    int newline = 0;
+    if (console->length + n > CONSOLE_BUFFER_SIZE) {
+        console_flush(console);
+    }
+    if (console->length == 0) {
+        console->deadline = console_now() + CONSOLE_FLUSH_NS;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        newline |= s[i] == '\n';
+        console->buffer[console->length++] = s[i];
+    }
+    if (newline || console->length == CONSOLE_BUFFER_SIZE || console_now() >= console->deadline) {
+        console_flush(console);
+    }
+}
+
+void console_write_string(console_t *console, const char *s, uint32_t n) {
+    while (n > 0) {
+        uint32_t chunk = n < CONSOLE_BUFFER_SIZE ? n : CONSOLE_BUFFER_SIZE; // console_put() tient dans le tampon
+        console_put(console, s, chunk);
+        s += chunk;
+        n -= chunk;
+    }
+}
+
+static int console_read(void *opaque, access_type_t access_type, uint32_t offset, uint32_t *data) {
+    (void) opaque;
+    (void) access_type;
+    switch (offset) {
+        case CONSOLE_PUTC:
+        case CONSOLE_PUTD:
+        case CONSOLE_PUTX:
+            *data = 0; // Registres en ecriture seule
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+static int console_write(void *opaque, access_type_t access_type, uint32_t offset, uint32_t data) {
+    console_t *console = (console_t*) opaque;
+    char digits[12];
+    uint32_t n = sizeof(digits);
+    uint32_t value = data;
+    (void) access_type;
+    // Conversion a la main : c'est le cout de printf que ce peripherique evite.
+    switch (offset) {
+        case CONSOLE_PUTC:
+            digits[0] = (char) data;
+            console_put(console, digits, 1);
+            return 0;
+        case CONSOLE_PUTD:
+            if ((int32_t) data < 0) {
+                value = 0u - data;
+            }
+            do {
+                digits[--n] = (char) ('0' + value % 10);
+                value /= 10;
+            } while (value != 0);
+            if ((int32_t) data < 0) {
+                digits[--n] = '-';
+            }
+            console_put(console, digits + n, sizeof(digits) - n);
+            return 0;
+        case CONSOLE_PUTX:
+            do {
+                digits[--n] = "0123456789abcdef"[value & 0xF];
+                value >>= 4;
+            } while (value != 0);
+            console_put(console, digits + n, sizeof(digits) - n);
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+console_t* console_init(platform_t *plt) {
+    console_t *console = (console_t*) malloc(sizeof(console_t));
+    console->fd = STDOUT_FILENO;
+    console->length = 0;
+    console->deadline = 0;
+    console->ring_head = 0;
+    console->ring_tail = 0;
+    console->ring = NULL;
+    console->dropped = 0;
+    console->drop = 0;
+    console->stop = 0;
+    console->sleeping = 0;
+    console->waiting = 0;
+    if (platform_add_device(plt, "console", CONSOLE_BASE, CONSOLE_SIZE, console_read, console_write, console, NULL) == NULL) {
+        free(console);
+        return NULL;
+    }
+    plt->console = console;
+    return console;
+}
+
+int console_start_writer(console_t *console, int drop) {
+    if (console->ring != NULL) {
+        console->drop = drop;
+        return 0;
+    }
+    console_flush(console);
+    console->drop = drop;
+    console->ring = (char*) malloc(CONSOLE_RING_SIZE);
+    pthread_mutex_init(&console->lock, NULL);
+    pthread_cond_init(&console->wake, NULL);
+    pthread_cond_init(&console->drained, NULL);
+    if (console->ring == NULL || pthread_create(&console->writer, NULL, console_writer, console) != 0) {
+        pthread_cond_destroy(&console->drained);
+        pthread_cond_destroy(&console->wake);
+        pthread_mutex_destroy(&console->lock);
+        free(console->ring);
+        console->ring = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Arrete le thread d'ecriture une fois l'anneau vide et repasse en mode synchrone.
+ */
+static void console_stop_writer(console_t *console) {
+    pthread_mutex_lock(&console->lock);
+    __atomic_store_n(&console->stop, 1, __ATOMIC_RELEASE);
+    pthread_cond_signal(&console->wake);
+    pthread_mutex_unlock(&console->lock);
+    pthread_join(console->writer, NULL);
+
+    pthread_cond_destroy(&console->drained);
+    pthread_cond_destroy(&console->wake);
+    pthread_mutex_destroy(&console->lock);
+    free(console->ring);
+    console->ring = NULL;
+    console->stop = 0;
+    if (console->dropped != 0) {
+        fprintf(stderr, "Console : %" PRIu64 " octets perdus (sortie trop lente)\n", console->dropped);
+        console->dropped = 0;
+    }
+}
+
+void console_set_output(console_t *console, int fd) {
+    console_flush(console);
+    if (console->ring != NULL) {
+        // Ce qui est deja dans l'anneau part vers l'ancienne sortie.
+        console_stop_writer(console);
+        console->fd = fd;
+        console_start_writer(console, console->drop);
+    }
+    else {
+        console->fd = fd;
+    }
+}
+
+void console_free(console_t *console) {
+    console_flush(console);
+    if (console->ring != NULL) {
+        console_stop_writer(console);
+    }
+    free(console);
+}
@@ -0,0 +1,90 @@
+#ifndef CONSOLE_H
+#define CONSOLE_H
+#include <inttypes.h>
+#include <pthread.h>
+#include "platform.h"
+
+#define CONSOLE_BASE 0x10000000
+#define CONSOLE_SIZE 0x1000
+
+// Registres de la console (offsets depuis CONSOLE_BASE)
+#define CONSOLE_PUTC 0x0 // Ecrit un caractere
+#define CONSOLE_PUTD 0x4 // Ecrit un entier signe en decimal
+#define CONSOLE_PUTX 0x8 // Ecrit un entier en hexadecimal
+
+#define CONSOLE_BUFFER_SIZE 4096
+#define CONSOLE_FLUSH_NS    100000000 // Delai maximal (100 ms) avant l'envoi d'une ligne incomplete
+#define CONSOLE_RING_SIZE   (1u << 20) // Anneau du mode asynchrone (puissance de 2)
+
+/**
+ * Console of the platform. The guest's output is accumulated in `buffer`
+ * and handed to write(2) in one call when a line ends, when the buffer is
+ * full, when CONSOLE_FLUSH_NS have elapsed since the oldest pending byte
+ * (checked on the next write), and when the core halts.
+ *
+ * In asynchronous mode (console_start_writer()), "writing" the buffer only
+ * copies it into a single-producer/single-consumer ring: the core is the
+ * producer, a host thread drains the ring to fd. A slow output then only
+ * stalls the core once the ring is full: the core waits for the thread to
+ * make room, unless the console was asked to drop the excess instead
+ * (counted in `dropped`).
+ */
+typedef struct console {
+    int      fd;       // Destination de la sortie (STDOUT_FILENO par defaut)
+    uint32_t length;   // Octets en attente dans buffer
+    uint64_t deadline; // Instant (CLOCK_MONOTONIC_COARSE, ns) ou les octets en attente doivent partir
+    uint32_t ring_head; // Octets publies dans ring depuis le debut (ecrit par le coeur seulement)
+    char     buffer[CONSOLE_BUFFER_SIZE]; // Separe aussi ring_head et ring_tail : pas de faux partage
+    uint32_t ring_tail; // Octets ecrits sur fd depuis le debut (ecrit par le thread seulement)
+    char     *ring;     // CONSOLE_RING_SIZE octets, NULL en mode synchrone
+    uint64_t dropped;   // Octets perdus faute de place dans ring
+    int      drop;      // Anneau plein : perdre les octets (1) plutot qu'attendre le thread (0)
+    int      stop;      // Demande d'arret du thread
+    int      sleeping;  // Le thread attend sur wake
+    int      waiting;   // Le coeur attend sur drained que le thread fasse de la place
+    pthread_t writer;
+    pthread_mutex_t lock;
+    pthread_cond_t  wake;
+    pthread_cond_t  drained;
+} console_t;
+
+/**
+ * Map the console on the platform's bus at CONSOLE_BASE, writing to stdout.
+ * The platform owns it and frees it in platform_free().
+ * @return The console, or NULL on error.
+ */
+console_t* console_init(platform_t *plt);
+
+/**
+ * Send the console's output to fd instead (the pending bytes are flushed
+ * first). The console does not close fd.
+ */
+void console_set_output(console_t *console, int fd);
+
+/**
+ * Switch to asynchronous mode: start the thread that writes the output.
+ * @param drop When the ring is full, drop the output (and report the
+ *             count on stderr) instead of waiting for the thread.
+ * @return 0 on success, -1 if the thread cannot be created (the console
+ *         stays synchronous).
+ */
+int console_start_writer(console_t *console, int drop);
+
+/**
+ * Append n bytes to the guest's output, as if they had been written one by
+ * one to CONSOLE_PUTC.
+ */
+void console_write_string(console_t *console, const char *s, uint32_t n);
+
+/**
+ * Write the pending bytes to the output (asynchronous mode: hand them to
+ * the writer thread).
+ */
+void console_flush(console_t *console);
+
+/**
+ * Flush and free the console, after the writer thread has written
+ * everything it was given.
+ */
+void console_free(console_t *console);
+#endif
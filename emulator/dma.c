@@ -0,0 +1,112 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "dma.h"
+
+/**
+ * Effectue le transfert programme, d'un coup, sur la memoire hote.
+ */
+static void dma_complete(void *opaque, uint64_t now) {
+    dma_device_t *dma = (dma_device_t*) opaque;
+    platform_t *plt = dma->plt;
+    uint8_t *dst = platform_host_ptr(plt, dma->dst, dma->len);
+    uint8_t *src = (dma->ctrl & DMA_CTRL_FILL) ? NULL : platform_host_ptr(plt, dma->src, dma->len);
+    (void) now;
+
+    dma->status &= ~DMA_STATUS_BUSY;
+    if (dst == NULL || (src == NULL && !(dma->ctrl & DMA_CTRL_FILL))) {
+        dma->status |= DMA_STATUS_ERROR;
+    }
+    else {
+        if (dma->ctrl & DMA_CTRL_FILL) {
+            memset(dst, (uint8_t) dma->src, dma->len);
+        }
+        else {
+            memmove(dst, src, dma->len);
+        }
+        platform_host_written(plt, dma->dst, dma->len);
+        dma->status |= DMA_STATUS_DONE;
+    }
+    if (dma->ctrl & DMA_CTRL_IRQ) {
+        platform_set_irq(plt, DMA_IRQ, 1);
+    }
+}
+
+static int dma_read(void *opaque, access_type_t access_type, uint32_t offset, uint32_t *data) {
+    dma_device_t *dma = (dma_device_t*) opaque;
+    if (access_type != ACCESS_WORD) {
+        return -1;
+    }
+    switch (offset) {
+        case DMA_SRC:    *data = dma->src; return 0;
+        case DMA_DST:    *data = dma->dst; return 0;
+        case DMA_LEN:    *data = dma->len; return 0;
+        case DMA_CTRL:   *data = dma->ctrl; return 0;
+        case DMA_STATUS: *data = dma->status; return 0;
+        default: return -1;
+    }
+}
+
+static int dma_write(void *opaque, access_type_t access_type, uint32_t offset, uint32_t data) {
+    dma_device_t *dma = (dma_device_t*) opaque;
+    if (access_type != ACCESS_WORD) {
+        return -1;
+    }
+    if (dma->status & DMA_STATUS_BUSY) {
+        return offset <= DMA_STATUS ? 0 : -1; // Les registres sont figes pendant un transfert
+    }
+    switch (offset) {
+        case DMA_SRC: dma->src = data; return 0;
+        case DMA_DST: dma->dst = data; return 0;
+        case DMA_LEN: dma->len = data; return 0;
+        case DMA_CTRL:
+            dma->ctrl = data & (DMA_CTRL_FILL | DMA_CTRL_IRQ);
+            if (data & DMA_CTRL_START) {
+                dma->status = DMA_STATUS_BUSY;
+                platform_set_irq(dma->plt, DMA_IRQ, 0);
+                platform_schedule(dma->plt, &dma->done, platform_time(dma->plt) + 1 + dma->len / DMA_BYTES_PER_TICK);
+            }
+            return 0;
+        case DMA_STATUS:
+            dma->status = 0;
+            platform_set_irq(dma->plt, DMA_IRQ, 0);
+            return 0;
+        default: return -1;
+    }
+}
+
+dma_device_t* dma_init(platform_t *plt) {
+    dma_device_t *dma = (dma_device_t*) malloc(sizeof(dma_device_t));
+    dma->plt = plt;
+    dma->src = 0;
+    dma->dst = 0;
+    dma->len = 0;
+    dma->ctrl = 0;
+    dma->status = 0;
+    sched_event_init(&dma->done, dma_complete, dma);
+    if (platform_add_device(plt, "dma", DMA_BASE, DMA_SIZE, dma_read, dma_write, dma, NULL) == NULL) {
+        free(dma);
+        return NULL;
+    }
+    plt->dma = dma;
+    return dma;
+}
+
+void dma_restore(dma_device_t *dma, const dma_device_t *saved) {
+    dma->src = saved->src;
+    dma->dst = saved->dst;
+    dma->len = saved->len;
+    dma->ctrl = saved->ctrl;
+    dma->status = saved->status;
+    if (saved->done.index >= 0) {
+        platform_schedule(dma->plt, &dma->done, saved->done.time);
+    }
+    else {
+        platform_cancel(dma->plt, &dma->done);
+    }
+}
+
+void dma_free(dma_device_t *dma) {
+    platform_cancel(dma->plt, &dma->done);
+    free(dma);
+}
@@ -0,0 +1,67 @@
+#ifndef DMA_H
+#define DMA_H
+#include <inttypes.h>
+#include "platform.h"
+#include "sched.h"
+
+#define DMA_BASE 0x10002000
+#define DMA_SIZE 0x1000
+#define DMA_IRQ  16 // Ligne d'interruption (mcause = 0x80000010, premiere ligne hors de celles de RISC-V)
+
+// Registres du DMA (offsets depuis DMA_BASE), acces en mots
+#define DMA_SRC    0x0  // Adresse source (copie) ou octet de remplissage dans les bits 7..0 (remplissage)
+#define DMA_DST    0x4  // Adresse destination
+#define DMA_LEN    0x8  // Nombre d'octets
+#define DMA_CTRL   0xC  // Ecriture : lance un transfert (bits DMA_CTRL_*), ignoree pendant un transfert
+#define DMA_STATUS 0x10 // Lecture : etat (bits DMA_STATUS_*) ; ecrire 1 efface DONE/ERROR et baisse la ligne
+
+#define DMA_CTRL_START     0x1 // Lance le transfert
+#define DMA_CTRL_FILL      0x2 // Remplit la destination avec l'octet de SRC au lieu de copier
+#define DMA_CTRL_IRQ       0x4 // Leve DMA_IRQ a la fin du transfert
+
+#define DMA_STATUS_BUSY    0x1 // Transfert en cours
+#define DMA_STATUS_DONE    0x2 // Transfert termine
+#define DMA_STATUS_ERROR   0x4 // Source ou destination hors d'une region de RAM : rien n'a ete ecrit
+
+#define DMA_BYTES_PER_TICK 16 // Debit du DMA, en octets par unite de temps virtuel
+
+/**
+ * DMA controller of the platform: copies (memmove semantics, overlapping
+ * ranges are allowed) or fills guest memory in bulk. A transfer started by
+ * a write of DMA_CTRL_START to DMA_CTRL takes 1 + LEN / DMA_BYTES_PER_TICK
+ * units of virtual time and is performed in one go, with host memmove() or
+ * memset() on the RAM backing, when its completion event fires: until then
+ * the destination is untouched. Source and destination must each lie in a
+ * single RAM region. On completion, DMA_STATUS_DONE (or DMA_STATUS_ERROR)
+ * is set and, if requested, the level-triggered line DMA_IRQ is raised
+ * until the guest writes DMA_STATUS.
+ */
+typedef struct dma {
+    platform_t *plt;
+    uint32_t src;
+    uint32_t dst;
+    uint32_t len;
+    uint32_t ctrl;
+    uint32_t status;
+    sched_event_t done; // Fin du transfert en cours
+} dma_device_t;
+
+/**
+ * Map the DMA controller on the platform's bus at DMA_BASE. The platform
+ * owns it and frees it in platform_free().
+ * @return The controller, or NULL on error.
+ */
+dma_device_t* dma_init(platform_t *plt);
+
+/**
+ * Put the controller back in the state saved in `saved`: its registers and,
+ * if a transfer was in progress, its completion at the saved instant. The
+ * interrupt line is left to the caller.
+ */
+void dma_restore(dma_device_t *dma, const dma_device_t *saved);
+
+/**
+ * Free the DMA controller and cancel its transfer, if any.
+ */
+void dma_free(dma_device_t *dma);
+#endif
@@ -0,0 +1,246 @@
+#include <elf.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "elf_loader.h"
+
+int elf_loader_is_elf(const char *file_name) {
+    unsigned char ident[SELFMAG];
+    FILE *f = fopen(file_name, "rb");
+    if (f == NULL) {
+        return 0;
+    }
+    int is_elf = fread(ident, 1, SELFMAG, f) == SELFMAG && memcmp(ident, ELFMAG, SELFMAG) == 0;
+    fclose(f);
+    return is_elf;
+}
+
+/**
+ * Lit exactement size octets a l'offset donne.
+ */
+static int elf_loader_pread(int fd, void *buf, size_t size, off_t offset) {
+    uint8_t *p = (uint8_t*) buf;
+    while (size > 0) {
+        ssize_t n = pread(fd, p, size, offset);
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        size -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+/**
+ * Place [offset, offset + size[ du fichier en host. Les pages hote
+ * entierement couvertes sont projetees en copie sur ecriture (MAP_PRIVATE)
+ * par-dessus la reservation de la RAM ; le debut et la fin partiels sont
+ * copies, pour ne pas amener en RAM des octets du fichier hors du segment.
+ */
+static int elf_loader_map(int fd, uint8_t *host, uint32_t size, off_t offset) {
+    uintptr_t page_size = (uintptr_t) sysconf(_SC_PAGESIZE);
+    uintptr_t start = ((uintptr_t) host + page_size - 1) & ~(page_size - 1);
+    uintptr_t end = ((uintptr_t) host + size) & ~(page_size - 1);
+
+    // La projection exige que l'offset dans le fichier et l'adresse hote
+    // soient congrus modulo la taille des pages.
+    if (start < end && (offset + (start - (uintptr_t) host)) % page_size == 0) {
+        off_t head = (off_t) (start - (uintptr_t) host);
+        if (mmap((void*) start, end - start, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, offset + head) == MAP_FAILED) {
+            return -1;
+        }
+        if (elf_loader_pread(fd, host, head, offset) != 0) {
+            return -1;
+        }
+        return elf_loader_pread(fd, (uint8_t*) end, (uintptr_t) host + size - end, offset + (off_t) (end - (uintptr_t) host));
+    }
+    return elf_loader_pread(fd, host, size, offset);
+}
+
+int elf_loader_load(platform_t *plt, const char *file_name, uint32_t *entry) {
+    Elf32_Ehdr ehdr;
+    int fd = open(file_name, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Erreur: Fichier programme non trouvé ou chemin incorrect: %s\n", file_name);
+        return -1;
+    }
+
+    if (elf_loader_pread(fd, &ehdr, sizeof(ehdr), 0) != 0
+        || memcmp(ehdr.e_ident, ELFMAG, SELFMAG) != 0
+        || ehdr.e_ident[EI_CLASS] != ELFCLASS32
+        || ehdr.e_ident[EI_DATA] != ELFDATA2LSB
+        || ehdr.e_type != ET_EXEC
+        || ehdr.e_phentsize != sizeof(Elf32_Phdr)) {
+        fprintf(stderr, "Erreur: %s n'est pas un executable ELF32 little-endian\n", file_name);
+        close(fd);
+        return -1;
+    }
+
+    for (int i = 0; i < ehdr.e_phnum; i++) {
+        Elf32_Phdr phdr;
+        if (elf_loader_pread(fd, &phdr, sizeof(phdr), ehdr.e_phoff + i * sizeof(phdr)) != 0) {
+            fprintf(stderr, "Erreur: en-tete de programme %d illisible dans %s\n", i, file_name);
+            close(fd);
+            return -1;
+        }
+        if (phdr.p_type != PT_LOAD || phdr.p_memsz == 0) {
+            continue;
+        }
+
+        uint8_t *host = platform_host_ptr(plt, phdr.p_vaddr, phdr.p_memsz);
+        if (host == NULL || phdr.p_filesz > phdr.p_memsz) {
+            fprintf(stderr, "Erreur: segment a 0x%08x (%u octets) hors de la RAM\n", phdr.p_vaddr, phdr.p_memsz);
+            close(fd);
+            return -1;
+        }
+
+        int status;
+        if (phdr.p_flags & PF_W) {
+            status = elf_loader_pread(fd, host, phdr.p_filesz, phdr.p_offset);
+        }
+        else {
+            status = elf_loader_map(fd, host, phdr.p_filesz, phdr.p_offset);
+        }
+        if (status != 0) {
+            fprintf(stderr, "Erreur: lecture du segment a 0x%08x dans %s\n", phdr.p_vaddr, file_name);
+            close(fd);
+            return -1;
+        }
+        memset(host + phdr.p_filesz, 0, phdr.p_memsz - phdr.p_filesz); // BSS
+        platform_mark_dirty(plt, phdr.p_vaddr, phdr.p_memsz);
+
+        if (plt->code_write != NULL) {
+            plt->code_write(plt->code_opaque, phdr.p_vaddr, phdr.p_memsz);
+        }
+    }
+
+    *entry = ehdr.e_entry;
+    close(fd); // Les projections restent valides apres la fermeture
+    return 0;
+}
+
+static int elf_symbol_compare(const void *a, const void *b) {
+    const elf_symbol_t *x = (const elf_symbol_t*) a;
+    const elf_symbol_t *y = (const elf_symbol_t*) b;
+    if (x->addr != y->addr) {
+        return x->addr < y->addr ? -1 : 1;
+    }
+    // A la meme adresse, la fonction (de taille connue) passe avant les etiquettes
+    if (x->size != y->size) {
+        return x->size > y->size ? -1 : 1;
+    }
+    return strcmp(x->name, y->name);
+}
+
+int elf_loader_symbols(const char *file_name, elf_symbol_t **symbols) {
+    Elf32_Ehdr ehdr;
+    Elf32_Shdr *shdrs = NULL;
+    Elf32_Sym *syms = NULL;
+    char *strtab = NULL;
+    int n = 0;
+    int fd = open(file_name, O_RDONLY);
+
+    *symbols = NULL;
+    if (fd < 0) {
+        fprintf(stderr, "Erreur: Fichier programme non trouvé ou chemin incorrect: %s\n", file_name);
+        return -1;
+    }
+    if (elf_loader_pread(fd, &ehdr, sizeof(ehdr), 0) != 0
+        || memcmp(ehdr.e_ident, ELFMAG, SELFMAG) != 0
+        || ehdr.e_ident[EI_CLASS] != ELFCLASS32
+        || (ehdr.e_shnum != 0 && ehdr.e_shentsize != sizeof(Elf32_Shdr))) {
+        fprintf(stderr, "Erreur: %s n'est pas un fichier ELF32\n", file_name);
+        close(fd);
+        return -1;
+    }
+
+    shdrs = (Elf32_Shdr*) malloc(ehdr.e_shnum * sizeof(Elf32_Shdr) + 1);
+    if (elf_loader_pread(fd, shdrs, ehdr.e_shnum * sizeof(Elf32_Shdr), ehdr.e_shoff) != 0) {
+        goto error;
+    }
+    for (int i = 0; i < ehdr.e_shnum; i++) {
+        const Elf32_Shdr *symtab = &shdrs[i];
+        if (symtab->sh_type != SHT_SYMTAB || symtab->sh_entsize != sizeof(Elf32_Sym) || symtab->sh_link >= ehdr.e_shnum) {
+            continue;
+        }
+        const Elf32_Shdr *strings = &shdrs[symtab->sh_link];
+        uint32_t n_syms = symtab->sh_size / sizeof(Elf32_Sym);
+
+        syms = (Elf32_Sym*) malloc(symtab->sh_size + 1);
+        strtab = (char*) malloc(strings->sh_size + 1);
+        if (elf_loader_pread(fd, syms, symtab->sh_size, symtab->sh_offset) != 0
+            || elf_loader_pread(fd, strtab, strings->sh_size, strings->sh_offset) != 0) {
+            goto error;
+        }
+        strtab[strings->sh_size] = '\0';
+
+        *symbols = (elf_symbol_t*) malloc((n_syms + 1) * sizeof(elf_symbol_t));
+        for (uint32_t j = 0; j < n_syms; j++) {
+            const Elf32_Sym *sym = &syms[j];
+            int type = ELF32_ST_TYPE(sym->st_info);
+            if ((type != STT_FUNC && type != STT_NOTYPE) || sym->st_shndx == SHN_UNDEF || sym->st_shndx >= ehdr.e_shnum
+                || !(shdrs[sym->st_shndx].sh_flags & SHF_EXECINSTR) || sym->st_name >= strings->sh_size) {
+                continue;
+            }
+            const char *name = strtab + sym->st_name;
+            if (name[0] == '\0' || name[0] == '$' || name[0] == '.') {
+                continue; // Symboles de correspondance ($x, $d) et etiquettes locales de l'assembleur
+            }
+            (*symbols)[n].addr = sym->st_value;
+            (*symbols)[n].size = sym->st_size;
+            (*symbols)[n].name = strdup(name);
+            n++;
+        }
+        break;
+    }
+    qsort(*symbols, n, sizeof(elf_symbol_t), elf_symbol_compare);
+
+    free(strtab);
+    free(syms);
+    free(shdrs);
+    close(fd);
+    return n;
+
+error:
+    fprintf(stderr, "Erreur: table des symboles illisible dans %s\n", file_name);
+    elf_loader_free_symbols(*symbols, n);
+    *symbols = NULL;
+    free(strtab);
+    free(syms);
+    free(shdrs);
+    close(fd);
+    return -1;
+}
+
+void elf_loader_free_symbols(elf_symbol_t *symbols, int n) {
+    for (int i = 0; i < n; i++) {
+        free(symbols[i].name);
+    }
+    free(symbols);
+}
+
+const elf_symbol_t* elf_loader_find_symbol(const elf_symbol_t *symbols, int n, uint32_t addr) {
+    int low = 0;
+    int high = n; // Premier symbole strictement apres addr dans [low, high]
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (symbols[mid].addr <= addr) {
+            low = mid + 1;
+        }
+        else {
+            high = mid;
+        }
+    }
+    if (low == 0) {
+        return NULL;
+    }
+    // Plusieurs symboles a la meme adresse : le premier (la fonction) la represente
+    while (low > 1 && symbols[low - 2].addr == symbols[low - 1].addr) {
+        low--;
+    }
+    return &symbols[low - 1];
+}
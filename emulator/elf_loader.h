@@ -0,0 +1,48 @@
+#ifndef ELF_LOADER_H
+#define ELF_LOADER_H
+#include <inttypes.h>
+#include "platform.h"
+
+/**
+ * Return 1 if file_name starts with the ELF magic number, 0 otherwise.
+ */
+int elf_loader_is_elf(const char *file_name);
+
+/**
+ * Load the PT_LOAD segments of an ELF32 little-endian executable in the
+ * platform's RAM. Read-only segments are mapped copy-on-write from the file
+ * instead of being copied; the part of a segment past its file size (BSS)
+ * is zero-filled. Every segment must fit in one RAM region.
+ * @param entry Receives the entry point given by the ELF header.
+ * @return      0 on success, -1 on error (message printed on stderr).
+ */
+int elf_loader_load(platform_t *plt, const char *file_name, uint32_t *entry);
+
+/**
+ * Code symbol of an ELF file: a function or an assembly label.
+ */
+typedef struct {
+    uint32_t addr;
+    uint32_t size; // 0 when unknown (assembly labels)
+    char     *name;
+} elf_symbol_t;
+
+/**
+ * Read the code symbols of an ELF32 file (STT_FUNC and STT_NOTYPE symbols
+ * defined in executable sections), sorted by address.
+ * @param symbols Receives the array, to free with elf_loader_free_symbols().
+ * @return        The number of symbols (0 if the file has no symbol table),
+ *                or -1 on error (message printed on stderr).
+ */
+int elf_loader_symbols(const char *file_name, elf_symbol_t **symbols);
+
+/**
+ * Free the array returned by elf_loader_symbols().
+ */
+void elf_loader_free_symbols(elf_symbol_t *symbols, int n);
+
+/**
+ * Symbol covering addr: the last one at or below it, NULL if there is none.
+ */
+const elf_symbol_t* elf_loader_find_symbol(const elf_symbol_t *symbols, int n, uint32_t addr);
+#endif
@@ -0,0 +1,285 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hle.h"
+#include "minirisc.h"
+#include "console.h"
+#include "elf_loader.h"
+
+static const char *hle_names[HLE_ROUTINES] = { "memcpy", "memmove", "memset", "strlen", "strcmp", "puts" };
+
+void hle_config_default(hle_config_t *config) {
+    config->call = 8;
+    config->byte = 1;
+}
+
+int hle_config_parse(hle_config_t *config, const char *spec) {
+    static const struct {
+        const char *name;
+        size_t offset;
+    } fields[] = {
+        { "call", offsetof(hle_config_t, call) },
+        { "byte", offsetof(hle_config_t, byte) },
+    };
+    hle_config_t parsed = *config;
+
+    while (*spec != '\0') {
+        size_t length = strcspn(spec, "=,");
+        size_t i;
+        for (i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+            if (strlen(fields[i].name) == length && strncmp(spec, fields[i].name, length) == 0) {
+                break;
+            }
+        }
+        if (i == sizeof(fields) / sizeof(fields[0]) || spec[length] != '=') {
+            return -1;
+        }
+        char *end;
+        uint32_t value = (uint32_t) strtoul(spec + length + 1, &end, 0);
+        if (end == spec + length + 1 || (*end != ',' && *end != '\0')) {
+            return -1;
+        }
+        *(uint32_t*) ((char*) &parsed + fields[i].offset) = value;
+        spec = *end == ',' ? end + 1 : end;
+    }
+    *config = parsed;
+    return 0;
+}
+
+hle_t* hle_new(platform_t *plt, const hle_config_t *config, const char *elf_file) {
+    elf_symbol_t *symbols;
+    int n_symbols = elf_loader_symbols(elf_file, &symbols);
+    if (n_symbols < 0) {
+        return NULL;
+    }
+
+    hle_t *hle = (hle_t*) calloc(1, sizeof(hle_t));
+    hle->config = *config;
+    hle->plt = plt;
+    for (int i = 0; i < n_symbols; i++) {
+        for (int r = 0; r < HLE_ROUTINES; r++) {
+            if (strcmp(symbols[i].name, hle_names[r]) != 0) {
+                continue;
+            }
+            uint8_t *code = platform_host_ptr(plt, symbols[i].addr, 4);
+            if (code == NULL || (symbols[i].addr & 0x3) != 0) {
+                fprintf(stderr, "HLE : %s a 0x%08x hors de la RAM, non liee\n", hle_names[r], symbols[i].addr);
+                continue;
+            }
+            *(uint32_t*) code = HLE_OPCODE | ((uint32_t) r << 20);
+            platform_host_written(plt, symbols[i].addr, 4);
+            hle->addrs[r] = symbols[i].addr;
+        }
+    }
+    elf_loader_free_symbols(symbols, n_symbols);
+    return hle;
+}
+
+void hle_free(hle_t *hle) {
+    free(hle);
+}
+
+/**
+ * Octet de la plateforme a addr, par la RAM si possible.
+ */
+static int hle_load(platform_t *plt, uint32_t addr, uint8_t *byte) {
+    const uint8_t *host = platform_host_ptr(plt, addr, 1);
+    uint32_t data;
+    if (host != NULL) {
+        *byte = *host;
+        return 0;
+    }
+    if (platform_read(plt, ACCESS_BYTE, addr, &data) != 0) {
+        return -1;
+    }
+    *byte = (uint8_t) data;
+    return 0;
+}
+
+/**
+ * Longueur de la chaine a addr, cherchee avec memchr() dans les regions de
+ * RAM et octet par octet ailleurs.
+ */
+static int hle_strlen(platform_t *plt, uint32_t addr, uint32_t *length) {
+    uint32_t n = 0;
+    for (;;) {
+        platform_device_t *dev = platform_find_device(plt, addr + n);
+        if (dev != NULL && dev->ram != NULL) {
+            const uint8_t *s = dev->ram + (addr + n - dev->base);
+            uint32_t available = dev->size - (addr + n - dev->base);
+            const uint8_t *end = (const uint8_t*) memchr(s, 0, available);
+            if (end != NULL) {
+                *length = n + (uint32_t) (end - s);
+                return 0;
+            }
+            n += available; // La chaine continue dans la region suivante
+        }
+        else {
+            uint8_t byte;
+            if (hle_load(plt, addr + n, &byte) != 0) {
+                return -1;
+            }
+            if (byte == 0) {
+                *length = n;
+                return 0;
+            }
+            n++;
+        }
+    }
+}
+
+/**
+ * memmove() dans la memoire du programme : directement sur la RAM hote si
+ * les deux zones y sont, octet par octet par le bus sinon.
+ */
+static int hle_move(platform_t *plt, uint32_t dst, uint32_t src, uint32_t n) {
+    uint8_t *host_dst = platform_host_ptr(plt, dst, n);
+    const uint8_t *host_src = platform_host_ptr(plt, src, n);
+    if (host_dst != NULL && host_src != NULL) {
+        memmove(host_dst, host_src, n);
+        platform_host_written(plt, dst, n);
+        return 0;
+    }
+    int backward = dst > src && dst - src < n;
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t k = backward ? n - 1 - i : i;
+        uint8_t byte;
+        if (hle_load(plt, src + k, &byte) != 0 || platform_write(plt, ACCESS_BYTE, dst + k, byte) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int hle_fill(platform_t *plt, uint32_t dst, uint8_t value, uint32_t n) {
+    uint8_t *host_dst = platform_host_ptr(plt, dst, n);
+    if (host_dst != NULL) {
+        memset(host_dst, value, n);
+        platform_host_written(plt, dst, n);
+        return 0;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        if (platform_write(plt, ACCESS_BYTE, dst + i, value) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * strcmp() ; *compared recoit le nombre d'octets compares.
+ */
+static int hle_compare(platform_t *plt, uint32_t a, uint32_t b, int32_t *result, uint32_t *compared) {
+    uint32_t length_a, length_b;
+    if (hle_strlen(plt, a, &length_a) != 0 || hle_strlen(plt, b, &length_b) != 0) {
+        return -1;
+    }
+    uint32_t n = (length_a < length_b ? length_a : length_b) + 1; // Le 0 final de la plus courte compte
+    const uint8_t *host_a = platform_host_ptr(plt, a, n);
+    const uint8_t *host_b = platform_host_ptr(plt, b, n);
+    for (uint32_t i = 0; i < n; i++) {
+        uint8_t byte_a, byte_b;
+        if (host_a != NULL && host_b != NULL) {
+            byte_a = host_a[i];
+            byte_b = host_b[i];
+        }
+        else if (hle_load(plt, a + i, &byte_a) != 0 || hle_load(plt, b + i, &byte_b) != 0) {
+            return -1;
+        }
+        if (byte_a != byte_b || byte_a == 0) {
+            *result = (int32_t) byte_a - (int32_t) byte_b;
+            *compared = i + 1;
+            return 0;
+        }
+    }
+    *result = 0;
+    *compared = n;
+    return 0;
+}
+
+static int hle_puts(platform_t *plt, uint32_t addr, uint32_t *length) {
+    if (hle_strlen(plt, addr, length) != 0) {
+        return -1;
+    }
+    if (plt->console == NULL) {
+        return 0;
+    }
+    const char *host = (const char*) platform_host_ptr(plt, addr, *length);
+    if (host != NULL) {
+        console_write_string(plt->console, host, *length);
+    }
+    else {
+        for (uint32_t i = 0; i < *length; i++) {
+            uint8_t byte;
+            if (hle_load(plt, addr + i, &byte) != 0) {
+                return -1;
+            }
+            console_write_string(plt->console, (const char*) &byte, 1);
+        }
+    }
+    console_write_string(plt->console, "\n", 1);
+    return 0;
+}
+
+int hle_call(hle_t *hle, minirisc_t *mr, uint32_t routine) {
+    platform_t *plt = hle->plt;
+    uint32_t a0 = mr->regs[10], a1 = mr->regs[11], a2 = mr->regs[12];
+    uint32_t result = a0;
+    uint32_t bytes = 0;
+    int status = 0;
+
+    switch (routine) {
+        case HLE_MEMCPY:
+        case HLE_MEMMOVE:
+            status = hle_move(plt, a0, a1, a2);
+            bytes = a2;
+            break;
+        case HLE_MEMSET:
+            status = hle_fill(plt, a0, (uint8_t) a1, a2);
+            bytes = a2;
+            break;
+        case HLE_STRLEN:
+            status = hle_strlen(plt, a0, &result);
+            bytes = result + 1;
+            break;
+        case HLE_STRCMP: {
+            int32_t difference = 0;
+            status = hle_compare(plt, a0, a1, &difference, &bytes);
+            result = (uint32_t) difference;
+            break;
+        }
+        case HLE_PUTS:
+            status = hle_puts(plt, a0, &bytes);
+            bytes++; // Retour a la ligne
+            result = bytes;
+            break;
+        default:
+            fprintf(stderr, "Erreur : routine HLE %u inconnue a 0x%08x\n", routine, mr->PC);
+            return -1;
+    }
+    if (status != 0) {
+        fprintf(stderr, "Erreur : %s (HLE) a 0x%08x : acces memoire invalide\n", hle_names[routine], mr->PC);
+        return -1;
+    }
+
+    hle->calls[routine]++;
+    hle->bytes[routine] += bytes;
+    uint64_t cost = hle->config.call + (uint64_t) hle->config.byte * bytes;
+    if (cost > 1) {
+        mr->counters.instret += cost - 1; // L'instruction HLE elle-meme est comptee par le moteur
+    }
+    mr->regs[10] = result;
+    mr->next_PC = mr->regs[1] & 0xFFFFFFFE; // Retour comme JALR x0, 0(ra)
+    return 0;
+}
+
+void hle_report(const hle_t *hle, FILE *out) {
+    fprintf(out, "Routines emulees (HLE) : %u instructions par appel + %u par octet\n", hle->config.call, hle->config.byte);
+    for (int r = 0; r < HLE_ROUTINES; r++) {
+        if (hle->addrs[r] != 0) {
+            fprintf(out, "  %-8s 0x%08x : %" PRIu64 " appels, %" PRIu64 " octets\n", hle_names[r], hle->addrs[r],
+                    hle->calls[r], hle->bytes[r]);
+        }
+    }
+}
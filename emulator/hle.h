@@ -0,0 +1,96 @@
+#ifndef HLE_H
+#define HLE_H
+#include <inttypes.h>
+#include <stdio.h>
+#include "platform.h"
+
+/*
+ * Emulation de haut niveau (HLE) de routines de bibliotheque du programme :
+ * la premiere instruction de chaque routine liee est remplacee par la
+ * pseudo-instruction HLE_OPCODE, dont les bits 20-31 donnent la routine.
+ * Son execution fait l'operation avec du code hote, en suivant la
+ * convention d'appel RISC-V (arguments dans a0-a2, resultat dans a0,
+ * retour a ra), sans executer le corps de la routine.
+ *
+ * Les acces memoire d'une routine emulee sont faits directement par l'hote :
+ * ils n'apparaissent ni dans la trace d'execution ni dans le modele de
+ * caches, et l'emulateur refuse de combiner HLE et ces observateurs.
+ */
+
+#define HLE_OPCODE 48 // Opcode libre entre les CSR (42-47) et l'extension M (56-63)
+
+/**
+ * Routines that can be bound.
+ */
+typedef enum {
+    HLE_MEMCPY,  // void* memcpy(void *dst, const void *src, size_t n)
+    HLE_MEMMOVE, // void* memmove(void *dst, const void *src, size_t n)
+    HLE_MEMSET,  // void* memset(void *dst, int c, size_t n)
+    HLE_STRLEN,  // size_t strlen(const char *s)
+    HLE_STRCMP,  // int strcmp(const char *a, const char *b)
+    HLE_PUTS,    // int puts(const char *s), on the platform's console
+    HLE_ROUTINES
+} hle_routine_t;
+
+/**
+ * Cost charged to the core for a call, in instructions retired (and thus
+ * in virtual time and mcycle): call + byte * bytes processed, at least 1.
+ */
+typedef struct {
+    uint32_t call;
+    uint32_t byte;
+} hle_config_t;
+
+/**
+ * Bound routines and their statistics.
+ */
+typedef struct hle {
+    hle_config_t config;
+    platform_t *plt;
+    uint32_t addrs[HLE_ROUTINES]; // Adresse de chaque routine liee, 0 si elle ne l'est pas
+    uint64_t calls[HLE_ROUTINES];
+    uint64_t bytes[HLE_ROUTINES]; // Octets traites (copies, remplis, parcourus ou ecrits)
+} hle_t;
+
+struct minirisc;
+
+/**
+ * Default cost: 8 instructions per call plus 1 per byte, about a
+ * word-by-word loop.
+ */
+void hle_config_default(hle_config_t *config);
+
+/**
+ * Change the cost from a comma-separated list of name=instructions, with
+ * names call and byte.
+ * @return 0 on success, -1 if spec is invalid.
+ */
+int hle_config_parse(hle_config_t *config, const char *spec);
+
+/**
+ * Bind the routines found among the symbols of elf_file, already loaded
+ * in the platform's RAM: their first instruction is overwritten with
+ * HLE_OPCODE. Routines that are not found keep running as guest code.
+ * @return The bindings, or NULL on error (message printed on stderr).
+ */
+hle_t* hle_new(platform_t *plt, const hle_config_t *config, const char *elf_file);
+
+/**
+ * Free the bindings. The patched code stays in RAM.
+ */
+void hle_free(hle_t *hle);
+
+/**
+ * Execute routine for the HLE_OPCODE instruction mr is executing at PC:
+ * set a0 and next_PC = ra, and charge the cost beyond the instruction
+ * itself to counters.instret.
+ * @return 0 on success, -1 if the routine touched memory it cannot access
+ *         (message printed on stderr; memory may be partially written).
+ */
+int hle_call(hle_t *hle, struct minirisc *mr, uint32_t routine);
+
+/**
+ * Print the calls and bytes of each bound routine.
+ */
+void hle_report(const hle_t *hle, FILE *out);
+#endif
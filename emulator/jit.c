@@ -0,0 +1,495 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "jit.h"
+#include "platform.h"
+
+#if defined(__x86_64__)
+
+/*
+ * Generation de code x86-64.
+ *
+ * Le code d'un bloc travaille directement sur mr->regs en memoire :
+ *   rbx = mr (callee-saved, sauvegarde dans le prologue)
+ *   rsi = mr->platform
+ *   eax, ecx, edx = temporaires
+ * Les registres guest sont relus a chaque instruction : pas d'allocation de
+ * registres, mais plus aucun decodage ni dispatch.
+ *
+ * Les acces memoire passent par le TLB logiciel de la plateforme. Un acces
+ * dont la page n'y est pas (MMIO, adresse invalide, premier acces a la page,
+ * ecriture sur une page de code) ou qui est mal aligne sort du code natif
+ * avant tout effet de bord (JIT_EXIT_RESUME) : l'interpreteur reprend le bloc
+ * a cette instruction avec sa semantique exacte.
+ */
+
+#define OFF_REG(r)      ((int32_t) (offsetof(minirisc_t, regs) + 4 * (r)))
+#define OFF_NEXT_PC     ((int32_t) offsetof(minirisc_t, next_PC))
+#define OFF_PLATFORM    ((int32_t) offsetof(minirisc_t, platform))
+#define OFF_BRANCHES    ((int32_t) (offsetof(minirisc_t, counters.events) + 8 * MINIRISC_EVENT_BRANCH))
+#define OFF_TLB_READ    ((int32_t) offsetof(platform_t, tlb_read))
+#define OFF_TLB_WRITE   ((int32_t) offsetof(platform_t, tlb_write))
+#define OFF_TLB_HOST    ((int32_t) offsetof(platform_tlb_entry_t, host))
+
+_Static_assert(sizeof(platform_tlb_entry_t) == 16, "emit_address() indexe le TLB par pas de 16 octets");
+_Static_assert(offsetof(platform_tlb_entry_t, page) == 0, "emit_address() compare le tag en debut d'entree");
+
+// Taille maximale du code emis pour une instruction, sorties comprises
+#define JIT_MAX_INSN_BYTES 128
+
+// Registres x86
+#define EAX 0
+#define ECX 1
+#define EDX 2
+
+// Codes de condition x86
+#define CC_B  0x2
+#define CC_AE 0x3
+#define CC_E  0x4
+#define CC_NE 0x5
+#define CC_L  0xC
+#define CC_GE 0xD
+
+typedef struct {
+    uint8_t *p;
+    uint8_t *epilogue_jumps[BLOCK_MAX_INSNS * 4]; // rel32 a faire pointer vers l'epilogue
+    int n_epilogue_jumps;
+    uint8_t *exit_jumps[BLOCK_MAX_INSNS * 4];     // rel32 vers la sortie de l'instruction exit_index
+    int exit_index[BLOCK_MAX_INSNS * 4];
+    int n_exit_jumps;
+} emitter_t;
+
+static void emit8(emitter_t *e, uint8_t b) {
+    *e->p++ = b;
+}
+
+static void emit32(emitter_t *e, uint32_t v) {
+    memcpy(e->p, &v, 4);
+    e->p += 4;
+}
+
+static void patch_rel32(uint8_t *at, uint8_t *target) {
+    int32_t rel = (int32_t) (target - (at + 4));
+    memcpy(at, &rel, 4);
+}
+
+// op r32, [rbx + disp32]
+static void emit_rm_rbx(emitter_t *e, uint8_t opcode, int reg, int32_t disp) {
+    emit8(e, opcode);
+    emit8(e, 0x80 | (reg << 3) | 3);
+    emit32(e, disp);
+}
+
+// mov r32, regs[r]
+static void emit_load_guest(emitter_t *e, int reg, int r) {
+    emit_rm_rbx(e, 0x8B, reg, OFF_REG(r));
+}
+
+// regs[r] = r32 (x0 n'est jamais ecrit)
+static void emit_store_guest(emitter_t *e, int reg, int r) {
+    if (r != 0) {
+        emit_rm_rbx(e, 0x89, reg, OFF_REG(r));
+    }
+}
+
+// mov dword [rbx + disp32], imm32
+static void emit_store_imm(emitter_t *e, int32_t disp, uint32_t imm) {
+    emit8(e, 0xC7);
+    emit8(e, 0x83);
+    emit32(e, disp);
+    emit32(e, imm);
+}
+
+// op eax, imm32 (groupe 0x81 : add /0, or /1, and /4, sub /5, xor /6, cmp /7)
+static void emit_alu_imm(emitter_t *e, int digit, uint32_t imm) {
+    emit8(e, 0x81);
+    emit8(e, 0xC0 | (digit << 3));
+    emit32(e, imm);
+}
+
+// setcc al ; movzx eax, al
+static void emit_setcc(emitter_t *e, int cc) {
+    emit8(e, 0x0F); emit8(e, 0x90 | cc); emit8(e, 0xC0);
+    emit8(e, 0x0F); emit8(e, 0xB6); emit8(e, 0xC0);
+}
+
+// mov eax, (index << 2) | kind ; jmp epilogue
+static void emit_exit(emitter_t *e, int index, int kind) {
+    emit8(e, 0xB8);
+    emit32(e, ((uint32_t) index << 2) | kind);
+    emit8(e, 0xE9);
+    e->epilogue_jumps[e->n_epilogue_jumps++] = e->p;
+    emit32(e, 0);
+}
+
+// jcc vers la sortie JIT_EXIT_RESUME de l'instruction index
+static void emit_jcc_exit(emitter_t *e, int cc, int index) {
+    emit8(e, 0x0F);
+    emit8(e, 0x80 | cc);
+    e->exit_jumps[e->n_exit_jumps] = e->p;
+    e->exit_index[e->n_exit_jumps++] = index;
+    emit32(e, 0);
+}
+
+/**
+ * Calcule l'adresse de l'acces et cherche sa page dans le TLB de la
+ * plateforme (celui des ecritures ne contient jamais de page de code).
+ * En cas de succes rdx = adresse hote de la page et eax = offset dans la
+ * page ; sinon sortie vers l'interpreteur, qui remplira le TLB.
+ */
+static void emit_address(emitter_t *e, const minirisc_insn_t *insn, int index, int size, int is_store) {
+    emit_load_guest(e, EAX, insn->rs1);
+    emit_alu_imm(e, 0, insn->imm);                                   // add eax, imm
+    emit8(e, 0x89); emit8(e, 0xC1);                                  // mov ecx, eax
+    emit8(e, 0xC1); emit8(e, 0xE9); emit8(e, PLATFORM_PAGE_SHIFT);   // shr ecx, PAGE_SHIFT
+    emit8(e, 0x83); emit8(e, 0xE1); emit8(e, PLATFORM_TLB_SIZE - 1); // and ecx, TLB_SIZE - 1
+    emit8(e, 0xC1); emit8(e, 0xE1); emit8(e, 4);                     // shl ecx, 4 (taille d'une entree)
+    emit8(e, 0x48); emit8(e, 0x8D); emit8(e, 0x94); emit8(e, 0x0E);  // lea rdx, [rsi + rcx + tlb]
+    emit32(e, is_store ? OFF_TLB_WRITE : OFF_TLB_READ);
+    emit8(e, 0x89); emit8(e, 0xC1);                                  // mov ecx, eax
+    emit8(e, 0x81); emit8(e, 0xE1); emit32(e, ~(PLATFORM_PAGE_SIZE - 1) | (size - 1)); // and ecx, page | alignement
+    emit8(e, 0x3B); emit8(e, 0x0A);                                  // cmp ecx, [rdx + page]
+    emit_jcc_exit(e, CC_NE, index);
+    emit8(e, 0x48); emit8(e, 0x8B); emit8(e, 0x52); emit8(e, OFF_TLB_HOST); // mov rdx, [rdx + host]
+    emit_alu_imm(e, 4, PLATFORM_PAGE_SIZE - 1);                      // and eax, PAGE_SIZE - 1
+}
+
+static void emit_load(emitter_t *e, const minirisc_insn_t *insn, int index) {
+    int size = (insn->opcode == 13) ? 4 : (insn->opcode == 12 || insn->opcode == 15) ? 2 : 1;
+    emit_address(e, insn, index, size, 0);
+    switch (insn->opcode) {
+        case 11: emit8(e, 0x0F); emit8(e, 0xBE); break; // LB  : movsx ecx, byte [rdx + rax]
+        case 12: emit8(e, 0x0F); emit8(e, 0xBF); break; // LH  : movsx ecx, word [rdx + rax]
+        case 13: emit8(e, 0x8B); break;                 // LW  : mov ecx, [rdx + rax]
+        case 14: emit8(e, 0x0F); emit8(e, 0xB6); break; // LBU : movzx ecx, byte [rdx + rax]
+        default: emit8(e, 0x0F); emit8(e, 0xB7); break; // LHU : movzx ecx, word [rdx + rax]
+    }
+    emit8(e, 0x0C); emit8(e, 0x02);
+    emit_store_guest(e, ECX, insn->rd);
+}
+
+static void emit_store(emitter_t *e, const minirisc_insn_t *insn, int index) {
+    int size = (insn->opcode == 18) ? 4 : (insn->opcode == 17) ? 2 : 1;
+    emit_address(e, insn, index, size, 1);
+    emit_load_guest(e, ECX, insn->rs2);
+    switch (insn->opcode) {
+        case 16: emit8(e, 0x88); break;                 // SB : mov [rdx + rax], cl
+        case 17: emit8(e, 0x66); emit8(e, 0x89); break; // SH : mov [rdx + rax], cx
+        default: emit8(e, 0x89); break;                 // SW : mov [rdx + rax], ecx
+    }
+    emit8(e, 0x0C); emit8(e, 0x02);
+}
+
+// Partie haute d'un produit 64 bits (MULH, MULHSU, MULHU)
+static void emit_mulh(emitter_t *e, const minirisc_insn_t *insn, int signed1, int signed2) {
+    if (signed1) {
+        emit8(e, 0x48); emit_rm_rbx(e, 0x63, EAX, OFF_REG(insn->rs1)); // movsxd rax, regs[rs1]
+    }
+    else {
+        emit_load_guest(e, EAX, insn->rs1);
+    }
+    if (signed2) {
+        emit8(e, 0x48); emit_rm_rbx(e, 0x63, ECX, OFF_REG(insn->rs2)); // movsxd rcx, regs[rs2]
+    }
+    else {
+        emit_load_guest(e, ECX, insn->rs2);
+    }
+    emit8(e, 0x48); emit8(e, 0x0F); emit8(e, 0xAF); emit8(e, 0xC1);   // imul rax, rcx
+    emit8(e, 0x48); emit8(e, 0xC1); emit8(e, 0xE8); emit8(e, 0x20);   // shr rax, 32
+    emit_store_guest(e, EAX, insn->rd);
+}
+
+// DIV, DIVU, REM, REMU avec les cas particuliers du switch de reference
+static void emit_div(emitter_t *e, const minirisc_insn_t *insn) {
+    int is_signed = (insn->opcode == 60 || insn->opcode == 62);
+    int is_rem = (insn->opcode == 62 || insn->opcode == 63);
+    uint8_t *to_special, *to_overflow = NULL, *to_done;
+
+    emit_load_guest(e, ECX, insn->rs2);
+    emit_load_guest(e, EAX, insn->rs1);
+    emit8(e, 0x85); emit8(e, 0xC9);                      // test ecx, ecx
+    emit8(e, 0x74); to_special = e->p; emit8(e, 0);      // jz division par zero
+    if (is_signed) {
+        uint8_t *to_normal;
+        emit8(e, 0x83); emit8(e, 0xF9); emit8(e, 0xFF);  // cmp ecx, -1
+        emit8(e, 0x75); to_normal = e->p; emit8(e, 0);   // jne
+        emit8(e, 0x3D); emit32(e, 0x80000000);           // cmp eax, INT32_MIN
+        emit8(e, 0x74); to_overflow = e->p; emit8(e, 0); // je depassement
+        *to_normal = (uint8_t) (e->p - (to_normal + 1));
+        emit8(e, 0x99);                                  // cdq
+        emit8(e, 0xF7); emit8(e, 0xF9);                  // idiv ecx
+    }
+    else {
+        emit8(e, 0x31); emit8(e, 0xD2);                  // xor edx, edx
+        emit8(e, 0xF7); emit8(e, 0xF1);                  // div ecx
+    }
+    if (is_rem) {
+        emit8(e, 0x89); emit8(e, 0xD0);                  // mov eax, edx
+    }
+    emit8(e, 0xEB); to_done = e->p; emit8(e, 0);         // jmp fin
+
+    // Division par zero : DIV/DIVU -> -1, REM/REMU -> rs1 (deja dans eax)
+    *to_special = (uint8_t) (e->p - (to_special + 1));
+    if (!is_rem) {
+        emit8(e, 0xB8); emit32(e, 0xFFFFFFFF);
+    }
+    if (is_signed) {
+        uint8_t *to_done2;
+        emit8(e, 0xEB); to_done2 = e->p; emit8(e, 0);
+        // INT32_MIN / -1 : DIV -> rs1 (deja dans eax), REM -> 0
+        *to_overflow = (uint8_t) (e->p - (to_overflow + 1));
+        if (is_rem) {
+            emit8(e, 0x31); emit8(e, 0xC0);              // xor eax, eax
+        }
+        *to_done2 = (uint8_t) (e->p - (to_done2 + 1));
+    }
+    *to_done = (uint8_t) (e->p - (to_done + 1));
+    emit_store_guest(e, EAX, insn->rd);
+}
+
+/**
+ * Emet une instruction. Renvoie 0 si le bloc continue, 1 si l'instruction
+ * termine le code natif (saut, branchement ou instruction non supportee).
+ */
+static int emit_insn(emitter_t *e, const minirisc_insn_t *insn, int index, uint32_t PC) {
+    uint8_t *to_taken;
+
+    switch (insn->opcode) {
+        case 1: // LUI
+        case 2: // AUIPC (imm = PC + immediat)
+            if (insn->rd != 0) {
+                emit_store_imm(e, OFF_REG(insn->rd), insn->imm);
+            }
+            return 0;
+        case 3: // JAL
+            if (insn->rd != 0) {
+                emit_store_imm(e, OFF_REG(insn->rd), PC + 4);
+            }
+            emit_store_imm(e, OFF_NEXT_PC, insn->imm);
+            emit_exit(e, index, JIT_EXIT_LINK1);
+            return 1;
+        case 4: // JALR
+            emit_load_guest(e, EAX, insn->rs1);
+            emit_alu_imm(e, 0, insn->imm);
+            emit_alu_imm(e, 4, 0xFFFFFFFE);
+            emit_rm_rbx(e, 0x89, EAX, OFF_NEXT_PC);
+            if (insn->rd != 0) {
+                emit_store_imm(e, OFF_REG(insn->rd), PC + 4);
+            }
+            emit_exit(e, index, JIT_EXIT_INDIRECT);
+            return 1;
+        case 5: case 6: case 7: case 8: case 9: case 10: { // Branchements
+            static const int cc[] = { CC_E, CC_NE, CC_L, CC_GE, CC_B, CC_AE };
+            emit_load_guest(e, EAX, insn->rs1);
+            emit_rm_rbx(e, 0x3B, EAX, OFF_REG(insn->rs2)); // cmp eax, regs[rs2]
+            emit8(e, 0x0F); emit8(e, 0x80 | cc[insn->opcode - 5]);
+            to_taken = e->p;
+            emit32(e, 0);
+            emit_store_imm(e, OFF_NEXT_PC, PC + 4);
+            emit_exit(e, index, JIT_EXIT_LINK0);
+            patch_rel32(to_taken, e->p);
+            // inc qword [rbx + disp32] : branchements pris, compte par les handlers dans l'interpreteur
+            emit8(e, 0x48); emit8(e, 0xFF); emit8(e, 0x83);
+            emit32(e, OFF_BRANCHES);
+            emit_store_imm(e, OFF_NEXT_PC, insn->imm);
+            emit_exit(e, index, JIT_EXIT_LINK1);
+            return 1;
+        }
+        case 11: case 12: case 13: case 14: case 15:
+            emit_load(e, insn, index);
+            return 0;
+        case 16: case 17: case 18:
+            emit_store(e, insn, index);
+            return 0;
+        case 19: case 22: case 23: case 24: { // ADDI, XORI, ORI, ANDI
+            static const int digit[] = { 0, -1, -1, 6, 1, 4 };
+            if (insn->rd != 0) {
+                emit_load_guest(e, EAX, insn->rs1);
+                emit_alu_imm(e, digit[insn->opcode - 19], insn->imm);
+                emit_store_guest(e, EAX, insn->rd);
+            }
+            return 0;
+        }
+        case 20: case 21: // SLTI, SLTIU
+            if (insn->rd != 0) {
+                emit_load_guest(e, EAX, insn->rs1);
+                emit_alu_imm(e, 7, insn->imm);
+                emit_setcc(e, insn->opcode == 20 ? CC_L : CC_B);
+                emit_store_guest(e, EAX, insn->rd);
+            }
+            return 0;
+        case 25: case 26: case 27: { // SLLI, SRLI, SRAI
+            static const uint8_t modrm[] = { 0xE0, 0xE8, 0xF8 };
+            if (insn->rd != 0) {
+                emit_load_guest(e, EAX, insn->rs1);
+                emit8(e, 0xC1); emit8(e, modrm[insn->opcode - 25]); emit8(e, insn->imm);
+                emit_store_guest(e, EAX, insn->rd);
+            }
+            return 0;
+        }
+        case 28: case 29: case 35: case 36: case 37: { // ADD, SUB, XOR, OR, AND
+            uint8_t op = insn->opcode == 28 ? 0x03 : insn->opcode == 29 ? 0x2B
+                       : insn->opcode == 35 ? 0x33 : insn->opcode == 36 ? 0x0B : 0x23;
+            if (insn->rd != 0) {
+                emit_load_guest(e, EAX, insn->rs1);
+                emit_rm_rbx(e, op, EAX, OFF_REG(insn->rs2));
+                emit_store_guest(e, EAX, insn->rd);
+            }
+            return 0;
+        }
+        case 30: case 31: case 32: { // SLL, SRL, SRA (le materiel masque deja le decalage sur 5 bits)
+            static const uint8_t modrm[] = { 0xE0, 0xE8, 0xF8 };
+            if (insn->rd != 0) {
+                emit_load_guest(e, ECX, insn->rs2);
+                emit_load_guest(e, EAX, insn->rs1);
+                emit8(e, 0xD3); emit8(e, modrm[insn->opcode - 30]);
+                emit_store_guest(e, EAX, insn->rd);
+            }
+            return 0;
+        }
+        case 33: case 34: // SLT, SLTU
+            if (insn->rd != 0) {
+                emit_load_guest(e, EAX, insn->rs1);
+                emit_rm_rbx(e, 0x3B, EAX, OFF_REG(insn->rs2));
+                emit_setcc(e, insn->opcode == 33 ? CC_L : CC_B);
+                emit_store_guest(e, EAX, insn->rd);
+            }
+            return 0;
+        case 56: // MUL
+            if (insn->rd != 0) {
+                emit_load_guest(e, EAX, insn->rs1);
+                emit8(e, 0x0F); emit_rm_rbx(e, 0xAF, EAX, OFF_REG(insn->rs2)); // imul eax, regs[rs2]
+                emit_store_guest(e, EAX, insn->rd);
+            }
+            return 0;
+        case 57: if (insn->rd != 0) emit_mulh(e, insn, 1, 1); return 0; // MULH
+        case 58: if (insn->rd != 0) emit_mulh(e, insn, 1, 0); return 0; // MULHSU
+        case 59: if (insn->rd != 0) emit_mulh(e, insn, 0, 0); return 0; // MULHU
+        case 60: case 61: case 62: case 63:
+            if (insn->rd != 0) emit_div(e, insn);
+            return 0;
+        default:
+            // CSR, ECALL, WFI, RETI, EBREAK, opcodes inconnus : interpreteur
+            emit_exit(e, index, JIT_EXIT_RESUME);
+            return 1;
+    }
+}
+
+static int jit_supported(const minirisc_insn_t *insn) {
+    return (insn->opcode >= 1 && insn->opcode <= 37) || (insn->opcode >= 56 && insn->opcode <= 63);
+}
+
+jit_t* jit_new(size_t size, uint32_t threshold) {
+    void *buffer = mmap(NULL, size, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffer == MAP_FAILED) {
+        return NULL;
+    }
+
+    jit_t *jit = (jit_t*) malloc(sizeof(jit_t));
+    jit->buffer = (uint8_t*) buffer;
+    jit->size = size;
+    jit->used = 0;
+    jit->threshold = threshold;
+    return jit;
+}
+
+void jit_free(jit_t *jit) {
+    munmap(jit->buffer, jit->size);
+    free(jit);
+}
+
+// Le profileur suit les appels et retours : JAL/JALR restent alors a l'interpreteur
+static int jit_profiled(const minirisc_t *mr, const minirisc_insn_t *insn) {
+    return mr->profiler != NULL && (insn->opcode == 3 || insn->opcode == 4);
+}
+
+void jit_reset(jit_t *jit) {
+    jit->used = 0;
+}
+
+jit_code_t jit_compile(jit_t *jit, minirisc_t *mr, minirisc_block_t *block) {
+    emitter_t e;
+    uint32_t n = block->n_insns;
+    int ended = 0;
+
+    if (n == 0 || !jit_supported(&block->insns[0]) || jit_profiled(mr, &block->insns[0])) {
+        return NULL;
+    }
+    if (jit->used + (n + 2) * JIT_MAX_INSN_BYTES > jit->size) {
+        mr->block_flush = 1; // Tampon plein : tout sera retraduit
+        return NULL;
+    }
+
+    uint8_t *start = jit->buffer + jit->used;
+    e.p = start;
+    e.n_epilogue_jumps = 0;
+    e.n_exit_jumps = 0;
+
+    emit8(&e, 0x53);                                              // push rbx
+    emit8(&e, 0x48); emit8(&e, 0x89); emit8(&e, 0xFB);            // mov rbx, rdi
+    emit8(&e, 0x48); emit_rm_rbx(&e, 0x8B, 6, OFF_PLATFORM);      // mov rsi, [rbx + platform]
+
+    for (uint32_t i = 0; i < n && !ended; i++) {
+        if (jit_profiled(mr, &block->insns[i])) {
+            emit_exit(&e, i, JIT_EXIT_RESUME);
+            ended = 1;
+            break;
+        }
+        ended = emit_insn(&e, &block->insns[i], i, block->PC + 4 * i);
+    }
+    if (!ended) {
+        // Bloc coupe en fin de page ou a sa taille maximale
+        emit_store_imm(&e, OFF_NEXT_PC, block->PC + 4 * n);
+        emit_exit(&e, n, JIT_EXIT_LINK0);
+    }
+
+    // Sorties vers l'interpreteur, une par instruction qui en a besoin
+    int exit_at[BLOCK_MAX_INSNS];
+    for (uint32_t i = 0; i < n; i++) {
+        exit_at[i] = -1;
+    }
+    for (int j = 0; j < e.n_exit_jumps; j++) {
+        int index = e.exit_index[j];
+        if (exit_at[index] < 0) {
+            exit_at[index] = (int) (e.p - start);
+            emit_exit(&e, index, JIT_EXIT_RESUME);
+        }
+        patch_rel32(e.exit_jumps[j], start + exit_at[index]);
+    }
+
+    uint8_t *epilogue = e.p;
+    emit8(&e, 0x5B); // pop rbx
+    emit8(&e, 0xC3); // ret
+    for (int j = 0; j < e.n_epilogue_jumps; j++) {
+        patch_rel32(e.epilogue_jumps[j], epilogue);
+    }
+
+    jit->used += (size_t) (e.p - start);
+    return (jit_code_t) (void*) start;
+}
+
+#else
+
+jit_t* jit_new(size_t size, uint32_t threshold) {
+    (void) size;
+    (void) threshold;
+    return NULL; // Pas de generateur de code pour cet hote
+}
+
+void jit_free(jit_t *jit) {
+    (void) jit;
+}
+
+void jit_reset(jit_t *jit) {
+    (void) jit;
+}
+
+jit_code_t jit_compile(jit_t *jit, minirisc_t *mr, minirisc_block_t *block) {
+    (void) jit;
+    (void) mr;
+    (void) block;
+    return NULL;
+}
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef JIT_H
+#define JIT_H
+#include <inttypes.h>
+#include <stddef.h>
+#include "minirisc.h"
+
+/**
+ * Valeur renvoyee par le code natif d'un bloc : (index << 2) | type.
+ */
+#define JIT_EXIT_LINK0    0 // Bloc termine, successeur en sequence (next_PC a jour)
+#define JIT_EXIT_LINK1    1 // Bloc termine, branchement pris ou JAL (next_PC a jour)
+#define JIT_EXIT_INDIRECT 2 // Bloc termine par JALR, cible dynamique dans next_PC
+#define JIT_EXIT_RESUME   3 // Reprendre l'interpretation du bloc a l'instruction `index`
+
+/**
+ * Fonction native generee pour un bloc.
+ */
+typedef int (*jit_code_t)(minirisc_t *mr);
+
+/**
+ * Traducteur dynamique vers du code x86-64, et son tampon de code executable.
+ */
+typedef struct jit {
+    uint8_t  *buffer;    // Zone mmap'ee executable
+    size_t   size;       // Taille de la zone
+    size_t   used;       // Octets deja utilises
+    uint32_t threshold;  // Nombre d'executions interpretees avant compilation
+} jit_t;
+
+/**
+ * Allocate a JIT with a code buffer of `size` bytes.
+ * @return NULL if the host is not x86-64 or the buffer cannot be mapped.
+ */
+jit_t* jit_new(size_t size, uint32_t threshold);
+
+/**
+ * Unmap the code buffer and free the JIT.
+ */
+void jit_free(jit_t *jit);
+
+/**
+ * Forget every compiled block (the buffer is reused from the start).
+ * Must be called when the blocks pointing into the buffer are freed.
+ */
+void jit_reset(jit_t *jit);
+
+/**
+ * Compile a block to native code.
+ * Covers LUI/AUIPC, jumps, branches, loads/stores through the TLB, the ALU
+ * (opcodes 19-37) and the M extension (56-63). Any other instruction, and
+ * any misaligned access or access missing the platform's TLB, leaves the
+ * native code with JIT_EXIT_RESUME so the interpreter executes it.
+ * @return the native code, or NULL if the block cannot be compiled
+ *         (first instruction not supported, or buffer full).
+ */
+jit_code_t jit_compile(jit_t *jit, minirisc_t *mr, minirisc_block_t *block);
+#endif
@@ -1,24 +1,350 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
 #include "platform.h"
 #include "minirisc.h"
+#include "elf_loader.h"
+#include "console.h"
+#include "stats.h"
+#include "batch.h"
+#include "profiler.h"
+#include "trace.h"
+#include "cache.h"
+#include "bpred.h"
+#include "pipeline.h"
+#include "hle.h"
+
+#define PROFILER_PERIOD_US 1000
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-e switch|predecode|threaded|block] [-j seuil] [-m base:taille]... [-o sortie] [-a|-A] [-p pile.folded] [-P periode_us] [-r trace] [-C cache]... [-B predicteurs] [-M pipeline] [-H cout] program.elf|program.bin\n", name);
+    fprintf(stderr, "  -j seuil        : executions d'un bloc avant sa compilation en code natif (0 : JIT desactive)\n");
+    fprintf(stderr, "  -m base:taille  : ajoute une region de RAM (en plus de celle a 0x%08x)\n", PLATFORM_RAM_BASE);
+    fprintf(stderr, "  -o sortie       : fichier recevant la sortie de la console (stdout par defaut)\n");
+    fprintf(stderr, "  -a              : la console ecrit depuis un thread dedie (une sortie lente ne bloque le processeur qu'une fois l'anneau plein)\n");
+    fprintf(stderr, "  -A              : comme -a, mais la sortie qui ne tient plus dans l'anneau est perdue au lieu de bloquer le processeur\n");
+    fprintf(stderr, "  -p pile.folded  : profile le programme, ecrit ses piles d'appels pour un flame graph et son profil sur stderr\n");
+    fprintf(stderr, "  -P periode_us   : temps CPU entre deux echantillons du profileur (%u us par defaut)\n", PROFILER_PERIOD_US);
+    fprintf(stderr, "  -r trace        : enregistre chaque instruction executee (PC, registre ecrit, acces memoire) dans une trace compressee\n");
+    fprintf(stderr, "  -C cache        : simule les caches (\"defaut\", ou l1i=, l1d=, l2=taille:voies:ligne[:lru|fifo|random][:wb|wt][:latence], mem=latence)\n");
+    fprintf(stderr, "  -B predicteurs  : evalue des predicteurs de branchement (\"all\", ou liste de nottaken, bimodal:bits, gshare:bits, tournament:bits, btb:entrees, ras:entrees)\n");
+    fprintf(stderr, "  -M pipeline     : modele de temps du pipeline 5 etages (\"defaut\", ou branch=, jal=, jalr=, loaduse=, mul=, div=cycles)\n");
+    fprintf(stderr, "  -H cout         : execute memcpy, memmove, memset, strlen, strcmp et puts du programme ELF sur l'hote (\"defaut\", ou call=, byte=instructions), sans -r ni -C\n");
+    fprintf(stderr, "       %s -d trace : affiche une trace en texte\n", name);
+    fprintf(stderr, "       %s -b manifeste [-t threads] [-T delai_ms] [-e moteur] [-j seuil] [-H cout] [-S]\n", name);
+    fprintf(stderr, "  -b manifeste    : execute en parallele les images du manifeste et verifie leur etat final (voir batch.h)\n");
+    fprintf(stderr, "  -S              : verifie aussi qu'une sauvegarde prise a mi-parcours puis restauree redonne exactement le meme etat final\n");
+}
+
+int main(int argc, char **argv) {
 
-int main() {
+    const char *engine = NULL;
+    const char *jit_threshold = NULL;
+    const char *rams[PLATFORM_MAX_RAMS];
+    int n_rams = 0;
+    const char *manifest = NULL;
+    const char *output = NULL;
+    int async_console = 0;
+    int drop_console = 0;
+    const char *folded = NULL;
+    uint32_t period_us = PROFILER_PERIOD_US;
+    const char *trace_file = NULL;
+    cache_setup_t cache_setup;
+    int use_caches = 0;
+    const char *predictors = NULL;
+    pipeline_config_t pipeline_config;
+    int use_pipeline = 0;
+    hle_config_t hle_config;
+    int use_hle = 0;
+    batch_config_t batch = { (int) sysconf(_SC_NPROCESSORS_ONLN), NULL, -1, 0, stdout, NULL, 0 };
+    int opt;
 
-    // --- TEST ---
-    // platform_test();
-    minirisc_test();
+    cache_setup_default(&cache_setup);
+    pipeline_config_default(&pipeline_config);
+    hle_config_default(&hle_config);
+    while ((opt = getopt(argc, argv, "e:j:m:o:aAp:P:r:d:C:B:M:H:b:t:T:Sh")) != -1) {
+        switch (opt) {
+            case 'e':
+                engine = optarg;
+                break;
+            case 'j':
+                jit_threshold = optarg;
+                break;
+            case 'm':
+                if (n_rams == PLATFORM_MAX_RAMS - 1) {
+                    fprintf(stderr, "Trop de regions de RAM\n");
+                    return 1;
+                }
+                rams[n_rams++] = optarg;
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            case 'a':
+                async_console = 1;
+                break;
+            case 'A':
+                async_console = 1;
+                drop_console = 1;
+                break;
+            case 'p':
+                folded = optarg;
+                break;
+            case 'P':
+                period_us = (uint32_t) strtoul(optarg, NULL, 0);
+                if (period_us == 0) {
+                    fprintf(stderr, "Periode d'echantillonnage invalide : %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'r':
+                trace_file = optarg;
+                break;
+            case 'd':
+                return trace_dump(optarg, stdout) == 0 ? 0 : 1;
+            case 'C':
+                if (strcmp(optarg, "defaut") != 0 && cache_setup_parse(&cache_setup, optarg) != 0) {
+                    fprintf(stderr, "Configuration de cache invalide : %s\n", optarg);
+                    return 1;
+                }
+                use_caches = 1;
+                break;
+            case 'B':
+                predictors = optarg;
+                break;
+            case 'M':
+                if (strcmp(optarg, "defaut") != 0 && pipeline_config_parse(&pipeline_config, optarg) != 0) {
+                    fprintf(stderr, "Configuration du pipeline invalide : %s\n", optarg);
+                    return 1;
+                }
+                use_pipeline = 1;
+                break;
+            case 'H':
+                if (strcmp(optarg, "defaut") != 0 && hle_config_parse(&hle_config, optarg) != 0) {
+                    fprintf(stderr, "Cout des routines emulees invalide : %s\n", optarg);
+                    return 1;
+                }
+                use_hle = 1;
+                break;
+            case 'b':
+                manifest = optarg;
+                break;
+            case 't':
+                batch.n_threads = atoi(optarg);
+                break;
+            case 'T':
+                batch.timeout_ms = (uint32_t) strtoul(optarg, NULL, 0);
+                break;
+            case 'S':
+                batch.snapshots = 1;
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (use_hle && (trace_file != NULL || use_caches)) {
+        // Une trace ou des statistiques de cache sans ces acces seraient fausses sans le dire.
+        fprintf(stderr, "-H est incompatible avec -r et -C : les acces memoire des routines emulees ne sont ni traces ni vus par les caches\n");
+        return 1;
+    }
 
     platform_t* platform;
     minirisc_t* minirisc;
 
     platform = platform_new();
+    for (int i = 0; i < n_rams; i++) {
+        char *end;
+        uint32_t base = (uint32_t) strtoul(rams[i], &end, 0);
+        if (*end != ':' || platform_add_ram(platform, base, (uint32_t) strtoul(end + 1, NULL, 0)) == NULL) {
+            fprintf(stderr, "Region de RAM invalide : %s\n", rams[i]);
+            platform_free(platform);
+            return 1;
+        }
+    }
     minirisc = minirisc_new(0x80000000, platform);
 
-    // platform_load_program(platform, "/home/wizhack/Document/ensta/architectureordinateurs/embedded_software/test1/build/esw.bin");
-    platform_load_program(platform, "/home/wizhack/Document/ensta/architectureordinateurs/embedded_software/fibonacci/build/esw.bin");
+    if (engine != NULL && minirisc_set_engine(minirisc, engine) != 0) {
+        fprintf(stderr, "Moteur d'execution inconnu : %s\n", engine);
+        usage(argv[0]);
+        minirisc_free(minirisc);
+        platform_free(platform);
+        return 1;
+    }
+
+    if (jit_threshold != NULL && minirisc_set_jit(minirisc, (uint32_t) strtoul(jit_threshold, NULL, 0)) != 0) {
+        fprintf(stderr, "JIT non disponible sur cet hote\n");
+    }
+
+    if (manifest != NULL) {
+        // Chaque image aura sa propre plateforme : celle-ci n'a servi qu'a valider les options.
+        minirisc_free(minirisc);
+        platform_free(platform);
+        batch.engine = engine;
+        batch.hle = use_hle ? &hle_config : NULL;
+        if (jit_threshold != NULL) {
+            batch.jit_threshold = (int64_t) strtoul(jit_threshold, NULL, 0);
+        }
+        return batch_run(manifest, &batch) == 0 ? 0 : 1;
+    }
+
+    int output_fd = -1;
+    if (output != NULL) {
+        output_fd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (output_fd < 0 || platform->console == NULL) {
+            fprintf(stderr, "Impossible d'ouvrir la sortie de la console : %s\n", output);
+            minirisc_free(minirisc);
+            platform_free(platform);
+            return 1;
+        }
+        console_set_output(platform->console, output_fd);
+    }
+    if (async_console && platform->console != NULL && console_start_writer(platform->console, drop_console) != 0) {
+        fprintf(stderr, "Console asynchrone indisponible, sortie synchrone\n");
+    }
+
+    if (optind < argc && elf_loader_is_elf(argv[optind])) {
+        if (elf_loader_load(platform, argv[optind], &minirisc->PC) != 0) {
+            minirisc_free(minirisc);
+            platform_free(platform);
+            return 1;
+        }
+    }
+    else if (optind < argc) {
+        if (platform_load_program(platform, argv[optind]) != 0) {
+            minirisc_free(minirisc);
+            platform_free(platform);
+            return 1;
+        }
+    }
+    else {
+        // Les tests des instructions passent par le manifeste : emulator -b ../embedded_software/tests.manifest
+        usage(argv[0]);
+        minirisc_free(minirisc);
+        platform_free(platform);
+        return 1;
+    }
+
+    hle_t *hle = NULL;
+    if (use_hle) {
+        if (optind < argc && elf_loader_is_elf(argv[optind])) {
+            hle = hle_new(platform, &hle_config, argv[optind]);
+        }
+        else {
+            fprintf(stderr, "Les routines emulees sont liees par les symboles d'un programme ELF\n");
+        }
+        if (hle != NULL) {
+            minirisc_set_hle(minirisc, hle);
+        }
+    }
+
+    bpred_t *bpred = NULL;
+    uint64_t instret = minirisc->counters.instret;
+    if (predictors != NULL) {
+        bpred = bpred_new(predictors);
+        if (bpred == NULL) {
+            fprintf(stderr, "Predicteurs de branchement invalides : %s\n", predictors);
+            minirisc_free(minirisc);
+            platform_free(platform);
+            return 1;
+        }
+        minirisc_set_bpred(minirisc, bpred);
+    }
+
+    trace_t *trace = NULL;
+    if (trace_file != NULL) {
+        trace = trace_new(trace_file, minirisc->PC, minirisc->regs);
+        if (trace == NULL) {
+            minirisc_free(minirisc);
+            platform_free(platform);
+            return 1;
+        }
+        minirisc_set_trace(minirisc, trace);
+    }
+
+    cache_model_t *caches = NULL;
+    if (use_caches) {
+        caches = cache_model_new(platform, &cache_setup);
+        minirisc_set_caches(minirisc, caches);
+    }
+
+    pipeline_t *pipeline = NULL;
+    if (use_pipeline) {
+        int is_elf = optind < argc && elf_loader_is_elf(argv[optind]);
+        pipeline = pipeline_new(&pipeline_config, is_elf ? argv[optind] : NULL);
+        if (pipeline != NULL) {
+            minirisc_set_pipeline(minirisc, pipeline);
+        }
+    }
+
+    profiler_t *profiler = NULL;
+    FILE *folded_file = NULL;
+    if (folded != NULL) {
+        folded_file = fopen(folded, "w");
+        if (folded_file == NULL) {
+            fprintf(stderr, "Impossible d'ouvrir le fichier du profil : %s\n", folded);
+        }
+        else {
+            int is_elf = optind < argc && elf_loader_is_elf(argv[optind]);
+            profiler = profiler_new(minirisc, is_elf ? argv[optind] : NULL);
+        }
+        if (profiler != NULL && profiler_start(profiler, period_us) != 0) {
+            fprintf(stderr, "Timer du profileur indisponible\n");
+            profiler_free(profiler);
+            profiler = NULL;
+        }
+        if (profiler != NULL) {
+            minirisc_set_profiler(minirisc, profiler);
+        }
+    }
+
     minirisc_run(minirisc);
 
+    if (bpred != NULL) {
+        minirisc_set_bpred(minirisc, NULL);
+        bpred_report(bpred, minirisc->counters.instret - instret, stderr);
+        bpred_free(bpred);
+    }
+    if (pipeline != NULL) {
+        minirisc_set_pipeline(minirisc, NULL);
+        pipeline_report(pipeline, stderr);
+        pipeline_free(pipeline);
+    }
+    if (caches != NULL) {
+        minirisc_set_caches(minirisc, NULL);
+        cache_report(caches, stderr);
+        cache_model_free(caches);
+    }
+    if (trace != NULL) {
+        minirisc_set_trace(minirisc, NULL);
+        trace_close(trace);
+    }
+    if (profiler != NULL) {
+        profiler_stop(profiler);
+        minirisc_set_profiler(minirisc, NULL);
+        profiler_report(profiler, stderr);
+        profiler_write_folded(profiler, folded_file);
+        profiler_free(profiler);
+    }
+    if (folded_file != NULL) {
+        fclose(folded_file);
+    }
+    if (hle != NULL) {
+        minirisc_set_hle(minirisc, NULL);
+        hle_report(hle, stderr);
+        hle_free(hle);
+    }
+#ifdef MINIRISC_STATS
+    stats_report(minirisc->stats, stderr);
+#endif
+
     minirisc_free(minirisc);
     platform_free(platform);
+    if (output_fd >= 0) {
+        close(output_fd);
+    }
 
     return 0;
-}
\ No newline at end of file
+}
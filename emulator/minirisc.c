@@ -1,7 +1,45 @@
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
 
 #include "minirisc.h"
 #include "platform.h"
+#include "jit.h"
+#include "console.h"
+#include "stats.h"
+#include "profiler.h"
+#include "trace.h"
+#include "cache.h"
+#include "bpred.h"
+#include "pipeline.h"
+#include "sched.h"
+#include "hle.h"
+
+#define ICACHE_PAGES      PLATFORM_PAGES
+#define ICACHE_PAGE_INSNS (PLATFORM_PAGE_SIZE / 4)
+
+#define BLOCK_HASH_SIZE 4096
+#define JIT_BUFFER_SIZE (16 * 1024 * 1024)
+#define JIT_THRESHOLD   64
+
+#ifdef MINIRISC_STATS
+#define STATS_COUNT(mr, PC, opcode, n) stats_count((mr)->stats, (PC), (opcode), (n))
+#else
+#define STATS_COUNT(mr, PC, opcode, n) ((void) 0)
+#endif
+
+// Apres un saut (next_PC = cible) : JAL/JALR avec rd = ra appelle, JALR x0, 0(ra) revient.
+#define PROFILE_JUMP(mr, rd, rs1, jalr) do { \
+    if ((mr)->profiler != NULL) { \
+        if ((rd) == 1) profiler_call((mr)->profiler, (mr)->next_PC, (mr)->PC + 4); \
+        else if ((jalr) && (rd) == 0 && (rs1) == 1) profiler_return((mr)->profiler, (mr)->next_PC); \
+    } \
+} while (0)
+
+static void minirisc_icache_invalidate(void *opaque, uint32_t addr, uint32_t size);
+static void minirisc_block_flush(minirisc_t *mr);
+static uint64_t minirisc_clock(void *opaque);
+static void minirisc_kick(void *opaque);
 
 minirisc_t* minirisc_new(uint32_t initial_PC, platform_t *platform) {
 
@@ -18,6 +56,50 @@ minirisc_t* minirisc_new(uint32_t initial_PC, platform_t *platform) {
     minirisc->halt = 0; 
     minirisc->csr.mstatus = 0;
     minirisc->csr.mepc = 0;
+    minirisc->csr.mtvec = 0;
+    minirisc->csr.mcause = 0;
+    minirisc->csr.mcycle_offset = 0;
+    minirisc->csr.minstret_offset = 0;
+    for (int i = 0; i < MINIRISC_HPM_COUNTERS; i++) {
+        minirisc->csr.mhpmcounter_offset[i] = 0;
+        // Au reset, mhpmcounter3 a mhpmcounter7 comptent chacun un evenement.
+        minirisc->csr.mhpmevent[i] = i + 1 < MINIRISC_EVENTS ? (uint32_t) (i + 1) : MINIRISC_EVENT_NONE;
+    }
+    memset(&minirisc->counters, 0, sizeof(minirisc->counters));
+
+    // Table de 8 Mo dont seules les entrees touchees occupent de la memoire.
+    // mmap plutot que calloc : apres une liberation, glibc servirait la
+    // suivante depuis le tas et la remettrait entierement a zero.
+    minirisc->icache = (minirisc_insn_t**) mmap(NULL, ICACHE_PAGES * sizeof(minirisc_insn_t*), PROT_READ | PROT_WRITE,
+                                                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    minirisc->icache_pages = NULL;
+    minirisc->n_icache_pages = 0;
+    minirisc->icache_capacity = 0;
+    minirisc->blocks = (minirisc_block_t**) calloc(BLOCK_HASH_SIZE, sizeof(minirisc_block_t*));
+    minirisc->block_flush = 0;
+    minirisc->block_list = NULL;
+    minirisc->jit = jit_new(JIT_BUFFER_SIZE, JIT_THRESHOLD);
+    minirisc->profiler = NULL;
+    minirisc->trace = NULL;
+    minirisc->caches = NULL;
+    minirisc->bpred = NULL;
+    minirisc->pipeline = NULL;
+    minirisc->hle = NULL;
+    minirisc->deadline = 0;
+    minirisc->wfi = 0;
+#ifdef MINIRISC_STATS
+    minirisc->stats = stats_new();
+#endif
+#ifdef __GNUC__
+    minirisc->engine = MINIRISC_ENGINE_BLOCK;
+#else
+    minirisc->engine = MINIRISC_ENGINE_PREDECODE;
+#endif
+    platform->code_write = minirisc_icache_invalidate;
+    platform->code_opaque = minirisc;
+    platform->clock = minirisc_clock;
+    platform->kick = minirisc_kick;
+    platform->core_opaque = minirisc;
 
     return minirisc;
 }
@@ -27,6 +109,25 @@ void minirisc_set_reg(minirisc_t* mr, int n_registre, uint32_t valeur) {
 }
 
 void minirisc_free(minirisc_t* mr) {
+    for (uint32_t i = 0; i < mr->n_icache_pages; i++) {
+        free(mr->icache[mr->icache_pages[i]]);
+        mr->platform->code_pages[mr->icache_pages[i]] = 0;
+    }
+    munmap(mr->icache, ICACHE_PAGES * sizeof(minirisc_insn_t*));
+    free(mr->icache_pages);
+    minirisc_block_flush(mr);
+    free(mr->blocks);
+    if (mr->jit != NULL) {
+        jit_free(mr->jit);
+    }
+#ifdef MINIRISC_STATS
+    stats_free(mr->stats);
+#endif
+    mr->platform->code_write = NULL;
+    mr->platform->code_opaque = NULL;
+    mr->platform->clock = NULL;
+    mr->platform->kick = NULL;
+    mr->platform->core_opaque = NULL;
     free(mr);
 }
 
@@ -41,20 +142,176 @@ void minirisc_fetch(minirisc_t *mr) {
     }
 }
 
+/**
+ * Valeur depuis le reset d'un evenement.
+ */
+static uint64_t minirisc_event_count(minirisc_t *mr, uint32_t event) {
+    switch (event) {
+        case MINIRISC_EVENT_LOAD:
+        case MINIRISC_EVENT_STORE:
+        case MINIRISC_EVENT_BRANCH:
+        case MINIRISC_EVENT_MEXT:
+            return mr->counters.events[event];
+        case MINIRISC_EVENT_MMIO:
+            return mr->platform->mmio_accesses;
+        default:
+            return 0; // Compteur arrete
+    }
+}
+
+/**
+ * Compteur numero n (0 : mcycle, 2 : minstret, 3 et plus : mhpmcounterN) :
+ * place sa valeur depuis le reset dans raw et renvoie son decalage, ou NULL
+ * si le compteur n'existe pas.
+ */
+static uint64_t* minirisc_counter(minirisc_t *mr, uint32_t n, uint64_t *raw) {
+    if (n == 0) {
+        // Un cycle par instruction sans modele de pipeline, plus le temps passe dans WFI
+        *raw = mr->counters.instret + mr->counters.stalls + mr->counters.idle;
+        return &mr->csr.mcycle_offset;
+    }
+    if (n == 2) {
+        *raw = mr->counters.instret;
+        return &mr->csr.minstret_offset;
+    }
+    if (n >= 3 && n < 3 + MINIRISC_HPM_COUNTERS) {
+        *raw = minirisc_event_count(mr, mr->csr.mhpmevent[n - 3]);
+        return &mr->csr.mhpmcounter_offset[n - 3];
+    }
+    return NULL;
+}
+
 uint32_t csr_read(minirisc_t *mr, uint32_t csr_num) {
+    uint64_t raw;
+    uint64_t *offset;
     switch (csr_num) {
         case 0x300: return mr->csr.mstatus;
+        case 0x305: return mr->csr.mtvec;
         case 0x341: return mr->csr.mepc;
-        default: return 0; // CSR inconnu ou non implémenté
+        case 0x342: return mr->csr.mcause;
     }
+    if (csr_num >= 0x323 && csr_num < 0x323 + MINIRISC_HPM_COUNTERS) {
+        return mr->csr.mhpmevent[csr_num - 0x323];
+    }
+    // Compteurs machine (0xB..) et leurs copies utilisateur (0xC..), bit 7 : moitie haute
+    if ((csr_num & ~0x9Fu) == 0xB00 || (csr_num & ~0x9Fu) == 0xC00) {
+        minirisc_sync_counters(mr);
+        offset = minirisc_counter(mr, csr_num & 0x1F, &raw);
+        if (offset != NULL) {
+            return (uint32_t) ((raw - *offset) >> (csr_num & 0x80 ? 32 : 0));
+        }
+    }
+    return 0; // CSR inconnu ou non implémenté
 }
 
 void csr_write(minirisc_t *mr, uint32_t csr_num, uint32_t value) {
+    uint64_t raw, counter;
+    uint64_t *offset;
     switch (csr_num) {
-        case 0x300: mr->csr.mstatus = value; break;
-        case 0x341: mr->csr.mepc = value; break;
-        default: break; // On ignore les écritures vers des CSR inconnus
+        case 0x300:
+            mr->csr.mstatus = value;
+            mr->deadline = 0; // Une interruption en attente est peut-etre autorisee
+            return;
+        case 0x305: mr->csr.mtvec = value & ~0x3u; return;
+        case 0x341: mr->csr.mepc = value; return;
+        case 0x342: mr->csr.mcause = value; return;
+    }
+    if (csr_num >= 0x323 && csr_num < 0x323 + MINIRISC_HPM_COUNTERS) {
+        // Le compteur garde sa valeur et compte desormais le nouvel evenement.
+        uint32_t n = csr_num - 0x323;
+        minirisc_sync_counters(mr);
+        counter = minirisc_event_count(mr, mr->csr.mhpmevent[n]) - mr->csr.mhpmcounter_offset[n];
+        mr->csr.mhpmevent[n] = value < MINIRISC_EVENTS ? value : MINIRISC_EVENT_NONE;
+        mr->csr.mhpmcounter_offset[n] = minirisc_event_count(mr, mr->csr.mhpmevent[n]) - counter;
+        return;
+    }
+    // Seuls les compteurs machine sont modifiables, les copies 0xC.. sont en lecture seule.
+    if ((csr_num & ~0x9Fu) == 0xB00) {
+        minirisc_sync_counters(mr);
+        offset = minirisc_counter(mr, csr_num & 0x1F, &raw);
+        if (offset != NULL) {
+            counter = raw - *offset;
+            if (csr_num & 0x80) {
+                counter = (counter & 0xFFFFFFFFu) | ((uint64_t) value << 32);
+            }
+            else {
+                counter = (counter & ~(uint64_t) 0xFFFFFFFFu) | value;
+            }
+            *offset = raw - counter;
+        }
+    }
+    // On ignore les écritures vers des CSR inconnus
+}
+
+/**
+ * Temps virtuel vu par les peripheriques : instructions executees et temps
+ * saute par WFI. Le moteur a blocs compte les instructions d'un bloc des
+ * qu'il y entre.
+ */
+static uint64_t minirisc_clock(void *opaque) {
+    minirisc_t *mr = (minirisc_t*) opaque;
+    return mr->counters.instret + mr->counters.idle;
+}
+
+static void minirisc_kick(void *opaque) {
+    ((minirisc_t*) opaque)->deadline = 0;
+}
+
+/**
+ * Appele par les moteurs avant l'instruction situee a PC quand instret
+ * atteint deadline : execute les evenements echus des peripheriques, fait
+ * sauter le temps d'evenement en evenement si le processeur attend dans WFI,
+ * prend l'interruption en attente de plus petit numero si mstatus
+ * l'autorise, puis recalcule deadline a partir du prochain evenement.
+ */
+static void minirisc_service(minirisc_t *mr) {
+    platform_t *plt = mr->platform;
+    uint64_t now = minirisc_clock(mr);
+
+    sched_run(plt->sched, now);
+    while (mr->wfi && plt->irq_pending == 0) {
+        uint64_t next = sched_next(plt->sched);
+        if (next == SCHED_NEVER) {
+            fprintf(stderr, "Erreur : WFI a 0x%08x sans interruption possible, arret\n", mr->PC - 4);
+            mr->halt = 1;
+            break;
+        }
+        // Rien ne peut se passer avant le prochain evenement : le temps y saute directement.
+        mr->counters.idle += next - now;
+        now = next;
+        sched_run(plt->sched, now);
+    }
+    mr->wfi = 0;
+
+    if ((mr->csr.mstatus & MINIRISC_MSTATUS_IE) && plt->irq_pending != 0 && !mr->halt) {
+        uint32_t line = 0;
+        while ((plt->irq_pending & (1u << line)) == 0) {
+            line++;
+        }
+        mr->csr.mepc = mr->PC;
+        mr->csr.mstatus &= ~MINIRISC_MSTATUS_IE;
+        mr->csr.mcause = MINIRISC_MCAUSE_IRQ | line;
+        mr->PC = mr->csr.mtvec;
     }
+    // Les evenements ont pu remettre deadline a 0 : il est fixe en dernier.
+    uint64_t next = sched_next(plt->sched);
+    mr->deadline = next == SCHED_NEVER ? UINT64_MAX : next - mr->counters.idle;
+}
+
+/**
+ * Evenement compte statiquement par une instruction d'opcode donne.
+ */
+static minirisc_event_t minirisc_opcode_event(uint32_t opcode) {
+    if (opcode >= 11 && opcode <= 15) {
+        return MINIRISC_EVENT_LOAD;
+    }
+    if (opcode >= 16 && opcode <= 18) {
+        return MINIRISC_EVENT_STORE;
+    }
+    if (opcode >= 56 && opcode <= 63) {
+        return MINIRISC_EVENT_MEXT;
+    }
+    return MINIRISC_EVENT_NONE;
 }
 
 void minirisc_decode_and_execute(minirisc_t* mr) {
@@ -72,7 +329,9 @@ void minirisc_decode_and_execute(minirisc_t* mr) {
     uint32_t old_val;
     int imm5 = (mr->IR >> 12) & 0x1F;
 
-
+    mr->counters.instret++;
+    mr->counters.events[minirisc_opcode_event(opcode)]++;
+    STATS_COUNT(mr, mr->PC, opcode, 1);
 
     switch (opcode) {
         case 1: // LUI
@@ -91,6 +350,7 @@ void minirisc_decode_and_execute(minirisc_t* mr) {
             }
             mr->next_PC = mr->PC + offset;
             minirisc_set_reg(mr,RD,mr->PC + 4);
+            PROFILE_JUMP(mr, RD, 0, 0);
             break;
         case 4: //JALR
             offset = (mr->IR) >> 20;
@@ -100,6 +360,7 @@ void minirisc_decode_and_execute(minirisc_t* mr) {
             }
             mr->next_PC = (mr->regs[RS] + offset) & 0xFFFFFFFE;
             minirisc_set_reg(mr,RD,mr->PC + 4);
+            PROFILE_JUMP(mr, RD, RS, 1);
             break;
         case 5: // BEQ
             offset = (mr->IR) >> 19; // Décalage
@@ -110,6 +371,7 @@ void minirisc_decode_and_execute(minirisc_t* mr) {
             }
             if (mr->regs[RS1] == mr->regs[RS2]) {
                 mr->next_PC = mr->PC + offset;
+                mr->counters.events[MINIRISC_EVENT_BRANCH]++;
             }
             break;
         case 6: // BNE
@@ -121,6 +383,7 @@ void minirisc_decode_and_execute(minirisc_t* mr) {
             }
             if (mr->regs[RS1] != mr->regs[RS2]) {
                 mr->next_PC = mr->PC + offset;
+                mr->counters.events[MINIRISC_EVENT_BRANCH]++;
             }
             break;
         case 7: // BLT
@@ -132,6 +395,7 @@ void minirisc_decode_and_execute(minirisc_t* mr) {
             }
             if ((int32_t) mr->regs[RS1] < (int32_t) mr->regs[RS2]) {
                 mr->next_PC = mr->PC + offset;
+                mr->counters.events[MINIRISC_EVENT_BRANCH]++;
             }
             break;
         case 8: // BGE
@@ -143,6 +407,7 @@ void minirisc_decode_and_execute(minirisc_t* mr) {
             }
             if ((int32_t) mr->regs[RS1] >= (int32_t) mr->regs[RS2]) {
                 mr->next_PC = mr->PC + offset;
+                mr->counters.events[MINIRISC_EVENT_BRANCH]++;
             }
             break;
         case 9: // BLTU
@@ -154,6 +419,7 @@ void minirisc_decode_and_execute(minirisc_t* mr) {
             }
             if (mr->regs[RS1] < mr->regs[RS2]) {
                 mr->next_PC = mr->PC + offset;
+                mr->counters.events[MINIRISC_EVENT_BRANCH]++;
             }
             break;
         case 10: // BGEU
@@ -165,6 +431,7 @@ void minirisc_decode_and_execute(minirisc_t* mr) {
             }
             if (mr->regs[RS1] >= mr->regs[RS2]) {
                 mr->next_PC = mr->PC + offset;
+                mr->counters.events[MINIRISC_EVENT_BRANCH]++;
             }
             break;
         case 11: // LB
@@ -363,10 +630,20 @@ void minirisc_decode_and_execute(minirisc_t* mr) {
             mr->halt = 1;
             break;
         case 40: // RETI
-            mr->csr.mstatus |= 0x2; // On met a jour le bit INTERRUPT_ENABLE.
+            mr->csr.mstatus |= MINIRISC_MSTATUS_IE; // On met a jour le bit INTERRUPT_ENABLE.
             mr->next_PC = mr->csr.mepc;
+            mr->deadline = 0;
             break;
         case 41: // WFI
+            mr->wfi = 1;
+            mr->deadline = 0;
+            break;
+        case 48: // HLE : routine emulee sur l'hote, retour a ra
+            if (mr->hle == NULL || hle_call(mr->hle, mr, mr->IR >> 20) != 0) {
+                mr->halt = 1;
+                break;
+            }
+            PROFILE_JUMP(mr, 0, 1, 1);
             break;
         case 42: // CSRRW
             old_val = mr->regs[RS];
@@ -463,8 +740,485 @@ void minirisc_decode_and_execute(minirisc_t* mr) {
     }
 }
 
-void minirisc_run(minirisc_t* mr) {
+/*
+ * Cache d'instructions predecodees.
+ *
+ * Chaque page de RAM executee possede un tableau de minirisc_insn_t (une
+ * entree par mot) alloue a la premiere execution. Une entree est decodee une
+ * seule fois par minirisc_predecode() puis executee directement par son
+ * handler. La plateforme previent le processeur (code_write) quand une
+ * ecriture touche une page marquee dans code_pages, et l'entree concernee est
+ * invalidee.
+ */
+
+static void op_lui(minirisc_t *mr, const minirisc_insn_t *d) {
+    minirisc_set_reg(mr, d->rd, d->imm);
+}
+
+static void op_auipc(minirisc_t *mr, const minirisc_insn_t *d) {
+    minirisc_set_reg(mr, d->rd, d->imm); // PC + immediat, calcule au decodage
+}
+
+static void op_jal(minirisc_t *mr, const minirisc_insn_t *d) {
+    mr->next_PC = d->imm;
+    minirisc_set_reg(mr, d->rd, mr->PC + 4);
+    PROFILE_JUMP(mr, d->rd, 0, 0);
+}
+
+static void op_jalr(minirisc_t *mr, const minirisc_insn_t *d) {
+    mr->next_PC = (mr->regs[d->rs1] + d->imm) & 0xFFFFFFFE;
+    minirisc_set_reg(mr, d->rd, mr->PC + 4);
+    PROFILE_JUMP(mr, d->rd, d->rs1, 1);
+}
+
+static void op_beq(minirisc_t *mr, const minirisc_insn_t *d) {
+    if (mr->regs[d->rs1] == mr->regs[d->rs2]) {
+        mr->next_PC = d->imm;
+        mr->counters.events[MINIRISC_EVENT_BRANCH]++;
+    }
+}
+
+static void op_bne(minirisc_t *mr, const minirisc_insn_t *d) {
+    if (mr->regs[d->rs1] != mr->regs[d->rs2]) {
+        mr->next_PC = d->imm;
+        mr->counters.events[MINIRISC_EVENT_BRANCH]++;
+    }
+}
+
+static void op_blt(minirisc_t *mr, const minirisc_insn_t *d) {
+    if ((int32_t) mr->regs[d->rs1] < (int32_t) mr->regs[d->rs2]) {
+        mr->next_PC = d->imm;
+        mr->counters.events[MINIRISC_EVENT_BRANCH]++;
+    }
+}
+
+static void op_bge(minirisc_t *mr, const minirisc_insn_t *d) {
+    if ((int32_t) mr->regs[d->rs1] >= (int32_t) mr->regs[d->rs2]) {
+        mr->next_PC = d->imm;
+        mr->counters.events[MINIRISC_EVENT_BRANCH]++;
+    }
+}
+
+static void op_bltu(minirisc_t *mr, const minirisc_insn_t *d) {
+    if (mr->regs[d->rs1] < mr->regs[d->rs2]) {
+        mr->next_PC = d->imm;
+        mr->counters.events[MINIRISC_EVENT_BRANCH]++;
+    }
+}
+
+static void op_bgeu(minirisc_t *mr, const minirisc_insn_t *d) {
+    if (mr->regs[d->rs1] >= mr->regs[d->rs2]) {
+        mr->next_PC = d->imm;
+        mr->counters.events[MINIRISC_EVENT_BRANCH]++;
+    }
+}
+
+static void op_lb(minirisc_t *mr, const minirisc_insn_t *d) {
+    uint32_t value = 0;
+    platform_read_fast(mr->platform, ACCESS_BYTE, mr->regs[d->rs1] + d->imm, &value);
+    minirisc_set_reg(mr, d->rd, value);
+}
+
+static void op_lbu(minirisc_t *mr, const minirisc_insn_t *d) {
+    uint32_t value = 0;
+    platform_read_fast(mr->platform, ACCESS_BYTE, mr->regs[d->rs1] + d->imm, &value);
+    minirisc_set_reg(mr, d->rd, value & 0x000000FF);
+}
+
+static void load_error(minirisc_t *mr, const minirisc_insn_t *d) {
+    fprintf(stderr, "Erreur : Load address misaligned exception at 0x%08x\n", (mr->regs[d->rs1] + d->imm));
+    mr->halt = 1;
+}
+
+static void op_lh(minirisc_t *mr, const minirisc_insn_t *d) {
+    uint32_t value;
+    if (platform_read_fast(mr->platform, ACCESS_HALF, mr->regs[d->rs1] + d->imm, &value) == 0) {
+        minirisc_set_reg(mr, d->rd, value);
+    }
+    else {
+        load_error(mr, d);
+    }
+}
+
+static void op_lhu(minirisc_t *mr, const minirisc_insn_t *d) {
+    uint32_t value;
+    if (platform_read_fast(mr->platform, ACCESS_HALF, mr->regs[d->rs1] + d->imm, &value) == 0) {
+        minirisc_set_reg(mr, d->rd, value & 0x0000FFFF);
+    }
+    else {
+        load_error(mr, d);
+    }
+}
+
+static void op_lw(minirisc_t *mr, const minirisc_insn_t *d) {
+    uint32_t value;
+    if (platform_read_fast(mr->platform, ACCESS_WORD, mr->regs[d->rs1] + d->imm, &value) == 0) {
+        minirisc_set_reg(mr, d->rd, value);
+    }
+    else {
+        load_error(mr, d);
+    }
+}
+
+static void store_error(minirisc_t *mr, const minirisc_insn_t *d) {
+    fprintf(stderr, "Erreur : Store address misaligned exception at 0x%08x\n", (mr->regs[d->rs1] + d->imm));
+    mr->halt = 1;
+}
+
+static void op_sb(minirisc_t *mr, const minirisc_insn_t *d) {
+    platform_write_fast(mr->platform, ACCESS_BYTE, mr->regs[d->rs1] + d->imm, mr->regs[d->rs2]);
+}
+
+static void op_sh(minirisc_t *mr, const minirisc_insn_t *d) {
+    if (platform_write_fast(mr->platform, ACCESS_HALF, mr->regs[d->rs1] + d->imm, mr->regs[d->rs2]) != 0) {
+        store_error(mr, d);
+    }
+}
+
+static void op_sw(minirisc_t *mr, const minirisc_insn_t *d) {
+    if (platform_write_fast(mr->platform, ACCESS_WORD, mr->regs[d->rs1] + d->imm, mr->regs[d->rs2]) != 0) {
+        store_error(mr, d);
+    }
+}
+
+static void op_addi(minirisc_t *mr, const minirisc_insn_t *d) {
+    minirisc_set_reg(mr, d->rd, mr->regs[d->rs1] + d->imm);
+}
+
+static void op_slti(minirisc_t *mr, const minirisc_insn_t *d) {
+    minirisc_set_reg(mr, d->rd, (int32_t) mr->regs[d->rs1] < (int32_t) d->imm);
+}
+
+static void op_sltiu(minirisc_t *mr, const minirisc_insn_t *d) {
+    minirisc_set_reg(mr, d->rd, mr->regs[d->rs1] < d->imm);
+}
+
+static void op_xori(minirisc_t *mr, const minirisc_insn_t *d) {
+    minirisc_set_reg(mr, d->rd, mr->regs[d->rs1] ^ d->imm);
+}
+
+static void op_ori(minirisc_t *mr, const minirisc_insn_t *d) {
+    minirisc_set_reg(mr, d->rd, mr->regs[d->rs1] | d->imm);
+}
+
+static void op_andi(minirisc_t *mr, const minirisc_insn_t *d) {
+    minirisc_set_reg(mr, d->rd, mr->regs[d->rs1] & d->imm);
+}
+
+static void op_slli(minirisc_t *mr, const minirisc_insn_t *d) {
+    minirisc_set_reg(mr, d->rd, mr->regs[d->rs1] << d->imm);
+}
+
+static void op_srli(minirisc_t *mr, const minirisc_insn_t *d) {
+    minirisc_set_reg(mr, d->rd, mr->regs[d->rs1] >> d->imm);
+}
+
+static void op_srai(minirisc_t *mr, const minirisc_insn_t *d) {
+    minirisc_set_reg(mr, d->rd, ((int32_t) mr->regs[d->rs1]) >> d->imm);
+}
+
+static void op_add(minirisc_t *mr, const minirisc_insn_t *d) {
+    minirisc_set_reg(mr, d->rd, mr->regs[d->rs1] + mr->regs[d->rs2]);
+}
+
+static void op_sub(minirisc_t *mr, const minirisc_insn_t *d) {
+    minirisc_set_reg(mr, d->rd, mr->regs[d->rs1] - mr->regs[d->rs2]);
+}
+
+static void op_sll(minirisc_t *mr, const minirisc_insn_t *d) {
+    minirisc_set_reg(mr, d->rd, mr->regs[d->rs1] << (mr->regs[d->rs2] & 0x1F));
+}
+
+static void op_srl(minirisc_t *mr, const minirisc_insn_t *d) {
+    minirisc_set_reg(mr, d->rd, mr->regs[d->rs1] >> (mr->regs[d->rs2] & 0x1F));
+}
+
+static void op_sra(minirisc_t *mr, const minirisc_insn_t *d) {
+    minirisc_set_reg(mr, d->rd, ((int32_t) mr->regs[d->rs1]) >> (mr->regs[d->rs2] & 0x1F));
+}
+
+static void op_slt(minirisc_t *mr, const minirisc_insn_t *d) {
+    minirisc_set_reg(mr, d->rd, (int32_t) mr->regs[d->rs1] < (int32_t) mr->regs[d->rs2]);
+}
+
+static void op_sltu(minirisc_t *mr, const minirisc_insn_t *d) {
+    minirisc_set_reg(mr, d->rd, mr->regs[d->rs1] < mr->regs[d->rs2]);
+}
+
+static void op_xor(minirisc_t *mr, const minirisc_insn_t *d) {
+    minirisc_set_reg(mr, d->rd, mr->regs[d->rs1] ^ mr->regs[d->rs2]);
+}
+
+static void op_or(minirisc_t *mr, const minirisc_insn_t *d) {
+    minirisc_set_reg(mr, d->rd, mr->regs[d->rs1] | mr->regs[d->rs2]);
+}
+
+static void op_and(minirisc_t *mr, const minirisc_insn_t *d) {
+    minirisc_set_reg(mr, d->rd, mr->regs[d->rs1] & mr->regs[d->rs2]);
+}
+
+static void op_ecall(minirisc_t *mr, const minirisc_insn_t *d) {
+    (void) d;
+    minirisc_set_reg(mr, 10, -1);
+}
+
+static void op_halt(minirisc_t *mr, const minirisc_insn_t *d) {
+    (void) d;
+    mr->halt = 1; // EBREAK et opcodes inconnus
+}
+
+static void op_reti(minirisc_t *mr, const minirisc_insn_t *d) {
+    (void) d;
+    mr->csr.mstatus |= MINIRISC_MSTATUS_IE; // On met a jour le bit INTERRUPT_ENABLE.
+    mr->next_PC = mr->csr.mepc;
+    mr->deadline = 0;
+}
+
+// L'attente elle-meme est faite par minirisc_service(), avant l'instruction suivante.
+static void op_wfi(minirisc_t *mr, const minirisc_insn_t *d) {
+    (void) d;
+    mr->wfi = 1;
+    mr->deadline = 0;
+}
+
+static void op_hle(minirisc_t *mr, const minirisc_insn_t *d) {
+    if (mr->hle == NULL || hle_call(mr->hle, mr, d->imm) != 0) {
+        mr->halt = 1;
+        return;
+    }
+    PROFILE_JUMP(mr, 0, 1, 1);
+}
+
+// Les operations CSR reprennent exactement la semantique du switch de reference.
+static void op_csrrw(minirisc_t *mr, const minirisc_insn_t *d) {
+    uint32_t old_val = mr->regs[d->rs1];
+    if (d->rd != 0) {
+        minirisc_set_reg(mr, d->rd, csr_read(mr, d->imm));
+    }
+    csr_write(mr, d->imm, old_val);
+}
+
+static void op_csrrs(minirisc_t *mr, const minirisc_insn_t *d) {
+    if (d->rd != 0) {
+        csr_write(mr, d->imm, csr_read(mr, d->imm) | mr->regs[d->rs1]);
+    }
+    minirisc_set_reg(mr, d->rd, csr_read(mr, d->imm));
+}
+
+static void op_csrrc(minirisc_t *mr, const minirisc_insn_t *d) {
+    if (d->rd != 0) {
+        csr_write(mr, d->imm, csr_read(mr, d->imm) & ~mr->regs[d->rs1]);
+    }
+    minirisc_set_reg(mr, d->rd, csr_read(mr, d->imm));
+}
+
+static void op_csrrwi(minirisc_t *mr, const minirisc_insn_t *d) {
+    if (d->rd != 0) {
+        minirisc_set_reg(mr, d->rd, csr_read(mr, d->imm));
+    }
+    csr_write(mr, d->imm, d->rs1); // rs1 contient imm5
+}
+
+static void op_csrrsi(minirisc_t *mr, const minirisc_insn_t *d) {
+    minirisc_set_reg(mr, d->rd, csr_read(mr, d->imm));
+    if (d->rs1 != 0) {
+        csr_write(mr, d->imm, csr_read(mr, d->imm) | d->rs1);
+    }
+}
+
+static void op_csrrci(minirisc_t *mr, const minirisc_insn_t *d) {
+    minirisc_set_reg(mr, d->rd, csr_read(mr, d->imm));
+    if (d->rs1 != 0) {
+        csr_write(mr, d->imm, csr_read(mr, d->imm) & ~(uint32_t) d->rs1);
+    }
+}
+
+static void op_mul(minirisc_t *mr, const minirisc_insn_t *d) {
+    minirisc_set_reg(mr, d->rd, mr->regs[d->rs1] * mr->regs[d->rs2]);
+}
+
+static void op_mulh(minirisc_t *mr, const minirisc_insn_t *d) {
+    minirisc_set_reg(mr, d->rd, (uint32_t)(((int64_t)(int32_t)mr->regs[d->rs1] * (int64_t)(int32_t)mr->regs[d->rs2]) >> 32));
+}
+
+static void op_mulhsu(minirisc_t *mr, const minirisc_insn_t *d) {
+    minirisc_set_reg(mr, d->rd, (uint32_t)(((int64_t)(int32_t)mr->regs[d->rs1] * (uint64_t)mr->regs[d->rs2]) >> 32));
+}
+
+static void op_mulhu(minirisc_t *mr, const minirisc_insn_t *d) {
+    minirisc_set_reg(mr, d->rd, (uint32_t)(((uint64_t)mr->regs[d->rs1] * (uint64_t)mr->regs[d->rs2]) >> 32));
+}
+
+static void op_div(minirisc_t *mr, const minirisc_insn_t *d) {
+    uint32_t a = mr->regs[d->rs1], b = mr->regs[d->rs2];
+    if (b == 0) minirisc_set_reg(mr, d->rd, -1);
+    else if (a == 0x80000000 && (int32_t) b == -1) minirisc_set_reg(mr, d->rd, a);
+    else minirisc_set_reg(mr, d->rd, (int32_t) a / (int32_t) b);
+}
+
+static void op_divu(minirisc_t *mr, const minirisc_insn_t *d) {
+    uint32_t a = mr->regs[d->rs1], b = mr->regs[d->rs2];
+    minirisc_set_reg(mr, d->rd, b == 0 ? 0xFFFFFFFF : a / b);
+}
+
+static void op_rem(minirisc_t *mr, const minirisc_insn_t *d) {
+    uint32_t a = mr->regs[d->rs1], b = mr->regs[d->rs2];
+    if (b == 0) minirisc_set_reg(mr, d->rd, a);
+    else if (a == 0x80000000 && (int32_t) b == -1) minirisc_set_reg(mr, d->rd, 0);
+    else minirisc_set_reg(mr, d->rd, (int32_t) a % (int32_t) b);
+}
+
+static void op_remu(minirisc_t *mr, const minirisc_insn_t *d) {
+    uint32_t a = mr->regs[d->rs1], b = mr->regs[d->rs2];
+    minirisc_set_reg(mr, d->rd, b == 0 ? a : a % b);
+}
+
+void minirisc_predecode(uint32_t IR, uint32_t PC, minirisc_insn_t *d) {
+    uint32_t imm_i = IR >> 20;
+    uint32_t imm_b = (IR >> 19) & 0xFFFFFFFE;
+    uint32_t imm_j = (IR & 0xFFFFF000) >> 11;
+    if (IR >> 31) { // Extension de signe
+        imm_i |= 0xFFFFF000;
+        imm_b |= 0xFFFFE000;
+        imm_j |= 0xFFE00000;
+    }
+
+    d->IR = IR;
+    d->opcode = IR & 0x7F;
+    d->rd = (IR >> 7) & 0x1F;
+    d->rs1 = (IR >> 12) & 0x1F;
+    d->rs2 = (IR >> 17) & 0x1F;
+    d->imm = imm_i;
+    d->event = minirisc_opcode_event(d->opcode);
+
+    switch (d->opcode) {
+        case 1:  d->exec = op_lui;   d->imm = IR & 0xFFFFF000; break;
+        case 2:  d->exec = op_auipc; d->imm = PC + (IR & 0xFFFFF000); break;
+        case 3:  d->exec = op_jal;   d->imm = PC + imm_j; break;
+        case 4:  d->exec = op_jalr;  break;
+        case 5: case 6: case 7: case 8: case 9: case 10:
+            // Les branchements comparent rs1 (bits 12-16) et rs2 (bits 7-11)
+            d->rs2 = d->rd;
+            d->imm = PC + imm_b;
+            switch (d->opcode) {
+                case 5:  d->exec = op_beq;  break;
+                case 6:  d->exec = op_bne;  break;
+                case 7:  d->exec = op_blt;  break;
+                case 8:  d->exec = op_bge;  break;
+                case 9:  d->exec = op_bltu; break;
+                default: d->exec = op_bgeu; break;
+            }
+            break;
+        case 11: d->exec = op_lb;  break;
+        case 12: d->exec = op_lh;  break;
+        case 13: d->exec = op_lw;  break;
+        case 14: d->exec = op_lbu; break;
+        case 15: d->exec = op_lhu; break;
+        case 16: d->exec = op_sb; d->rs2 = d->rd; break; // Valeur a ecrire dans les bits 7-11
+        case 17: d->exec = op_sh; d->rs2 = d->rd; break;
+        case 18: d->exec = op_sw; d->rs2 = d->rd; break;
+        case 19: d->exec = op_addi;  break;
+        case 20: d->exec = op_slti;  break;
+        case 21: d->exec = op_sltiu; break;
+        case 22: d->exec = op_xori;  break;
+        case 23: d->exec = op_ori;   break;
+        case 24: d->exec = op_andi;  break;
+        case 25: d->exec = op_slli; d->imm &= 0x1F; break;
+        case 26: d->exec = op_srli; d->imm &= 0x1F; break;
+        case 27: d->exec = op_srai; d->imm &= 0x1F; break;
+        case 28: d->exec = op_add;  break;
+        case 29: d->exec = op_sub;  break;
+        case 30: d->exec = op_sll;  break;
+        case 31: d->exec = op_srl;  break;
+        case 32: d->exec = op_sra;  break;
+        case 33: d->exec = op_slt;  break;
+        case 34: d->exec = op_sltu; break;
+        case 35: d->exec = op_xor;  break;
+        case 36: d->exec = op_or;   break;
+        case 37: d->exec = op_and;  break;
+        case 38: d->exec = op_ecall; break;
+        case 39: d->exec = op_halt;  break;
+        case 40: d->exec = op_reti;  break;
+        case 41: d->exec = op_wfi;   break;
+        case 42: d->exec = op_csrrw;  d->imm = IR >> 20; break; // imm = numero du CSR
+        case 43: d->exec = op_csrrs;  d->imm = IR >> 20; break;
+        case 44: d->exec = op_csrrc;  d->imm = IR >> 20; break;
+        case 45: d->exec = op_csrrwi; d->imm = IR >> 20; break;
+        case 46: d->exec = op_csrrsi; d->imm = IR >> 20; break;
+        case 47: d->exec = op_csrrci; d->imm = IR >> 20; break;
+        case 48: d->exec = op_hle;    d->imm = IR >> 20; break; // imm = routine
+        case 56: d->exec = op_mul;    break;
+        case 57: d->exec = op_mulh;   break;
+        case 58: d->exec = op_mulhsu; break;
+        case 59: d->exec = op_mulhu;  break;
+        case 60: d->exec = op_div;    break;
+        case 61: d->exec = op_divu;   break;
+        case 62: d->exec = op_rem;    break;
+        case 63: d->exec = op_remu;   break;
+        default: d->exec = op_halt;   break;
+    }
+}
+
+/**
+ * Appele par la plateforme quand une ecriture touche une page de code :
+ * invalide les entrees des mots recouverts par [addr, addr + size[.
+ */
+static void minirisc_icache_invalidate(void *opaque, uint32_t addr, uint32_t size) {
+    minirisc_t *mr = (minirisc_t*) opaque;
+    uint32_t first = addr >> 2;
+    uint32_t last = (addr + size - 1) >> 2;
+
+    for (uint32_t w = first; w <= last; w++) {
+        minirisc_insn_t *page = mr->icache[w / ICACHE_PAGE_INSNS];
+        if (page != NULL) {
+            if (page[w % ICACHE_PAGE_INSNS].exec != NULL) {
+                mr->block_flush = 1; // Du code traduit a peut-etre ete modifie
+            }
+            page[w % ICACHE_PAGE_INSNS].exec = NULL;
+            page[w % ICACHE_PAGE_INSNS].label = NULL;
+        }
+    }
+}
+
+/**
+ * Renvoie l'instruction predecodee situee a PC, en la decodant si besoin.
+ * Renvoie NULL si PC n'est pas un mot aligne en RAM.
+ */
+static inline minirisc_insn_t* minirisc_icache_lookup(minirisc_t *mr, uint32_t PC) {
+    if ((PC & 0x3) != 0) {
+        return NULL;
+    }
+
+    minirisc_insn_t *page = mr->icache[PC >> PLATFORM_PAGE_SHIFT];
+    if (page == NULL) {
+        if (platform_host_ptr(mr->platform, PC & ~(PLATFORM_PAGE_SIZE - 1), PLATFORM_PAGE_SIZE) == NULL) {
+            return NULL; // Pas de RAM a cette adresse
+        }
+        // Une entree de plus en fin de page, jamais decodee : le moteur threade
+        // y arrive en deroulant sequentiellement et repasse alors par ici.
+        page = (minirisc_insn_t*) calloc(ICACHE_PAGE_INSNS + 1, sizeof(minirisc_insn_t));
+        mr->icache[PC >> PLATFORM_PAGE_SHIFT] = page;
+        if (mr->n_icache_pages == mr->icache_capacity) {
+            mr->icache_capacity = mr->icache_capacity ? 2 * mr->icache_capacity : 16;
+            mr->icache_pages = (uint32_t*) realloc(mr->icache_pages, mr->icache_capacity * sizeof(uint32_t));
+        }
+        mr->icache_pages[mr->n_icache_pages++] = PC >> PLATFORM_PAGE_SHIFT;
+        platform_set_code_page(mr->platform, PC >> PLATFORM_PAGE_SHIFT);
+    }
+
+    minirisc_insn_t *insn = &page[(PC & (PLATFORM_PAGE_SIZE - 1)) >> 2];
+    if (insn->exec == NULL) {
+        minirisc_predecode(*(const uint32_t*) platform_host_ptr(mr->platform, PC, 4), PC, insn);
+    }
+    return insn;
+}
+
+static void minirisc_run_switch(minirisc_t* mr) {
     while (mr->halt == 0) {
+        if (mr->counters.instret >= mr->deadline) {
+            minirisc_service(mr);
+            continue;
+        }
         minirisc_fetch(mr);
 
         if (mr->halt)
@@ -478,430 +1232,862 @@ void minirisc_run(minirisc_t* mr) {
     }
 }
 
-void minirisc_test() {
-    platform_t* platformTest;
-    minirisc_t* miniriscTest;
-
-    platformTest = platform_new();
-    miniriscTest = minirisc_new(0x80000000, platformTest);
-
-    // Test écriture sur le registre x0
-    printf("=== Test x0 ===\n");
-    minirisc_set_reg(miniriscTest, 0, 0xDEADBEEF);
-    
-    if (miniriscTest->regs[0] == 0) {
-        printf("SUCCES : x0 est bien reste a 0.\n");
-    } else {
-        printf("ECHEC : x0 a ete modifie (valeur : %x)\n", miniriscTest->regs[0]);
-    }
-
-    // Test de LUI
-    printf("=== Test pour LUI ===\n");
-    platform_load_program(platformTest, "/home/wizhack/Document/ensta/architectureordinateurs/embedded_software/lui_test/build/esw.bin");
-    minirisc_run(miniriscTest);
-    printf("Valeur dans le registre 1 en hexadecimal: %x\n",miniriscTest->regs[1]);
-    printf("Cela correspond a une valeur immédiate de %u pour lui.\n",(int) miniriscTest->regs[1] >> 12);
-
-    // Test de AUIPC
-    miniriscTest->halt = 0;
-    miniriscTest->PC = 0x80000000;
-    printf("=== Test pour AUIPC ===\n");
-    platform_load_program(platformTest, "/home/wizhack/Document/ensta/architectureordinateurs/embedded_software/auipc_test/build/esw.bin");
-    minirisc_run(miniriscTest);
-    printf("Valeur dans le registre 1 en hexadecimal: %x\n",miniriscTest->regs[1]);
-    printf("Cela correspond a une valeur immédiate de %u pour auipc.\n",(int) ((miniriscTest->regs[1] - 0x80000000) >> 12));
-
-    // Test de JAL
-    miniriscTest->halt = 0;
-    miniriscTest->PC = 0x80000000;
-    platform_load_program(platformTest, "/home/wizhack/Document/ensta/architectureordinateurs/embedded_software/jal_test/build/esw.bin");
-    minirisc_run(miniriscTest);
-    printf("=== Test pour JAL ===\n");
-    printf("Valeur dans le registre 1 en hexadecimal: %x\n",miniriscTest->regs[1]);
-    printf("Valeur dans le registre 2 en hexadecimal: %x\n",miniriscTest->regs[2]);
-    printf("Valeur dans le registre 3 en hexadecimal: %x\n",miniriscTest->regs[3]);
-
-    // Test de JALR
-    miniriscTest->halt = 0;
-    miniriscTest->PC = 0x80000000;
-    platform_load_program(platformTest, "/home/wizhack/Document/ensta/architectureordinateurs/embedded_software/jalr_test/build/esw.bin");
-    minirisc_run(miniriscTest);
-    printf("=== Test pour JALR ===\n");
-    printf("Valeur dans le registre 1 en hexadecimal: %x\n",miniriscTest->regs[1]);
-    printf("Valeur dans le registre 2 en hexadecimal: %x\n",miniriscTest->regs[2]);
-    printf("Le nextPC a la fin de l'éxécution est: %x\n",miniriscTest->next_PC);
-
-    // Test de BEQ
-    miniriscTest->halt = 0;
-    miniriscTest->PC = 0x80000000;
-    platform_load_program(platformTest, "/home/wizhack/Document/ensta/architectureordinateurs/embedded_software/beq_test/build/esw.bin");
-    minirisc_run(miniriscTest);
-    printf("=== Test pour BEQ ===\n");
-    printf("Valeur dans le registre 1 en hexadecimal: %x\n",miniriscTest->regs[1]);
-    printf("Valeur dans le registre 2 en hexadecimal: %x\n",miniriscTest->regs[2]);
-
-    // Test de BNE
-    miniriscTest->halt = 0;
-    miniriscTest->PC = 0x80000000;
-    platform_load_program(platformTest, "/home/wizhack/Document/ensta/architectureordinateurs/embedded_software/bne_test/build/esw.bin");
-    minirisc_run(miniriscTest);
-    printf("=== Test pour BNE ===\n");
-    printf("Valeur dans le registre 1 en hexadecimal: %x\n",miniriscTest->regs[1]);
-    printf("Valeur dans le registre 2 en hexadecimal: %x\n",miniriscTest->regs[2]);
-
-    // Test de BLT
-    miniriscTest->halt = 0;
-    miniriscTest->PC = 0x80000000;
-    platform_load_program(platformTest, "/home/wizhack/Document/ensta/architectureordinateurs/embedded_software/blt_test/build/esw.bin");
-    minirisc_run(miniriscTest);
-    printf("=== Test pour BLT ===\n");
-    printf("Valeur dans le registre 1 en hexadecimal: %x\n",miniriscTest->regs[1]);
-    printf("Valeur dans le registre 2 en hexadecimal: %x\n",miniriscTest->regs[2]);
-
-    // Test de BGE
-    miniriscTest->halt = 0;
-    miniriscTest->PC = 0x80000000;
-    platform_load_program(platformTest, "/home/wizhack/Document/ensta/architectureordinateurs/embedded_software/bge_test/build/esw.bin");
-    minirisc_run(miniriscTest);
-    printf("=== Test pour BGE ===\n");
-    printf("Valeur dans le registre 1 en hexadecimal: %x\n",miniriscTest->regs[1]);
-    printf("Valeur dans le registre 2 en hexadecimal: %x\n",miniriscTest->regs[2]);
-
-    // Test de BLTU
-    miniriscTest->halt = 0;
-    miniriscTest->PC = 0x80000000;
-    platform_load_program(platformTest, "/home/wizhack/Document/ensta/architectureordinateurs/embedded_software/bltu_test/build/esw.bin");
-    minirisc_run(miniriscTest);
-    printf("=== Test pour BLTU ===\n");
-    printf("Valeur dans le registre 3 en hexadecimal: %x\n",miniriscTest->regs[3]);
-
-    // Test de BGEU
-    miniriscTest->halt = 0;
-    miniriscTest->PC = 0x80000000;
-    platform_load_program(platformTest, "/home/wizhack/Document/ensta/architectureordinateurs/embedded_software/bltu_test/build/esw.bin");
-    minirisc_run(miniriscTest);
-    printf("=== Test pour BGEU ===\n");
-    printf("Valeur dans le registre 3 en hexadecimal: %x\n",miniriscTest->regs[3]);
-
-    // Test de LB
-    miniriscTest->halt = 0;
-    miniriscTest->PC = 0x80000000;
-    platform_load_program(platformTest, "/home/wizhack/Document/ensta/architectureordinateurs/embedded_software/lb_test/build/esw.bin");
-    minirisc_run(miniriscTest);
-    printf("=== Test pour LB ===\n");
-    printf("Valeur dans le registre 3 en hexadecimal: %x\n",miniriscTest->regs[3]);
-    printf("Valeur dans le registre 4 en hexadecimal: %x\n",miniriscTest->regs[4]);
-
-    // Test de LH
-    miniriscTest->halt = 0;
-    miniriscTest->PC = 0x80000000;
-    platform_load_program(platformTest, "/home/wizhack/Document/ensta/architectureordinateurs/embedded_software/lh_test/build/esw.bin");
-    minirisc_run(miniriscTest);
-    printf("=== Test pour LH ===\n");
-    printf("Valeur dans le registre 3 en hexadecimal: %x\n",miniriscTest->regs[3]);
-    printf("Valeur dans le registre 4 en hexadecimal: %x\n",miniriscTest->regs[4]);
-
-    // Test de LW
-    miniriscTest->halt = 0;
-    miniriscTest->PC = 0x80000000;
-    platform_load_program(platformTest, "/home/wizhack/Document/ensta/architectureordinateurs/embedded_software/lw_test/build/esw.bin");
-    minirisc_run(miniriscTest);
-    printf("=== Test pour LW ===\n");
-    printf("Valeur dans le registre 3 en hexadecimal: %x\n",miniriscTest->regs[3]);
-
-    // Test de LBU
-    miniriscTest->halt = 0;
-    miniriscTest->PC = 0x80000000;
-    platform_load_program(platformTest, "/home/wizhack/Document/ensta/architectureordinateurs/embedded_software/lbu_test/build/esw.bin");
-    minirisc_run(miniriscTest);
-    printf("=== Test pour LBU ===\n");
-    printf("Valeur dans le registre 3 en hexadecimal: %x\n",miniriscTest->regs[3]);
-
-    // Test de LHU
-    miniriscTest->halt = 0;
-    miniriscTest->PC = 0x80000000;
-    platform_load_program(platformTest, "/home/wizhack/Document/ensta/architectureordinateurs/embedded_software/lhu_test/build/esw.bin");
-    minirisc_run(miniriscTest);
-    printf("=== Test pour LHU ===\n");
-    printf("Valeur dans le registre 3 en hexadecimal: %x\n",miniriscTest->regs[3]);
-
-    // Test de SB
-    miniriscTest->halt = 0;
-    miniriscTest->PC = 0x80000000;
-    platform_load_program(platformTest, "/home/wizhack/Document/ensta/architectureordinateurs/embedded_software/sb_test/build/esw.bin");
-    minirisc_run(miniriscTest);
-    printf("=== Test pour SB ===\n");
-    printf("Valeur dans le registre 4 en hexadecimal: %x\n",miniriscTest->regs[4]);
-
-    // Test de SH
-    miniriscTest->halt = 0;
-    miniriscTest->PC = 0x80000000;
-    platform_load_program(platformTest, "/home/wizhack/Document/ensta/architectureordinateurs/embedded_software/sh_test/build/esw.bin");
-    minirisc_run(miniriscTest);
-    printf("=== Test pour SH ===\n");
-    printf("Valeur dans le registre 4 en hexadecimal: %x\n",miniriscTest->regs[4]);
-
-    // Test de SW
-    miniriscTest->halt = 0;
-    miniriscTest->PC = 0x80000000;
-    platform_load_program(platformTest, "/home/wizhack/Document/ensta/architectureordinateurs/embedded_software/sw_test/build/esw.bin");
-    minirisc_run(miniriscTest);
-    printf("=== Test pour SW ===\n");
-    printf("Valeur dans le registre 3 en hexadecimal: %x\n",miniriscTest->regs[3]);
-
-    // Test de ADDI
-    miniriscTest->halt = 0;
-    miniriscTest->PC = 0x80000000;
-    platform_load_program(platformTest, "/home/wizhack/Document/ensta/architectureordinateurs/embedded_software/addi_test/build/esw.bin");
-    minirisc_run(miniriscTest);
-    printf("=== Test pour ADDI ===\n");
-    printf("Valeur dans le registre 1 en hexadecimal: %x\n",miniriscTest->regs[1]);
-    printf("Valeur dans le registre 2 en hexadecimal: %x\n",miniriscTest->regs[2]);
-    printf("Valeur dans le registre 3 en hexadecimal: %x\n",miniriscTest->regs[3]);
-
-    // Test de SLTI
-    miniriscTest->halt = 0;
-    miniriscTest->PC = 0x80000000;
-    platform_load_program(platformTest, "/home/wizhack/Document/ensta/architectureordinateurs/embedded_software/slti_test/build/esw.bin");
-    minirisc_run(miniriscTest);
-    printf("=== Test pour SLTI ===\n");
-    printf("Valeur dans le registre 2 en hexadecimal: %x\n",miniriscTest->regs[2]);
-    printf("Valeur dans le registre 3 en hexadecimal: %x\n",miniriscTest->regs[3]);
-    printf("Valeur dans le registre 5 en hexadecimal: %x\n",miniriscTest->regs[5]);
-
-    // Test de SLTIU
-    miniriscTest->halt = 0;
-    miniriscTest->PC = 0x80000000;
-    platform_load_program(platformTest, "/home/wizhack/Document/ensta/architectureordinateurs/embedded_software/sltiu_test/build/esw.bin");
-    minirisc_run(miniriscTest);
-    printf("=== Test pour SLTIU ===\n");
-    printf("Valeur dans le registre 3 en hexadecimal: %x\n",miniriscTest->regs[3]);
-    printf("Valeur dans le registre 4 en hexadecimal: %x\n",miniriscTest->regs[4]);
-    printf("Valeur dans le registre 5 en hexadecimal: %x\n",miniriscTest->regs[5]);
-
-    // Test de XORI
-    miniriscTest->halt = 0;
-    miniriscTest->PC = 0x80000000;
-    platform_load_program(platformTest, "/home/wizhack/Document/ensta/architectureordinateurs/embedded_software/xori_test/build/esw.bin");
-    minirisc_run(miniriscTest);
-    printf("=== Test pour XORI ===\n");
-    printf("Valeur dans le registre 2 en hexadecimal: %x\n",miniriscTest->regs[2]);
-    printf("Valeur dans le registre 4 en hexadecimal: %x\n",miniriscTest->regs[4]);
-
-    // Test de ORI
-    miniriscTest->halt = 0;
-    miniriscTest->PC = 0x80000000;
-    platform_load_program(platformTest, "/home/wizhack/Document/ensta/architectureordinateurs/embedded_software/ori_test/build/esw.bin");
-    minirisc_run(miniriscTest);
-    printf("=== Test pour ORI ===\n");
-    printf("Valeur dans le registre 2 en hexadecimal: %x\n",miniriscTest->regs[2]);
-    printf("Valeur dans le registre 3 en hexadecimal: %x\n",miniriscTest->regs[3]);
-
-    // Test de ANDI
-    miniriscTest->halt = 0;
-    miniriscTest->PC = 0x80000000;
-    platform_load_program(platformTest, "/home/wizhack/Document/ensta/architectureordinateurs/embedded_software/andi_test/build/esw.bin");
-    minirisc_run(miniriscTest);
-    printf("=== Test pour ANDI ===\n");
-    printf("Valeur dans le registre 2 en hexadecimal: %x\n",miniriscTest->regs[2]);
-    printf("Valeur dans le registre 4 en hexadecimal: %x\n",miniriscTest->regs[4]);
-
-    // Test de SLLI
-    miniriscTest->halt = 0;
-    miniriscTest->PC = 0x80000000;
-    platform_load_program(platformTest, "/home/wizhack/Document/ensta/architectureordinateurs/embedded_software/slli_test/build/esw.bin");
-    minirisc_run(miniriscTest);
-    printf("=== Test pour SLLI ===\n");
-    printf("Valeur dans le registre 2 en hexadecimal: %x\n",miniriscTest->regs[2]);
-    printf("Valeur dans le registre 4 en hexadecimal: %x\n",miniriscTest->regs[4]);
-
-    // Test de SRLI
-    miniriscTest->halt = 0;
-    miniriscTest->PC = 0x80000000;
-    platform_load_program(platformTest, "/home/wizhack/Document/ensta/architectureordinateurs/embedded_software/srli_test/build/esw.bin");
-    minirisc_run(miniriscTest);
-    printf("=== Test pour SRLI ===\n");
-    printf("Valeur dans le registre 2 en hexadecimal: %x\n",miniriscTest->regs[2]);
-
-    // Test de SRAI
-    miniriscTest->halt = 0;
-    miniriscTest->PC = 0x80000000;
-    platform_load_program(platformTest, "/home/wizhack/Document/ensta/architectureordinateurs/embedded_software/srai_test/build/esw.bin");
-    minirisc_run(miniriscTest);
-    printf("=== Test pour SRAI ===\n");
-    printf("Valeur dans le registre 2 en hexadecimal: %x\n",miniriscTest->regs[2]);
-    printf("Valeur dans le registre 4 en hexadecimal: %x\n",miniriscTest->regs[4]);
-
-    // Test de ADD
-    miniriscTest->halt = 0;
-    miniriscTest->PC = 0x80000000;
-    platform_load_program(platformTest, "/home/wizhack/Document/ensta/architectureordinateurs/embedded_software/add_test/build/esw.bin");
-    minirisc_run(miniriscTest);
-    printf("=== Test pour ADD ===\n");
-    printf("Valeur dans le registre 3 en hexadecimal: %x\n",miniriscTest->regs[3]);
-    printf("Valeur dans le registre 4 en hexadecimal: %x\n",miniriscTest->regs[4]);
-
-    // Test de SUB
-    miniriscTest->halt = 0;
-    miniriscTest->PC = 0x80000000;
-    platform_load_program(platformTest, "/home/wizhack/Document/ensta/architectureordinateurs/embedded_software/sub_test/build/esw.bin");
-    minirisc_run(miniriscTest);
-    printf("=== Test pour SUB ===\n");
-    printf("Valeur dans le registre 3 en hexadecimal: %x\n",miniriscTest->regs[3]);
-    printf("Valeur dans le registre 4 en hexadecimal: %x\n",miniriscTest->regs[4]);
-
-    // Test de SLL
-    miniriscTest->halt = 0;
-    miniriscTest->PC = 0x80000000;
-    platform_load_program(platformTest, "/home/wizhack/Document/ensta/architectureordinateurs/embedded_software/sll_test/build/esw.bin");
-    minirisc_run(miniriscTest);
-    printf("=== Test pour SLL ===\n");
-    printf("Valeur dans le registre 3 en hexadecimal: %x\n",miniriscTest->regs[3]);
-    printf("Valeur dans le registre 5 en hexadecimal: %x\n",miniriscTest->regs[5]);
-
-    // Test de SRL
-    miniriscTest->halt = 0;
-    miniriscTest->PC = 0x80000000;
-    platform_load_program(platformTest, "/home/wizhack/Document/ensta/architectureordinateurs/embedded_software/srl_test/build/esw.bin");
-    minirisc_run(miniriscTest);
-    printf("=== Test pour SRL ===\n");
-    printf("Valeur dans le registre 3 en hexadecimal: %x\n",miniriscTest->regs[3]);
-    printf("Valeur dans le registre 5 en hexadecimal: %x\n",miniriscTest->regs[5]);
-
-    // Test de SRA
-    miniriscTest->halt = 0;
-    miniriscTest->PC = 0x80000000;
-    platform_load_program(platformTest, "/home/wizhack/Document/ensta/architectureordinateurs/embedded_software/sra_test/build/esw.bin");
-    minirisc_run(miniriscTest);
-    printf("=== Test pour SRA ===\n");
-    printf("Valeur dans le registre 3 en hexadecimal: %x\n",miniriscTest->regs[3]);
-    printf("Valeur dans le registre 5 en hexadecimal: %x\n",miniriscTest->regs[5]);
-
-    // Test de SLT
-    miniriscTest->halt = 0;
-    miniriscTest->PC = 0x80000000;
-    platform_load_program(platformTest, "/home/wizhack/Document/ensta/architectureordinateurs/embedded_software/slt_test/build/esw.bin");
-    minirisc_run(miniriscTest);
-    printf("=== Test pour SLT ===\n");
-    printf("Valeur dans le registre 4 en hexadecimal: %x\n",miniriscTest->regs[4]);
-    printf("Valeur dans le registre 5 en hexadecimal: %x\n",miniriscTest->regs[5]);
-    printf("Valeur dans le registre 6 en hexadecimal: %x\n",miniriscTest->regs[6]);
-
-    // Test de SLTU
-    miniriscTest->halt = 0;
-    miniriscTest->PC = 0x80000000;
-    platform_load_program(platformTest, "/home/wizhack/Document/ensta/architectureordinateurs/embedded_software/sltu_test/build/esw.bin");
-    minirisc_run(miniriscTest);
-    printf("=== Test pour SLTU ===\n");
-    printf("Valeur dans le registre 3 en hexadecimal: %x\n",miniriscTest->regs[3]);
-    printf("Valeur dans le registre 4 en hexadecimal: %x\n",miniriscTest->regs[4]);
-
-    // Test de XOR
-    miniriscTest->halt = 0;
-    miniriscTest->PC = 0x80000000;
-    platform_load_program(platformTest, "/home/wizhack/Document/ensta/architectureordinateurs/embedded_software/xor_test/build/esw.bin");
-    minirisc_run(miniriscTest);
-    printf("=== Test pour XOR ===\n");
-    printf("Valeur dans le registre 3 en hexadecimal: %x\n",miniriscTest->regs[3]);
-    printf("Valeur dans le registre 4 en hexadecimal: %x\n",miniriscTest->regs[4]);
-    printf("Valeur dans le registre 7 en hexadecimal: %x\n",miniriscTest->regs[7]);
-
-    // Test de OR
-    miniriscTest->halt = 0;
-    miniriscTest->PC = 0x80000000;
-    platform_load_program(platformTest, "/home/wizhack/Document/ensta/architectureordinateurs/embedded_software/or_test/build/esw.bin");
-    minirisc_run(miniriscTest);
-    printf("=== Test pour OR ===\n");
-    printf("Valeur dans le registre 3 en hexadecimal: %x\n",miniriscTest->regs[3]);
-    printf("Valeur dans le registre 4 en hexadecimal: %x\n",miniriscTest->regs[4]);
-
-    // Test de AND
-    miniriscTest->halt = 0;
-    miniriscTest->PC = 0x80000000;
-    platform_load_program(platformTest, "/home/wizhack/Document/ensta/architectureordinateurs/embedded_software/and_test/build/esw.bin");
-    minirisc_run(miniriscTest);
-    printf("=== Test pour AND ===\n");
-    printf("Valeur dans le registre 3 en hexadecimal: %x\n",miniriscTest->regs[3]);
-    printf("Valeur dans le registre 6 en hexadecimal: %x\n",miniriscTest->regs[6]);
-    printf("Valeur dans le registre 9 en hexadecimal: %x\n",miniriscTest->regs[9]);
-
-    // ----------------------------------------------------------------------------------
-
-    // Test de MUL
-    miniriscTest->halt = 0;
-    miniriscTest->PC = 0x80000000;
-    platform_load_program(platformTest, "/home/wizhack/Document/ensta/architectureordinateurs/embedded_software/mul_test/build/esw.bin");
-    minirisc_run(miniriscTest);
-    printf("=== Test pour MUL ===\n");
-    printf("Valeur dans le registre 3 en hexadecimal: %x\n",miniriscTest->regs[3]);
-    printf("Valeur dans le registre 5 en hexadecimal: %x\n",miniriscTest->regs[5]);
-
-    // Test de MULH
-    miniriscTest->halt = 0;
-    miniriscTest->PC = 0x80000000;
-    platform_load_program(platformTest, "/home/wizhack/Document/ensta/architectureordinateurs/embedded_software/mulh_test/build/esw.bin");
-    minirisc_run(miniriscTest);
-    printf("=== Test pour MULH ===\n");
-    printf("Valeur dans le registre 2 en hexadecimal: %x\n",miniriscTest->regs[2]);
-    printf("Valeur dans le registre 4 en hexadecimal: %x\n",miniriscTest->regs[4]);
-    printf("Valeur dans le registre 7 en hexadecimal: %x\n",miniriscTest->regs[7]);
-
-    // Test de MULHSU
-    miniriscTest->halt = 0;
-    miniriscTest->PC = 0x80000000;
-    platform_load_program(platformTest, "/home/wizhack/Document/ensta/architectureordinateurs/embedded_software/mulhsu_test/build/esw.bin");
-    minirisc_run(miniriscTest);
-    printf("=== Test pour MULHSU ===\n");
-    printf("Valeur dans le registre 3 en hexadecimal: %x\n",miniriscTest->regs[3]);
-
-    // Test de MULHU
-    miniriscTest->halt = 0;
-    miniriscTest->PC = 0x80000000;
-    platform_load_program(platformTest, "/home/wizhack/Document/ensta/architectureordinateurs/embedded_software/mulhu_test/build/esw.bin");
-    minirisc_run(miniriscTest);
-    printf("=== Test pour MULHU ===\n");
-    printf("Valeur dans le registre 2 en hexadecimal: %x\n",miniriscTest->regs[2]);
-    printf("Valeur dans le registre 3 en hexadecimal: %x\n",miniriscTest->regs[3]);
-
-    // Test de DIV
-    miniriscTest->halt = 0;
-    miniriscTest->PC = 0x80000000;
-    platform_load_program(platformTest, "/home/wizhack/Document/ensta/architectureordinateurs/embedded_software/div_test/build/esw.bin");
-    minirisc_run(miniriscTest);
-    printf("=== Test pour DIV ===\n");
-    printf("Valeur dans le registre 4 en hexadecimal: %x\n",miniriscTest->regs[4]);
-    printf("Valeur dans le registre 5 en hexadecimal: %x\n",miniriscTest->regs[5]);
-    printf("Valeur dans le registre 8 en hexadecimal: %x\n",miniriscTest->regs[8]);
-
-    // Test de DIVU
-    miniriscTest->halt = 0;
-    miniriscTest->PC = 0x80000000;
-    platform_load_program(platformTest, "/home/wizhack/Document/ensta/architectureordinateurs/embedded_software/divu_test/build/esw.bin");
-    minirisc_run(miniriscTest);
-    printf("=== Test pour DIVU ===\n");
-    printf("Valeur dans le registre 4 en hexadecimal: %x\n",miniriscTest->regs[4]);
-    printf("Valeur dans le registre 5 en hexadecimal: %x\n",miniriscTest->regs[5]);
-    printf("Valeur dans le registre 6 en hexadecimal: %x\n",miniriscTest->regs[6]);
-
-    // Test de REM
-    miniriscTest->halt = 0;
-    miniriscTest->PC = 0x80000000;
-    platform_load_program(platformTest, "/home/wizhack/Document/ensta/architectureordinateurs/embedded_software/rem_test/build/esw.bin");
-    minirisc_run(miniriscTest);
-    printf("=== Test pour REM ===\n");
-    printf("Valeur dans le registre 5 en hexadecimal: %x\n",miniriscTest->regs[5]);
-    printf("Valeur dans le registre 6 en hexadecimal: %x\n",miniriscTest->regs[6]);
-    printf("Valeur dans le registre 7 en hexadecimal: %x\n",miniriscTest->regs[7]);
-
-    // Test de REMU
-    miniriscTest->halt = 0;
-    miniriscTest->PC = 0x80000000;
-    platform_load_program(platformTest, "/home/wizhack/Document/ensta/architectureordinateurs/embedded_software/remu_test/build/esw.bin");
-    minirisc_run(miniriscTest);
-    printf("=== Test pour REMU ===\n");
-    printf("Valeur dans le registre 4 en hexadecimal: %x\n",miniriscTest->regs[4]);
-    printf("Valeur dans le registre 5 en hexadecimal: %x\n",miniriscTest->regs[5]);
-
-    minirisc_free(miniriscTest);
-    platform_free(platformTest);
-}
\ No newline at end of file
+static void minirisc_run_predecode(minirisc_t* mr) {
+    while (mr->halt == 0) {
+        if (mr->counters.instret >= mr->deadline) {
+            minirisc_service(mr);
+            continue;
+        }
+        minirisc_insn_t *insn = minirisc_icache_lookup(mr, mr->PC);
+
+        if (insn == NULL) {
+            // Hors RAM ou PC non aligne : chemin de reference
+            minirisc_fetch(mr);
+
+            if (mr->halt)
+            {
+                break;
+            }
+
+            minirisc_decode_and_execute(mr);
+        }
+        else {
+            mr->IR = insn->IR;
+            mr->next_PC = mr->PC + 4;
+            mr->counters.instret++;
+            mr->counters.events[insn->event]++;
+            STATS_COUNT(mr, mr->PC, insn->opcode, 1);
+            insn->exec(mr, insn);
+        }
+        
+        mr->PC = mr->next_PC;
+    }
+}
+
+/**
+ * Registre ecrit par une instruction (0 si aucun) : rd, sauf pour les
+ * branchements, stockages, EBREAK, RETI, WFI et opcodes inconnus. ECALL
+ * et HLE ecrivent a0.
+ */
+static uint32_t minirisc_written_reg(uint32_t opcode, uint32_t rd) {
+    if (opcode == 38 || opcode == 48) {
+        return 10;
+    }
+    if ((opcode >= 1 && opcode <= 4) || (opcode >= 11 && opcode <= 15) || (opcode >= 19 && opcode <= 37)
+        || (opcode >= 42 && opcode <= 47) || (opcode >= 56 && opcode <= 63)) {
+        return rd;
+    }
+    return 0;
+}
+
+/*
+ * Moteur predecode instrumente, pour la trace, le modele de caches, les
+ * predicteurs de branchement et le modele de pipeline. Les
+ * acces memoire se deduisent de l'instruction (rs1 + immediat), le registre
+ * ecrit se lit apres son execution : les handlers ne savent rien des
+ * observateurs.
+ */
+static void minirisc_run_observed(minirisc_t* mr) {
+    static const uint8_t access_size[] = { 1, 2, 4, 1, 2, 1, 2, 4 }; // LB a SW
+    minirisc_insn_t decoded;
+    trace_entry_t entry;
+
+    while (mr->halt == 0) {
+        if (mr->counters.instret >= mr->deadline) {
+            minirisc_service(mr);
+            continue;
+        }
+        minirisc_insn_t *insn = minirisc_icache_lookup(mr, mr->PC);
+
+        if (insn == NULL) {
+            minirisc_fetch(mr);
+            if (mr->halt) {
+                break;
+            }
+            minirisc_predecode(mr->IR, mr->PC, &decoded);
+            insn = &decoded;
+        }
+
+        uint32_t opcode = insn->opcode;
+        entry.PC = mr->PC;
+        entry.flags = 0;
+        if (opcode >= 11 && opcode <= 18) {
+            entry.flags = opcode <= 15 ? TRACE_LOAD : TRACE_STORE;
+            entry.size = access_size[opcode - 11];
+            entry.addr = mr->regs[insn->rs1] + insn->imm;
+            entry.data = mr->regs[insn->rs2] & (entry.size == 4 ? 0xFFFFFFFF : (1u << (8 * entry.size)) - 1);
+        }
+
+        uint32_t PC = mr->PC;
+        uint32_t stalls = 0;
+        // Un branchement pris vers PC + 4 ne change pas next_PC : son issue se
+        // lit dans le compteur d'evenements, incremente par la condition.
+        uint64_t taken = mr->counters.events[MINIRISC_EVENT_BRANCH];
+        if (mr->caches != NULL) {
+            stalls = cache_fetch(mr->caches, PC);
+            if (entry.flags != 0) {
+                stalls += cache_data(mr->caches, PC, entry.addr, entry.flags == TRACE_STORE);
+            }
+        }
+
+        if (insn == &decoded) {
+            minirisc_decode_and_execute(mr);
+        }
+        else {
+            mr->IR = insn->IR;
+            mr->next_PC = mr->PC + 4;
+            mr->counters.instret++;
+            mr->counters.events[insn->event]++;
+            STATS_COUNT(mr, mr->PC, opcode, 1);
+            insn->exec(mr, insn);
+        }
+
+        if (mr->pipeline != NULL) {
+            stalls = pipeline_step(mr->pipeline, insn, PC, mr->next_PC, stalls);
+            mr->counters.stalls += stalls;
+        }
+        if (mr->bpred != NULL) {
+            if (opcode >= 5 && opcode <= 10) {
+                bpred_branch(mr->bpred, mr->PC, mr->counters.events[MINIRISC_EVENT_BRANCH] != taken);
+            }
+            else if (opcode == 3 || opcode == 4) {
+                // Appel : rd = ra ; retour : JALR x0, 0(ra)
+                bpred_jump(mr->bpred, mr->PC, mr->next_PC, insn->rd == 1, opcode == 4 && insn->rd == 0 && insn->rs1 == 1);
+            }
+        }
+        if (mr->trace != NULL) {
+            uint32_t rd = minirisc_written_reg(opcode, insn->rd);
+            if (rd != 0) {
+                entry.flags |= TRACE_REG;
+                entry.rd = rd;
+                entry.value = mr->regs[rd];
+            }
+            trace_write(mr->trace, &entry);
+        }
+
+        mr->PC = mr->next_PC;
+    }
+}
+
+/*
+ * Opcodes ayant un label dans les moteurs a base de computed goto
+ * (tous sauf EBREAK, traite comme un opcode inconnu : arret).
+ */
+#define MINIRISC_OPCODES(X) \
+    X(1, lui)     X(2, auipc)   X(3, jal)     X(4, jalr)    \
+    X(5, beq)     X(6, bne)     X(7, blt)     X(8, bge)     \
+    X(9, bltu)    X(10, bgeu)   X(11, lb)     X(12, lh)     \
+    X(13, lw)     X(14, lbu)    X(15, lhu)    X(16, sb)     \
+    X(17, sh)     X(18, sw)     X(19, addi)   X(20, slti)   \
+    X(21, sltiu)  X(22, xori)   X(23, ori)    X(24, andi)   \
+    X(25, slli)   X(26, srli)   X(27, srai)   X(28, add)    \
+    X(29, sub)    X(30, sll)    X(31, srl)    X(32, sra)    \
+    X(33, slt)    X(34, sltu)   X(35, xor)    X(36, or)     \
+    X(37, and)    X(38, ecall)  X(40, reti)   X(41, wfi)    \
+    X(42, csrrw)  X(43, csrrs)  X(44, csrrc)  X(45, csrrwi) \
+    X(46, csrrsi) X(47, csrrci) X(48, hle)    X(56, mul)    \
+    X(57, mulh)   X(58, mulhsu) X(59, mulhu)  X(60, div)    \
+    X(61, divu)   X(62, rem)    X(63, remu)
+
+const char* minirisc_opcode_name(uint32_t opcode) {
+    switch (opcode) {
+#define X(num, name) case num: return #name;
+        MINIRISC_OPCODES(X)
+#undef X
+        case 39: return "ebreak";
+        default: return "?";
+    }
+}
+
+#ifdef __GNUC__
+/*
+ * Moteur direct-threade : chaque entree du cache contient l'adresse du label
+ * qui l'execute, et chaque handler se termine par son propre saut indirect
+ * vers l'instruction suivante au lieu de revenir dans une boucle commune.
+ * Le deroulement sequentiel passe simplement a l'entree suivante du tableau
+ * de la page ; la sentinelle de fin de page et les entrees invalidees ont un
+ * label NULL et renvoient vers la recherche complete.
+ *
+ * Seules les instructions pouvant arreter le processeur (acces memoire
+ * fautifs, EBREAK, opcode inconnu) testent halt. Les echeances des
+ * peripheriques et les interruptions sont examinees a la recherche
+ * complete : apres un saut pris, en fin de page et apres WFI.
+ */
+static void minirisc_run_threaded(minirisc_t* mr) {
+    static const void *labels[128];
+    static int labels_ready;
+    minirisc_insn_t *insn;
+
+    // Plusieurs processeurs peuvent demarrer en parallele : la table n'est
+    // publiee qu'une fois complete.
+    if (!__atomic_load_n(&labels_ready, __ATOMIC_ACQUIRE)) {
+        for (int i = 0; i < 128; i++) {
+            labels[i] = &&lbl_illegal; // Opcodes inconnus et EBREAK : arret
+        }
+#define X(num, name) labels[num] = &&lbl_##name;
+        MINIRISC_OPCODES(X)
+#undef X
+        __atomic_store_n(&labels_ready, 1, __ATOMIC_RELEASE);
+    }
+
+// Compte l'instruction insn, sur le point d'etre executee.
+#define COUNT()                                 \
+    do {                                        \
+        mr->counters.instret++;                 \
+        mr->counters.events[insn->event]++;     \
+        STATS_COUNT(mr, mr->PC, insn->opcode, 1); \
+    } while (0)
+
+// Passe a l'instruction suivante en sequence.
+#define NEXT()                                  \
+    do {                                        \
+        mr->PC += 4;                            \
+        insn++;                                 \
+        if (insn->label == NULL) goto lookup;   \
+        mr->IR = insn->IR;                      \
+        COUNT();                                \
+        goto *insn->label;                      \
+    } while (0)
+
+// Execute un handler pouvant modifier next_PC, puis va a next_PC.
+#define JUMP(handler)                           \
+    do {                                        \
+        mr->next_PC = mr->PC + 4;               \
+        handler(mr, insn);                      \
+        if (mr->next_PC == mr->PC + 4) NEXT();  \
+        mr->PC = mr->next_PC;                   \
+        goto lookup;                            \
+    } while (0)
+
+// Execute un handler pouvant arreter le processeur.
+#define CHECKED(handler)                        \
+    do {                                        \
+        handler(mr, insn);                      \
+        if (mr->halt) goto lbl_stop;                \
+        NEXT();                                 \
+    } while (0)
+
+lookup:
+    if (mr->counters.instret >= mr->deadline) {
+        minirisc_service(mr);
+    }
+    if (mr->halt) {
+        return;
+    }
+    insn = minirisc_icache_lookup(mr, mr->PC);
+    if (insn == NULL) {
+        // Hors RAM ou PC non aligne : chemin de reference
+        minirisc_fetch(mr);
+        if (mr->halt) {
+            return;
+        }
+        minirisc_decode_and_execute(mr);
+        mr->PC = mr->next_PC;
+        goto lookup;
+    }
+    insn->label = labels[insn->opcode];
+    mr->IR = insn->IR;
+    COUNT();
+    goto *insn->label;
+
+lbl_lui:    op_lui(mr, insn);    NEXT();
+lbl_auipc:  op_auipc(mr, insn);  NEXT();
+lbl_jal:    JUMP(op_jal);
+lbl_jalr:   JUMP(op_jalr);
+lbl_beq:    JUMP(op_beq);
+lbl_bne:    JUMP(op_bne);
+lbl_blt:    JUMP(op_blt);
+lbl_bge:    JUMP(op_bge);
+lbl_bltu:   JUMP(op_bltu);
+lbl_bgeu:   JUMP(op_bgeu);
+lbl_lb:     op_lb(mr, insn);     NEXT();
+lbl_lh:     CHECKED(op_lh);
+lbl_lw:     CHECKED(op_lw);
+lbl_lbu:    op_lbu(mr, insn);    NEXT();
+lbl_lhu:    CHECKED(op_lhu);
+lbl_sb:     op_sb(mr, insn);     NEXT();
+lbl_sh:     CHECKED(op_sh);
+lbl_sw:     CHECKED(op_sw);
+lbl_addi:   op_addi(mr, insn);   NEXT();
+lbl_slti:   op_slti(mr, insn);   NEXT();
+lbl_sltiu:  op_sltiu(mr, insn);  NEXT();
+lbl_xori:   op_xori(mr, insn);   NEXT();
+lbl_ori:    op_ori(mr, insn);    NEXT();
+lbl_andi:   op_andi(mr, insn);   NEXT();
+lbl_slli:   op_slli(mr, insn);   NEXT();
+lbl_srli:   op_srli(mr, insn);   NEXT();
+lbl_srai:   op_srai(mr, insn);   NEXT();
+lbl_add:    op_add(mr, insn);    NEXT();
+lbl_sub:    op_sub(mr, insn);    NEXT();
+lbl_sll:    op_sll(mr, insn);    NEXT();
+lbl_srl:    op_srl(mr, insn);    NEXT();
+lbl_sra:    op_sra(mr, insn);    NEXT();
+lbl_slt:    op_slt(mr, insn);    NEXT();
+lbl_sltu:   op_sltu(mr, insn);   NEXT();
+lbl_xor:    op_xor(mr, insn);    NEXT();
+lbl_or:     op_or(mr, insn);     NEXT();
+lbl_and:    op_and(mr, insn);    NEXT();
+lbl_ecall:  op_ecall(mr, insn);  NEXT();
+lbl_reti:   JUMP(op_reti);
+lbl_wfi:
+    op_wfi(mr, insn);
+    mr->PC += 4;
+    goto lookup;
+lbl_csrrw:  op_csrrw(mr, insn);  NEXT();
+lbl_csrrs:  op_csrrs(mr, insn);  NEXT();
+lbl_csrrc:  op_csrrc(mr, insn);  NEXT();
+lbl_csrrwi: op_csrrwi(mr, insn); NEXT();
+lbl_csrrsi: op_csrrsi(mr, insn); NEXT();
+lbl_csrrci: op_csrrci(mr, insn); NEXT();
+lbl_hle:
+    mr->next_PC = mr->PC + 4;
+    op_hle(mr, insn);
+    if (mr->halt) goto lbl_stop;
+    mr->PC = mr->next_PC;
+    goto lookup;
+lbl_mul:    op_mul(mr, insn);    NEXT();
+lbl_mulh:   op_mulh(mr, insn);   NEXT();
+lbl_mulhsu: op_mulhsu(mr, insn); NEXT();
+lbl_mulhu:  op_mulhu(mr, insn);  NEXT();
+lbl_div:    op_div(mr, insn);    NEXT();
+lbl_divu:   op_divu(mr, insn);   NEXT();
+lbl_rem:    op_rem(mr, insn);    NEXT();
+lbl_remu:   op_remu(mr, insn);   NEXT();
+lbl_illegal:
+    mr->halt = 1;
+lbl_stop:
+    // Comme la boucle de reference, le PC avance meme sur une instruction qui arrete.
+    mr->PC += 4;
+
+#undef COUNT
+#undef NEXT
+#undef JUMP
+#undef CHECKED
+}
+
+#endif
+
+/*
+ * Cache de blocs de base.
+ *
+ * Un bloc est traduit une fois a partir du cache d'instructions predecodees
+ * puis range dans une table de hachage indexee par son PC de depart. Ses
+ * successeurs statiques (instruction suivante, cible d'un branchement pris ou
+ * d'un JAL) sont chaines au premier passage : on enchaine alors les blocs sans
+ * repasser par la table. JALR et RETI ont une cible dynamique et repassent par
+ * la table.
+ *
+ * Une ecriture sur une instruction deja decodee demande la vidange complete
+ * du cache de blocs (block_flush), faite a la prochaine frontiere de bloc : il
+ * n'y a ainsi jamais de lien vers un bloc libere. Les ecritures en memoire
+ * terminent le bloc courant si elles ont touche du code.
+ */
+
+#define BLOCK_OP_END    128 // Pseudo-opcode de fin de bloc sans saut
+
+static int minirisc_ends_block(const minirisc_insn_t *insn) {
+    return (insn->opcode >= 3 && insn->opcode <= 10) // JAL, JALR, branchements
+        || insn->opcode == 40 || insn->opcode == 41  // RETI, WFI
+        || insn->opcode == 48                        // HLE (retour a ra)
+        || insn->exec == op_halt;                    // EBREAK et opcodes inconnus
+}
+
+static void minirisc_block_flush(minirisc_t *mr) {
+    minirisc_sync_counters(mr);
+    for (int i = 0; i < BLOCK_HASH_SIZE; i++) {
+        minirisc_block_t *block = mr->blocks[i];
+        while (block != NULL) {
+            minirisc_block_t *next = block->hash_next;
+            free(block);
+            block = next;
+        }
+        mr->blocks[i] = NULL;
+    }
+    mr->block_list = NULL;
+    if (mr->jit != NULL) {
+        jit_reset(mr->jit); // Le code natif appartenait aux blocs liberes
+    }
+    mr->block_flush = 0;
+}
+
+/**
+ * Traduit le bloc commencant a PC. Le bloc s'arrete sur une instruction de
+ * fin de bloc, en fin de page ou apres BLOCK_MAX_INSNS instructions.
+ * Renvoie NULL si PC n'est pas un mot aligne en RAM.
+ */
+static minirisc_block_t* minirisc_block_translate(minirisc_t *mr, uint32_t PC, const void * const *labels) {
+    minirisc_insn_t insns[BLOCK_MAX_INSNS];
+    uint32_t page_end = (PC | (PLATFORM_PAGE_SIZE - 1)) + 1;
+    uint32_t n = 0;
+    int ended = 0;
+
+    if (minirisc_icache_lookup(mr, PC) == NULL) {
+        return NULL;
+    }
+
+    for (uint32_t pc = PC; n < BLOCK_MAX_INSNS && pc != page_end; pc += 4) {
+        minirisc_insn_t *insn = minirisc_icache_lookup(mr, pc);
+        insns[n] = *insn;
+        insns[n].label = labels[insn->opcode];
+        n++;
+        if (minirisc_ends_block(insn)) {
+            ended = 1;
+            break;
+        }
+    }
+
+    minirisc_block_t *block = (minirisc_block_t*) malloc(sizeof(minirisc_block_t) + (n + 1) * sizeof(minirisc_insn_t));
+    block->PC = PC;
+    block->n_insns = n;
+    block->exec_count = 0;
+    block->execs = 0;
+    memset(block->n_events, 0, sizeof(block->n_events));
+    for (uint32_t i = 0; i < n; i++) {
+        block->n_events[insns[i].event]++;
+    }
+    block->native = NULL;
+    block->link[0] = NULL;
+    block->link[1] = NULL;
+    memcpy(block->insns, insns, n * sizeof(minirisc_insn_t));
+    if (!ended) {
+        memset(&block->insns[n], 0, sizeof(minirisc_insn_t));
+        block->insns[n].label = labels[BLOCK_OP_END];
+    }
+    return block;
+}
+
+static minirisc_block_t* minirisc_block_get(minirisc_t *mr, uint32_t PC, const void * const *labels) {
+    minirisc_block_t **bucket = &mr->blocks[(PC >> 2) & (BLOCK_HASH_SIZE - 1)];
+    minirisc_block_t *block;
+
+    for (block = *bucket; block != NULL; block = block->hash_next) {
+        if (block->PC == PC) {
+            return block;
+        }
+    }
+
+    block = minirisc_block_translate(mr, PC, labels);
+    if (block != NULL) {
+        block->hash_next = *bucket;
+        *bucket = block;
+        block->list_next = mr->block_list;
+        mr->block_list = block;
+    }
+    return block;
+}
+
+void minirisc_sync_counters(minirisc_t *mr) {
+    for (minirisc_block_t *block = mr->block_list; block != NULL; block = block->list_next) {
+        if (block->execs != 0) {
+            for (int e = 0; e < MINIRISC_EVENTS; e++) {
+                mr->counters.events[e] += block->execs * block->n_events[e];
+            }
+#ifdef MINIRISC_STATS
+            for (uint32_t i = 0; i < block->n_insns; i++) {
+                STATS_COUNT(mr, block->PC + 4 * i, block->insns[i].opcode, block->execs);
+            }
+#endif
+            block->execs = 0;
+        }
+    }
+}
+
+/**
+ * Retire des compteurs les instructions du bloc a partir de from : le moteur
+ * a blocs compte le bloc entier en y entrant, ce qu'il corrige quand il en
+ * sort avant la fin ou qu'un CSR est lu en cours de bloc.
+ */
+static void minirisc_block_uncount(minirisc_t *mr, const minirisc_block_t *block, uint32_t from) {
+    for (uint32_t i = from; i < block->n_insns; i++) {
+        mr->counters.instret--;
+        mr->counters.events[block->insns[i].event]--;
+        STATS_COUNT(mr, block->PC + 4 * i, block->insns[i].opcode, (uint64_t) -1);
+    }
+}
+
+static void minirisc_block_recount(minirisc_t *mr, const minirisc_block_t *block, uint32_t from) {
+    for (uint32_t i = from; i < block->n_insns; i++) {
+        mr->counters.instret++;
+        mr->counters.events[block->insns[i].event]++;
+        STATS_COUNT(mr, block->PC + 4 * i, block->insns[i].opcode, 1);
+    }
+}
+
+#ifdef __GNUC__
+/*
+ * Moteur a blocs : les micro-ops d'un bloc s'enchainent par computed goto
+ * sans mettre a jour PC, qui n'est recalcule qu'a la sortie du bloc. L'etat
+ * du processeur (halt, vidange du cache) n'est examine qu'aux frontieres de
+ * bloc et apres les acces memoire qui peuvent arreter le processeur ou
+ * modifier du code.
+ *
+ * Les compteurs de performance ne coutent qu'un increment par bloc (execs),
+ * reporte dans mr->counters par minirisc_sync_counters() ; seules les
+ * sorties anticipees et les instructions CSR corrigent directement les
+ * compteurs. instret est tenu a jour a l'entree de chaque bloc : c'est
+ * l'horloge comparee a deadline pour les peripheriques et les interruptions.
+ */
+static void minirisc_run_block(minirisc_t* mr) {
+    static const void *labels[BLOCK_OP_END + 1];
+    static int labels_ready;
+    minirisc_block_t *block, *next;
+    minirisc_insn_t *insn;
+    int taken;
+
+    if (!__atomic_load_n(&labels_ready, __ATOMIC_ACQUIRE)) {
+        for (int i = 0; i < BLOCK_OP_END; i++) {
+            labels[i] = &&lbl_illegal; // Opcodes inconnus et EBREAK : arret
+        }
+#define X(num, name) labels[num] = &&lbl_##name;
+        MINIRISC_OPCODES(X)
+#undef X
+        labels[BLOCK_OP_END] = &&lbl_end;
+        __atomic_store_n(&labels_ready, 1, __ATOMIC_RELEASE);
+    }
+
+// PC de l'instruction courante
+#define INSN_PC() (block->PC + ((uint32_t) (insn - block->insns) << 2))
+
+#define NEXT()                                  \
+    do {                                        \
+        insn++;                                 \
+        goto *insn->label;                      \
+    } while (0)
+
+// Acces memoire : peut arreter le processeur ou ecrire sur du code traduit.
+#define CHECKED(handler)                        \
+    do {                                        \
+        handler(mr, insn);                      \
+        if (mr->halt || mr->block_flush) {      \
+            mr->PC = INSN_PC() + 4;             \
+            minirisc_block_uncount(mr, block, (uint32_t) (insn - block->insns) + 1); \
+            goto enter;                         \
+        }                                       \
+        NEXT();                                 \
+    } while (0)
+
+// Instruction CSR : comme dans les autres moteurs, les compteurs lus comprennent
+// l'instruction elle-meme mais pas la suite du bloc.
+#define CSR(handler)                            \
+    do {                                        \
+        minirisc_block_uncount(mr, block, (uint32_t) (insn - block->insns) + 1); \
+        handler(mr, insn);                      \
+        minirisc_block_recount(mr, block, (uint32_t) (insn - block->insns) + 1); \
+        NEXT();                                 \
+    } while (0)
+
+// Branchement conditionnel : successeur chaine selon la direction prise.
+#define BRANCH(handler)                         \
+    do {                                        \
+        mr->PC = INSN_PC();                     \
+        mr->next_PC = mr->PC + 4;               \
+        handler(mr, insn);                      \
+        taken = mr->next_PC != mr->PC + 4;      \
+        goto chain;                             \
+    } while (0)
+
+// Saut a cible dynamique : pas de chainage.
+#define INDIRECT(handler)                       \
+    do {                                        \
+        mr->PC = INSN_PC();                     \
+        handler(mr, insn);                      \
+        mr->PC = mr->next_PC;                   \
+        goto enter;                             \
+    } while (0)
+
+enter:
+    if (mr->counters.instret >= mr->deadline) {
+        minirisc_service(mr);
+    }
+    // Apres les evenements : un peripherique (DMA) a pu ecrire sur du code traduit.
+    if (mr->block_flush) {
+        minirisc_block_flush(mr);
+    }
+    if (mr->halt) {
+        return;
+    }
+    block = minirisc_block_get(mr, mr->PC, labels);
+    if (block == NULL) {
+        // Hors RAM ou PC non aligne : chemin de reference
+        minirisc_fetch(mr);
+        if (mr->halt) {
+            return;
+        }
+        minirisc_decode_and_execute(mr);
+        mr->PC = mr->next_PC;
+        goto enter;
+    }
+run:
+    if (mr->counters.instret >= mr->deadline) {
+        mr->PC = block->PC; // Echeance ou interruption : examinee par enter
+        goto enter;
+    }
+    block->execs++;
+    mr->counters.instret += block->n_insns;
+dispatch:
+    if (block->native != NULL) {
+        int ret = ((jit_code_t) block->native)(mr);
+        switch (ret & 3) {
+            case JIT_EXIT_LINK0:
+            case JIT_EXIT_LINK1:
+                taken = ret & 1;
+                goto chain;
+            case JIT_EXIT_INDIRECT:
+                mr->PC = mr->next_PC;
+                goto enter;
+            default:
+                // Instruction non compilee : l'interpreteur reprend le bloc ici
+                insn = &block->insns[ret >> 2];
+                goto *insn->label;
+        }
+    }
+    if (mr->jit != NULL && ++block->exec_count == mr->jit->threshold) {
+        block->native = (void*) jit_compile(mr->jit, mr, block);
+        if (block->native != NULL) {
+            goto dispatch;
+        }
+    }
+    insn = block->insns;
+    goto *insn->label;
+
+chain:
+    // Frontiere de bloc
+    mr->PC = mr->next_PC;
+    next = block->link[taken];
+    if (next == NULL) {
+        next = minirisc_block_get(mr, mr->PC, labels);
+        if (next == NULL) {
+            goto enter;
+        }
+        block->link[taken] = next;
+    }
+    if (mr->halt || mr->block_flush) {
+        goto enter;
+    }
+    block = next;
+    goto run;
+
+lbl_end:
+    mr->next_PC = INSN_PC();
+    taken = 0;
+    goto chain;
+
+lbl_lui:    op_lui(mr, insn);    NEXT();
+lbl_auipc:  op_auipc(mr, insn);  NEXT();
+lbl_jal:
+    mr->PC = INSN_PC();
+    op_jal(mr, insn);
+    taken = 1;
+    goto chain;
+lbl_jalr:   INDIRECT(op_jalr);
+lbl_beq:    BRANCH(op_beq);
+lbl_bne:    BRANCH(op_bne);
+lbl_blt:    BRANCH(op_blt);
+lbl_bge:    BRANCH(op_bge);
+lbl_bltu:   BRANCH(op_bltu);
+lbl_bgeu:   BRANCH(op_bgeu);
+lbl_lb:     op_lb(mr, insn);     NEXT();
+lbl_lh:     CHECKED(op_lh);
+lbl_lw:     CHECKED(op_lw);
+lbl_lbu:    op_lbu(mr, insn);    NEXT();
+lbl_lhu:    CHECKED(op_lhu);
+lbl_sb:     CHECKED(op_sb);
+lbl_sh:     CHECKED(op_sh);
+lbl_sw:     CHECKED(op_sw);
+lbl_addi:   op_addi(mr, insn);   NEXT();
+lbl_slti:   op_slti(mr, insn);   NEXT();
+lbl_sltiu:  op_sltiu(mr, insn);  NEXT();
+lbl_xori:   op_xori(mr, insn);   NEXT();
+lbl_ori:    op_ori(mr, insn);    NEXT();
+lbl_andi:   op_andi(mr, insn);   NEXT();
+lbl_slli:   op_slli(mr, insn);   NEXT();
+lbl_srli:   op_srli(mr, insn);   NEXT();
+lbl_srai:   op_srai(mr, insn);   NEXT();
+lbl_add:    op_add(mr, insn);    NEXT();
+lbl_sub:    op_sub(mr, insn);    NEXT();
+lbl_sll:    op_sll(mr, insn);    NEXT();
+lbl_srl:    op_srl(mr, insn);    NEXT();
+lbl_sra:    op_sra(mr, insn);    NEXT();
+lbl_slt:    op_slt(mr, insn);    NEXT();
+lbl_sltu:   op_sltu(mr, insn);   NEXT();
+lbl_xor:    op_xor(mr, insn);    NEXT();
+lbl_or:     op_or(mr, insn);     NEXT();
+lbl_and:    op_and(mr, insn);    NEXT();
+lbl_ecall:  op_ecall(mr, insn);  NEXT();
+lbl_reti:   INDIRECT(op_reti);
+lbl_wfi:
+    mr->PC = INSN_PC();
+    op_wfi(mr, insn);
+    mr->next_PC = mr->PC + 4;
+    taken = 0;
+    goto chain;
+lbl_csrrw:  CSR(op_csrrw);
+lbl_csrrs:  CSR(op_csrrs);
+lbl_csrrc:  CSR(op_csrrc);
+lbl_csrrwi: CSR(op_csrrwi);
+lbl_csrrsi: CSR(op_csrrsi);
+lbl_csrrci: CSR(op_csrrci);
+lbl_hle:
+    // Retour a ra, ou arret ; la routine a pu ecrire sur du code traduit (vu par enter)
+    mr->PC = INSN_PC();
+    mr->next_PC = mr->PC + 4;
+    op_hle(mr, insn);
+    mr->PC = mr->next_PC;
+    goto enter;
+lbl_mul:    op_mul(mr, insn);    NEXT();
+lbl_mulh:   op_mulh(mr, insn);   NEXT();
+lbl_mulhsu: op_mulhsu(mr, insn); NEXT();
+lbl_mulhu:  op_mulhu(mr, insn);  NEXT();
+lbl_div:    op_div(mr, insn);    NEXT();
+lbl_divu:   op_divu(mr, insn);   NEXT();
+lbl_rem:    op_rem(mr, insn);    NEXT();
+lbl_remu:   op_remu(mr, insn);   NEXT();
+lbl_illegal:
+    mr->halt = 1;
+    mr->PC = INSN_PC() + 4;
+
+#undef INSN_PC
+#undef NEXT
+#undef CHECKED
+#undef CSR
+#undef BRANCH
+#undef INDIRECT
+}
+#endif
+
+int minirisc_set_engine(minirisc_t *mr, const char *name) {
+    if (strcmp(name, "switch") == 0) {
+        mr->engine = MINIRISC_ENGINE_SWITCH;
+    }
+    else if (strcmp(name, "predecode") == 0) {
+        mr->engine = MINIRISC_ENGINE_PREDECODE;
+    }
+#ifdef __GNUC__
+    else if (strcmp(name, "threaded") == 0) {
+        mr->engine = MINIRISC_ENGINE_THREADED;
+    }
+    else if (strcmp(name, "block") == 0) {
+        mr->engine = MINIRISC_ENGINE_BLOCK;
+    }
+#endif
+    else {
+        return -1;
+    }
+    return 0;
+}
+
+void minirisc_set_profiler(minirisc_t *mr, struct profiler *profiler) {
+    // Le code natif deja genere ne signale pas les sauts.
+    minirisc_block_flush(mr);
+    mr->profiler = profiler;
+}
+
+void minirisc_set_trace(minirisc_t *mr, struct trace *trace) {
+    mr->trace = trace;
+}
+
+void minirisc_set_caches(minirisc_t *mr, struct cache_model *caches) {
+    mr->caches = caches;
+}
+
+void minirisc_set_bpred(minirisc_t *mr, struct bpred *bp) {
+    mr->bpred = bp;
+}
+
+void minirisc_set_pipeline(minirisc_t *mr, struct pipeline *pl) {
+    mr->pipeline = pl;
+}
+
+void minirisc_set_hle(minirisc_t *mr, struct hle *hle) {
+    mr->hle = hle;
+}
+
+int minirisc_set_jit(minirisc_t *mr, uint32_t threshold) {
+    // Les blocs peuvent pointer dans le tampon du JIT actuel.
+    minirisc_block_flush(mr);
+    if (mr->jit != NULL) {
+        jit_free(mr->jit);
+        mr->jit = NULL;
+    }
+    if (threshold == 0) {
+        return 0;
+    }
+    mr->jit = jit_new(JIT_BUFFER_SIZE, threshold);
+    return mr->jit != NULL ? 0 : -1;
+}
+
+minirisc_snapshot_t* minirisc_snapshot(minirisc_t *mr) {
+    minirisc_snapshot_t *snap = (minirisc_snapshot_t*) malloc(sizeof(minirisc_snapshot_t));
+    snap->memory = platform_snapshot(mr->platform);
+    if (snap->memory == NULL) {
+        free(snap);
+        return NULL;
+    }
+    snap->PC = mr->PC;
+    snap->IR = mr->IR;
+    snap->next_PC = mr->next_PC;
+    memcpy(snap->regs, mr->regs, sizeof(snap->regs));
+    snap->halt = mr->halt;
+    snap->csr = mr->csr;
+    snap->wfi = mr->wfi;
+    minirisc_sync_counters(mr);
+    snap->counters = mr->counters;
+    snap->mmio_accesses = mr->platform->mmio_accesses;
+    return snap;
+}
+
+void minirisc_restore(minirisc_t *mr, const minirisc_snapshot_t *snap) {
+    mr->PC = snap->PC;
+    mr->IR = snap->IR;
+    mr->next_PC = snap->next_PC;
+    memcpy(mr->regs, snap->regs, sizeof(mr->regs));
+    mr->halt = snap->halt;
+    mr->csr = snap->csr;
+    minirisc_sync_counters(mr); // Les executions en attente appartiennent a l'etat abandonne
+    mr->counters = snap->counters;
+    mr->wfi = snap->wfi;
+    mr->deadline = 0; // Le temps a change : lignes d'interruption et echeances a reexaminer
+    mr->platform->mmio_accesses = snap->mmio_accesses;
+    // Apres les compteurs : les peripheriques reprogramment leurs evenements
+    // au temps virtuel restaure. Les pages de code restaurees invalident le
+    // cache d'instructions et demandent le vidage des blocs, fait a l'entree
+    // du moteur.
+    platform_restore(mr->platform, snap->memory);
+}
+
+void minirisc_snapshot_free(minirisc_t *mr, minirisc_snapshot_t *snap) {
+    platform_snapshot_free(mr->platform, snap->memory);
+    free(snap);
+}
+
+void minirisc_run(minirisc_t* mr) {
+    int observed = mr->trace != NULL || mr->caches != NULL || mr->bpred != NULL || mr->pipeline != NULL;
+    switch (observed ? MINIRISC_ENGINE_PREDECODE : mr->engine) {
+        case MINIRISC_ENGINE_SWITCH:
+            minirisc_run_switch(mr);
+            break;
+#ifdef __GNUC__
+        case MINIRISC_ENGINE_THREADED:
+            minirisc_run_threaded(mr);
+            break;
+        case MINIRISC_ENGINE_BLOCK:
+            minirisc_run_block(mr);
+            break;
+#endif
+        default:
+            if (observed) {
+                minirisc_run_observed(mr);
+            }
+            else {
+                minirisc_run_predecode(mr);
+            }
+            break;
+    }
+    // Les moteurs threade et par blocs avancent PC sans tenir next_PC a
+    // jour : comme apres chaque instruction du moteur de reference, next_PC = PC.
+    mr->next_PC = mr->PC;
+    minirisc_sync_counters(mr);
+    if (mr->platform->console != NULL) {
+        console_flush(mr->platform->console); // Le programme s'est arrete : sa sortie doit etre visible
+    }
+}
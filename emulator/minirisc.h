@@ -3,27 +3,164 @@
 #include <inttypes.h>
 #include "platform.h"
 
+/**
+ * Events that the programmable performance counters (mhpmcounterN) can count,
+ * selected by writing their number to mhpmeventN.
+ */
+typedef enum {
+    MINIRISC_EVENT_NONE = 0,   // Counter stopped
+    MINIRISC_EVENT_LOAD = 1,   // Loads executed
+    MINIRISC_EVENT_STORE = 2,  // Stores executed
+    MINIRISC_EVENT_BRANCH = 3, // Conditional branches taken
+    MINIRISC_EVENT_MMIO = 4,   // Device (non-RAM) accesses, see platform_t.mmio_accesses
+    MINIRISC_EVENT_MEXT = 5,   // M extension instructions (MUL, DIV, REM...)
+    MINIRISC_EVENTS
+} minirisc_event_t;
+
+#define MINIRISC_HPM_COUNTERS 8 // mhpmcounter3 a mhpmcounter10, les suivants lisent 0
+
+#define MINIRISC_MSTATUS_IE 0x2        // Bit INTERRUPT_ENABLE de mstatus
+#define MINIRISC_MCAUSE_IRQ 0x80000000 // mcause d'une interruption : ce bit | numero de la ligne
+
 /**
  * Structure pour les CSR.
+ *
+ * Les compteurs (mcycle, minstret, mhpmcounterN) ne sont pas mis a jour par
+ * les moteurs : ils sont calcules a la lecture depuis minirisc_counters_t.
+ * Une ecriture ne fait que changer leur decalage.
  */
 typedef struct {
 	uint32_t mstatus; // Machine Status (Adresse 0x300)
 	uint32_t mepc;    // Machine Exception PC (Adresse 0x341)
+    uint32_t mtvec;   // Adresse du traitant d'interruption (0x305)
+    uint32_t mcause;  // Cause de la derniere interruption prise (0x342)
+    uint64_t mcycle_offset;   // mcycle = cycles depuis le reset - mcycle_offset (0xB00, 0xB80)
+    uint64_t minstret_offset; // minstret = instructions depuis le reset - minstret_offset (0xB02, 0xB82)
+    uint64_t mhpmcounter_offset[MINIRISC_HPM_COUNTERS]; // mhpmcounter3+i (0xB03+i, 0xB83+i)
+    uint32_t mhpmevent[MINIRISC_HPM_COUNTERS];          // Evenement compte par mhpmcounter3+i (0x323+i)
 } csr_t;
 
 /**
- * Processor object.
+ * Raw event counts since reset, kept by the execution engines as cheaply as
+ * they can (the block engine only counts block executions, see
+ * minirisc_sync_counters()).
+ * The MMIO count is kept by the platform.
  */
 typedef struct {
+    uint64_t instret;                 // Instructions executed
+    uint64_t stalls;                  // Cycles beyond one per instruction, from the pipeline model
+    uint64_t idle;                    // Virtual time skipped by WFI while waiting for an interrupt
+    uint64_t events[MINIRISC_EVENTS]; // Indexed by minirisc_event_t; [MINIRISC_EVENT_NONE] is scratch
+} minirisc_counters_t;
+
+struct minirisc;
+struct jit;
+struct profiler;
+struct trace;
+struct cache_model;
+struct bpred;
+struct pipeline;
+struct hle;
+
+/**
+ * Execution engines usable by minirisc_run().
+ */
+typedef enum {
+    MINIRISC_ENGINE_SWITCH = 0,    // Reference: minirisc_fetch() + minirisc_decode_and_execute()
+    MINIRISC_ENGINE_PREDECODE = 1, // Predecoded instructions, one handler call per instruction
+    MINIRISC_ENGINE_THREADED = 2,  // Predecoded instructions, direct-threaded dispatch (computed goto, GCC only)
+    MINIRISC_ENGINE_BLOCK = 3      // Translated basic blocks chained together (computed goto, GCC only)
+} minirisc_engine_t;
+
+/**
+ * Instruction predecodee : operandes extraits, immediat deja etendu (ou
+ * cible deja calculee pour les sauts/branchements relatifs au PC) et
+ * fonction qui l'execute. `exec == NULL` signifie que l'entree est invalide.
+ */
+typedef struct minirisc_insn {
+    void     (*exec)(struct minirisc *mr, const struct minirisc_insn *insn);
+    const void *label; // Handler du moteur threade (NULL tant qu'il ne l'a pas resolu)
+    uint32_t IR;      // Instruction brute
+    uint32_t imm;     // Immediat etendu, ou cible pour AUIPC/JAL/branchements
+    uint8_t  opcode;
+    uint8_t  rd;
+    uint8_t  rs1;
+    uint8_t  rs2;
+    uint8_t  event;   // minirisc_event_t compte statiquement par l'instruction (charge, stockage, extension M)
+} minirisc_insn_t;
+
+/**
+ * Bloc de base traduit : suite d'instructions predecodees commencant a PC et
+ * se terminant par un saut, un branchement, EBREAK ou RETI (ou par une
+ * pseudo-instruction de fin si le bloc atteint la fin de la page ou sa
+ * taille maximale). Les successeurs statiques sont chaines directement.
+ */
+#define BLOCK_MAX_INSNS 64
+
+typedef struct minirisc_block {
+    uint32_t PC;                      // Adresse de la premiere instruction
+    uint32_t n_insns;                 // Nombre d'instructions guest du bloc
+    uint32_t exec_count;              // Executions interpretees, pour declencher le JIT
+    uint64_t execs;                   // Executions pas encore reportees dans mr->counters
+    uint8_t  n_events[MINIRISC_EVENTS]; // Instructions du bloc par evenement statique (insn->event)
+    void     *native;                 // Code natif genere par le JIT (NULL si aucun)
+    struct minirisc_block *link[2];   // Successeurs chaines : [0] en sequence, [1] branchement pris / cible de JAL
+    struct minirisc_block *hash_next; // Chainage dans la table de hachage
+    struct minirisc_block *list_next; // Liste de tous les blocs traduits
+    minirisc_insn_t insns[];          // n_insns micro-ops (+ la pseudo-instruction de fin eventuelle)
+} minirisc_block_t;
+
+/**
+ * Processor object.
+ */
+typedef struct minirisc {
 	uint32_t    PC;       // Program counter register
 	uint32_t    IR;       // Instruction register
-	uint32_t    next_PC;  // Value used to update the PC after the exec stage
+	uint32_t    next_PC;  // Value used to update the PC after the exec stage (equal to PC when minirisc_run() returns)
 	uint32_t    regs[32]; // General purpose registers, r0 is hardwired to 0
 	platform_t* platform; // The platform this core is connected to
 	int         halt;     // Stop the emulator when other than 0
 	csr_t		csr;
+    minirisc_counters_t counters; // Raw counts behind the counter CSRs
+    minirisc_insn_t **icache; // Predecoded instructions, one lazily allocated array per RAM page
+    uint32_t    *icache_pages;   // Pages allocated in icache, so that freeing does not scan it
+    uint32_t    n_icache_pages;
+    uint32_t    icache_capacity;
+    minirisc_engine_t engine; // Engine used by minirisc_run()
+    minirisc_block_t **blocks; // Translated blocks, hash table indexed by PC
+    minirisc_block_t *block_list; // All translated blocks, for minirisc_sync_counters()
+    int         block_flush;  // Translated code was overwritten: flush blocks at the next block boundary
+    struct jit *jit;          // Native code generator for hot blocks (NULL when disabled)
+    struct profiler *profiler; // Call stack tracking for the sampling profiler (NULL when disabled)
+    struct trace *trace;      // Execution trace being recorded (NULL when disabled)
+    struct cache_model *caches; // Simulated cache hierarchy (NULL when disabled)
+    struct bpred *bpred;      // Branch predictors under evaluation (NULL when disabled)
+    struct pipeline *pipeline; // Pipeline timing model (NULL when disabled)
+    struct hle  *hle;         // Library routines emulated on the host (NULL when disabled)
+    uint64_t    deadline;     // Value of counters.instret at which devices and interrupts are next examined (0: right away)
+    int         wfi;          // WFI executed: wait for an interrupt at the next examination
+#ifdef MINIRISC_STATS
+    struct stats *stats;      // Per-opcode and per-PC histograms (see stats.h)
+#endif
 } minirisc_t;
 
+/**
+ * Machine state saved by minirisc_snapshot(): the core's registers and the
+ * memory image and device state of its platform.
+ */
+typedef struct {
+    uint32_t PC;
+    uint32_t IR;
+    uint32_t next_PC;
+    uint32_t regs[32];
+    int      halt;
+    int      wfi;
+    csr_t    csr;
+    minirisc_counters_t counters;
+    uint64_t mmio_accesses;
+    platform_snapshot_t *memory;
+} minirisc_snapshot_t;
+
 /**
  * Allocate and initializes a new `minirisc_t` object.
  */
@@ -41,6 +178,10 @@ void minirisc_fetch(minirisc_t *mr);
 
 /**
  * Lit un CSR en fonction de son numéro (adresse)
+ * Compteurs : mcycle/minstret/mhpmcounterN (0xB00-0xB1F, moities hautes
+ * 0xB80-0xB9F) et leurs copies en lecture seule cycle/instret/hpmcounterN
+ * (0xC00-0xC1F, 0xC80-0xC9F). Sans modele de temps, un cycle par instruction.
+ * Interruptions : mstatus (0x300), mtvec (0x305), mepc (0x341), mcause (0x342).
  */
 uint32_t csr_read(minirisc_t *mr, uint32_t csr_num);
 
@@ -55,14 +196,115 @@ void csr_write(minirisc_t *mr, uint32_t csr_num, uint32_t value);
 void minirisc_decode_and_execute(minirisc_t *mr);
 
 /**
- * Run the processor:
- * minirisc_fetch() and minirisc_decode_and_execute()
- * in a loop while halt is false.
+ * Decode IR (located at PC) into insn, without executing it.
+ */
+void minirisc_predecode(uint32_t IR, uint32_t PC, minirisc_insn_t *insn);
+
+/**
+ * Bring mr->counters up to date. Apart from instret, the block engine only
+ * counts executions per block while running; they are added to the counters
+ * here, which csr_read(), minirisc_snapshot() and minirisc_run() (on return) call.
+ */
+void minirisc_sync_counters(minirisc_t *mr);
+
+/**
+ * Mnemonic of an opcode ("addi", "lw"...), "?" if it is not an instruction.
+ */
+const char* minirisc_opcode_name(uint32_t opcode);
+
+/**
+ * Select the engine used by minirisc_run() from its name ("switch",
+ * "predecode", "threaded" or "block").
+ * @return 0 on success, -1 if the name is unknown or the engine is not
+ *         available with this compiler.
+ */
+int minirisc_set_engine(minirisc_t *mr, const char *name);
+
+/**
+ * Enable the JIT of the block engine: a block is compiled to native code
+ * after `threshold` interpreted executions. 0 disables the JIT, so that
+ * the interpreters can be compared against it.
+ * @return 0 on success, -1 if the JIT is not available on this host.
+ */
+int minirisc_set_jit(minirisc_t *mr, uint32_t threshold);
+
+/**
+ * Report calls and returns (JAL/JALR with rd = ra, JALR x0, 0(ra)) to
+ * profiler, NULL to stop. Translated blocks are flushed, so that the JIT
+ * leaves these jumps to the interpreter while a profiler is set.
+ */
+void minirisc_set_profiler(minirisc_t *mr, struct profiler *profiler);
+
+/**
+ * Record every instruction executed by minirisc_run() in trace (NULL to
+ * stop): PC, register written and memory access. While a trace is set,
+ * minirisc_run() uses an instrumented variant of the predecode engine.
+ */
+void minirisc_set_trace(minirisc_t *mr, struct trace *trace);
+
+/**
+ * Simulate every instruction fetch, load and store executed by
+ * minirisc_run() in caches (NULL to stop). Like tracing, this runs the
+ * instrumented predecode engine.
+ */
+void minirisc_set_caches(minirisc_t *mr, struct cache_model *caches);
+
+/**
+ * Resolve every branch and jump executed by minirisc_run() in the
+ * predictors of bp (NULL to stop), with the instrumented predecode engine.
+ */
+void minirisc_set_bpred(minirisc_t *mr, struct bpred *bp);
+
+/**
+ * Time every instruction executed by minirisc_run() with the pipeline model
+ * pl (NULL to stop), with the instrumented predecode engine. The stalls it
+ * computes, cache penalties included when caches are set, are added to
+ * mcycle.
+ */
+void minirisc_set_pipeline(minirisc_t *mr, struct pipeline *pl);
+
+/**
+ * Execute the HLE pseudo-instructions (see hle.h) with the routines bound
+ * by hle, NULL to stop: they then halt the core like an unknown opcode.
+ */
+void minirisc_set_hle(minirisc_t *mr, struct hle *hle);
+
+/**
+ * Run the processor while halt is false, with the engine selected in
+ * mr->engine. The predecoded engines execute instructions located in RAM
+ * from the cache; anything else goes through minirisc_fetch() and
+ * minirisc_decode_and_execute().
+ *
+ * The devices' events (see sched.h) that are due are run, and the
+ * interrupt lines examined, when counters.instret reaches mr->deadline,
+ * the instant of the earliest event; in between, the engines run without
+ * looking at any device. The check point is: every instruction
+ * for the switch and predecode engines, every jump taken for the threaded
+ * engine, every block for the block engine. A pending interrupt is taken
+ * there if mstatus enables it: mepc receives the PC of the next instruction,
+ * the enable bit is cleared, mcause is set and execution continues at mtvec.
+ * WFI skips the virtual time from event to event until an interrupt line
+ * is raised, instead of executing anything; with no interrupt able to
+ * wake it up, the core halts.
  */
 void minirisc_run(minirisc_t *mr);
 
 /**
- * Lance des tests unitaires pour le minirisc.
+ * Save the state of the core and of its platform's RAM and devices.
+ * @return The snapshot, or NULL on error.
+ */
+minirisc_snapshot_t* minirisc_snapshot(minirisc_t *mr);
+
+/**
+ * Put the core and its platform's RAM and devices back in the state saved
+ * by snap. Device events queued since then are cancelled.
+ * Only the RAM pages written since then are copied (see platform_restore()),
+ * so restoring a snapshot after a short run is cheap.
+ */
+void minirisc_restore(minirisc_t *mr, const minirisc_snapshot_t *snap);
+
+/**
+ * Free a snapshot taken on mr.
  */
-void minirisc_test();
+void minirisc_snapshot_free(minirisc_t *mr, minirisc_snapshot_t *snap);
 #endif
\ No newline at end of file
@@ -0,0 +1,196 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pipeline.h"
+#include "minirisc.h"
+
+void pipeline_config_default(pipeline_config_t *config) {
+    config->branch = 2;
+    config->jal = 1;
+    config->jalr = 2;
+    config->load_use = 1;
+    config->mul = 3;
+    config->div = 34;
+}
+
+int pipeline_config_parse(pipeline_config_t *config, const char *spec) {
+    static const struct {
+        const char *name;
+        size_t offset;
+    } fields[] = {
+        { "branch", offsetof(pipeline_config_t, branch) },
+        { "jal", offsetof(pipeline_config_t, jal) },
+        { "jalr", offsetof(pipeline_config_t, jalr) },
+        { "loaduse", offsetof(pipeline_config_t, load_use) },
+        { "mul", offsetof(pipeline_config_t, mul) },
+        { "div", offsetof(pipeline_config_t, div) },
+    };
+    pipeline_config_t parsed = *config;
+
+    while (*spec != '\0') {
+        size_t length = strcspn(spec, "=,");
+        size_t i;
+        for (i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+            if (strlen(fields[i].name) == length && strncmp(spec, fields[i].name, length) == 0) {
+                break;
+            }
+        }
+        if (i == sizeof(fields) / sizeof(fields[0]) || spec[length] != '=') {
+            return -1;
+        }
+        char *end;
+        uint32_t value = (uint32_t) strtoul(spec + length + 1, &end, 0);
+        if (end == spec + length + 1 || (*end != ',' && *end != '\0')) {
+            return -1;
+        }
+        *(uint32_t*) ((char*) &parsed + fields[i].offset) = value;
+        spec = *end == ',' ? end + 1 : end;
+    }
+    // Une latence compte le cycle de l'instruction elle-meme
+    if (parsed.mul == 0 || parsed.div == 0) {
+        return -1;
+    }
+    *config = parsed;
+    return 0;
+}
+
+pipeline_t* pipeline_new(const pipeline_config_t *config, const char *elf_file) {
+    pipeline_t *pl = (pipeline_t*) calloc(1, sizeof(pipeline_t));
+    pl->config = *config;
+    if (elf_file != NULL) {
+        pl->n_symbols = elf_loader_symbols(elf_file, &pl->symbols);
+        if (pl->n_symbols < 0) {
+            free(pl);
+            return NULL;
+        }
+    }
+    pl->functions = (pipeline_function_t*) calloc(pl->n_symbols + 1, sizeof(pipeline_function_t));
+    pl->function = &pl->functions[pl->n_symbols];
+    return pl;
+}
+
+void pipeline_free(pipeline_t *pl) {
+    elf_loader_free_symbols(pl->symbols, pl->n_symbols);
+    free(pl->functions);
+    free(pl);
+}
+
+/**
+ * Cherche la fonction contenant PC et la portee de son symbole, pour que
+ * les instructions suivantes n'aient qu'une comparaison a faire.
+ */
+static void pipeline_enter(pipeline_t *pl, uint32_t PC) {
+    const elf_symbol_t *sym = elf_loader_find_symbol(pl->symbols, pl->n_symbols, PC);
+    int i = sym != NULL ? (int) (sym - pl->symbols) : pl->n_symbols;
+    int next = sym != NULL ? i + 1 : 0;
+
+    while (next < pl->n_symbols && pl->symbols[next].addr <= PC) {
+        next++; // Symboles a la meme adresse que sym
+    }
+    pl->function = &pl->functions[i];
+    pl->function_start = sym != NULL ? sym->addr : 0;
+    pl->function_end = next < pl->n_symbols ? pl->symbols[next].addr : 0xFFFFFFFF;
+}
+
+static inline int pipeline_reads_rs1(uint32_t opcode) {
+    return (opcode >= 4 && opcode <= 37) || (opcode >= 42 && opcode <= 44) || (opcode >= 56 && opcode <= 63);
+}
+
+// Les stockages lisent leur valeur en MEM : elle arrive a temps d'un chargement precedent.
+static inline int pipeline_reads_rs2(uint32_t opcode) {
+    return (opcode >= 5 && opcode <= 10) || (opcode >= 28 && opcode <= 37) || (opcode >= 56 && opcode <= 63);
+}
+
+uint32_t pipeline_step(pipeline_t *pl, const struct minirisc_insn *insn, uint32_t PC, uint32_t next_PC, uint32_t memory_stalls) {
+    const pipeline_config_t *config = &pl->config;
+    uint32_t opcode = insn->opcode;
+    uint32_t stalls = memory_stalls;
+
+    if (pl->load_rd != 0 && ((pipeline_reads_rs1(opcode) && insn->rs1 == pl->load_rd)
+                             || (pipeline_reads_rs2(opcode) && insn->rs2 == pl->load_rd))) {
+        stalls += config->load_use;
+        pl->load_use_stalls += config->load_use;
+    }
+    pl->load_rd = opcode >= 11 && opcode <= 15 ? insn->rd : 0;
+
+    if (opcode >= 5 && opcode <= 10) {
+        if (next_PC != PC + 4) {
+            stalls += config->branch;
+            pl->branch_stalls += config->branch;
+        }
+    }
+    else if (opcode == 3) {
+        stalls += config->jal;
+        pl->jump_stalls += config->jal;
+    }
+    else if (opcode == 4 || opcode == 40) {
+        stalls += config->jalr;
+        pl->jump_stalls += config->jalr;
+    }
+    else if (opcode >= 56 && opcode <= 59) {
+        stalls += config->mul - 1;
+        pl->muldiv_stalls += config->mul - 1;
+    }
+    else if (opcode >= 60 && opcode <= 63) {
+        stalls += config->div - 1;
+        pl->muldiv_stalls += config->div - 1;
+    }
+    pl->memory_stalls += memory_stalls;
+
+    pl->instructions++;
+    pl->cycles += 1 + stalls;
+    if (PC - pl->function_start >= pl->function_end - pl->function_start) {
+        pipeline_enter(pl, PC);
+    }
+    pl->function->instructions++;
+    pl->function->cycles += 1 + stalls;
+    return stalls;
+}
+
+typedef struct {
+    const char *name;
+    const pipeline_function_t *function;
+} pipeline_rank_t;
+
+static int pipeline_rank_compare(const void *a, const void *b) {
+    const pipeline_rank_t *x = (const pipeline_rank_t*) a;
+    const pipeline_rank_t *y = (const pipeline_rank_t*) b;
+    if (x->function->cycles != y->function->cycles) {
+        return x->function->cycles < y->function->cycles ? 1 : -1;
+    }
+    return strcmp(x->name, y->name);
+}
+
+static double pipeline_cpi(uint64_t cycles, uint64_t instructions) {
+    return instructions ? (double) cycles / instructions : 0.0;
+}
+
+void pipeline_report(const pipeline_t *pl, FILE *out) {
+    uint64_t cycles = pl->cycles + (pl->instructions ? PIPELINE_DEPTH - 1 : 0); // Remplissage
+
+    fprintf(out, "Pipeline %d etages : %" PRIu64 " cycles, %" PRIu64 " instructions, CPI %.3f\n",
+            PIPELINE_DEPTH, cycles, pl->instructions, pipeline_cpi(cycles, pl->instructions));
+    fprintf(out, "  cycles perdus : load-use %" PRIu64 ", branchements %" PRIu64 ", sauts %" PRIu64
+            ", MUL/DIV %" PRIu64 ", memoire %" PRIu64 "\n",
+            pl->load_use_stalls, pl->branch_stalls, pl->jump_stalls, pl->muldiv_stalls, pl->memory_stalls);
+
+    pipeline_rank_t *ranks = (pipeline_rank_t*) malloc((pl->n_symbols + 1) * sizeof(pipeline_rank_t));
+    int n = 0;
+    for (int i = 0; i <= pl->n_symbols; i++) {
+        if (pl->functions[i].instructions != 0) {
+            ranks[n].name = i < pl->n_symbols ? pl->symbols[i].name : "(sans symbole)";
+            ranks[n].function = &pl->functions[i];
+            n++;
+        }
+    }
+    qsort(ranks, n, sizeof(pipeline_rank_t), pipeline_rank_compare);
+    fprintf(out, "  fonction                  instructions          cycles     CPI  %% cycles\n");
+    for (int i = 0; i < n && i < PIPELINE_TOP; i++) {
+        const pipeline_function_t *function = ranks[i].function;
+        fprintf(out, "  %-24s %13" PRIu64 "  %14" PRIu64 "  %6.3f  %7.2f\n", ranks[i].name, function->instructions,
+                function->cycles, pipeline_cpi(function->cycles, function->instructions),
+                pl->cycles ? 100.0 * function->cycles / pl->cycles : 0.0);
+    }
+    free(ranks);
+}
@@ -0,0 +1,100 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+#include <inttypes.h>
+#include <stdio.h>
+#include "elf_loader.h"
+
+/*
+ * Modele de temps d'un pipeline scalaire en ordre a 5 etages (IF, ID, EX,
+ * MEM, WB) avec envoi (forwarding) complet. Une instruction coute un cycle,
+ * plus :
+ *   - une bulle si elle lit le registre charge par l'instruction precedente
+ *     (dependance load-use) ;
+ *   - la penalite d'un branchement pris (predit non pris, resolu en EX), de
+ *     JAL (resolu en ID) ou de JALR/RETI (resolus en EX) ;
+ *   - la latence de MUL/DIV (opcodes 56 a 63) moins un, l'etage EX restant
+ *     occupe ;
+ *   - les cycles de penalite des caches quand le modele de caches est actif.
+ */
+
+#define PIPELINE_DEPTH 5
+#define PIPELINE_TOP   20 // Fonctions du rapport
+
+struct minirisc_insn;
+
+/**
+ * Penalties and latencies of the pipeline, in cycles.
+ */
+typedef struct {
+    uint32_t branch;   // Taken conditional branch
+    uint32_t jal;      // JAL
+    uint32_t jalr;     // JALR and RETI
+    uint32_t load_use; // Load followed by a dependent instruction
+    uint32_t mul;      // MUL, MULH, MULHSU, MULHU latency
+    uint32_t div;      // DIV, DIVU, REM, REMU latency
+} pipeline_config_t;
+
+typedef struct {
+    uint64_t instructions;
+    uint64_t cycles;
+} pipeline_function_t;
+
+/**
+ * Timing state and statistics.
+ */
+typedef struct pipeline {
+    pipeline_config_t config;
+    uint32_t load_rd;           // Registre charge par l'instruction precedente (0 : aucun)
+    uint64_t instructions;
+    uint64_t cycles;            // Sans le remplissage initial du pipeline
+    uint64_t load_use_stalls;
+    uint64_t branch_stalls;
+    uint64_t jump_stalls;
+    uint64_t muldiv_stalls;
+    uint64_t memory_stalls;
+    elf_symbol_t *symbols;      // Fonctions du programme, triees par adresse
+    int n_symbols;
+    pipeline_function_t *functions; // Par symbole, plus une entree pour le code hors symbole
+    uint32_t function_start;    // [function_start, function_end[ : portee du symbole courant
+    uint32_t function_end;
+    pipeline_function_t *function;
+} pipeline_t;
+
+/**
+ * Default timings: 2-cycle branch and JALR penalties, 1-cycle JAL penalty,
+ * 1 load-use bubble, 3-cycle multiplier, 34-cycle divider.
+ */
+void pipeline_config_default(pipeline_config_t *config);
+
+/**
+ * Change timings from a comma-separated list of name=cycles, with names
+ * branch, jal, jalr, loaduse, mul and div.
+ * @return 0 on success, -1 if spec is invalid.
+ */
+int pipeline_config_parse(pipeline_config_t *config, const char *spec);
+
+/**
+ * Create a timing model. Cycles are attributed to the functions of
+ * elf_file when it is not NULL (see elf_loader_symbols()).
+ * @return The model, or NULL on error (message printed on stderr).
+ */
+pipeline_t* pipeline_new(const pipeline_config_t *config, const char *elf_file);
+
+/**
+ * Free the model.
+ */
+void pipeline_free(pipeline_t *pl);
+
+/**
+ * Account for the instruction insn at PC, which has just executed and set
+ * next_PC, and whose memory accesses cost memory_stalls cycles.
+ * @return The cycles it took beyond the first one.
+ */
+uint32_t pipeline_step(pipeline_t *pl, const struct minirisc_insn *insn, uint32_t PC, uint32_t next_PC, uint32_t memory_stalls);
+
+/**
+ * Print total cycles, CPI, stall cycles by cause, and cycles and CPI of
+ * the most expensive functions.
+ */
+void pipeline_report(const pipeline_t *pl, FILE *out);
+#endif
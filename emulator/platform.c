@@ -1,42 +1,221 @@
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
 
 #include "platform.h"
+#include "console.h"
+#include "sched.h"
+#include "timer.h"
+#include "dma.h"
+
+static int ram_read(void *opaque, access_type_t access_type, uint32_t offset, uint32_t *data);
+static int ram_write(void *opaque, access_type_t access_type, uint32_t offset, uint32_t data);
+
+/**
+ * Reserve size octets a zero sans les allouer : les pages ne sont fournies
+ * par le noyau qu'au premier acces.
+ */
+static void* platform_reserve(size_t size) {
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return p == MAP_FAILED ? NULL : p;
+}
 
 platform_t* platform_new() {
     platform_t* platform;
     platform = (platform_t*) malloc(sizeof(platform_t));
-    platform->memory = (uint32_t*) malloc(32*1024*1024*sizeof(uint8_t));
+    platform->n_rams = 0;
+    platform->code_pages = (uint8_t*) platform_reserve(PLATFORM_PAGES);
+    platform->code_write = NULL;
+    platform->code_opaque = NULL;
+    platform->dirty_pages = NULL;
+    platform->dirty_list = NULL;
+    platform->n_dirty = 0;
+    platform->dirty_capacity = 0;
+    platform->dirty_base = NULL;
+    platform_tlb_flush(platform);
+
+    platform->n_devices = 0;
+    platform->console = NULL;
+    platform->timer = NULL;
+    platform->dma = NULL;
+    platform->sched = sched_new();
+    platform->irq_pending = 0;
+    platform->clock = NULL;
+    platform->kick = NULL;
+    platform->core_opaque = NULL;
+    platform->mmio_accesses = 0;
+    for (uint32_t i = 0; i < (1u << (32 - PLATFORM_BUS_L1_SHIFT)); i++) {
+        platform->bus[i] = NULL;
+    }
+    platform_add_ram(platform, PLATFORM_RAM_BASE, PLATFORM_RAM_SIZE);
+    console_init(platform);
+    timer_init(platform);
+    dma_init(platform);
     return platform;
 }
 
 void platform_free(platform_t* platform) {
-    free(platform->memory);
+    if (platform->console != NULL) {
+        console_free(platform->console);
+    }
+    if (platform->timer != NULL) {
+        timer_free(platform->timer);
+    }
+    if (platform->dma != NULL) {
+        dma_free(platform->dma);
+    }
+    sched_free(platform->sched);
+    for (uint32_t i = 0; i < (1u << (32 - PLATFORM_BUS_L1_SHIFT)); i++) {
+        free(platform->bus[i]);
+    }
+    for (int i = 0; i < platform->n_rams; i++) {
+        munmap(platform->rams[i].host, platform->rams[i].size);
+    }
+    munmap(platform->code_pages, PLATFORM_PAGES);
+    if (platform->dirty_pages != NULL) {
+        munmap(platform->dirty_pages, PLATFORM_PAGES);
+    }
+    free(platform->dirty_list);
     free(platform);
 }
 
-int platform_read(platform_t *plt, access_type_t access_type, uint32_t addr, uint32_t *data) {
-    if (addr == 0x10000000 || addr == 0x10000004 || addr == 0x10000008) {
-        *data = 0;
-        return 0;
+platform_device_t* platform_add_device(platform_t *plt, const char *name, uint32_t base, uint32_t size,
+                                       platform_device_read_t read, platform_device_write_t write,
+                                       void *opaque, uint8_t *ram) {
+    uint32_t first = base >> PLATFORM_PAGE_SHIFT;
+    uint32_t last = (uint32_t) (((uint64_t) base + size - 1) >> PLATFORM_PAGE_SHIFT);
+
+    if (size == 0 || (base & (PLATFORM_PAGE_SIZE - 1)) != 0 || (uint64_t) base + size > 0x100000000ull
+        || plt->n_devices == PLATFORM_MAX_DEVICES) {
+        fprintf(stderr, "Erreur : peripherique %s invalide a 0x%08x\n", name, base);
+        return NULL;
+    }
+    for (uint32_t page = first; page <= last; page++) {
+        if (platform_find_device(plt, page << PLATFORM_PAGE_SHIFT) != NULL) {
+            fprintf(stderr, "Erreur : peripherique %s en conflit a 0x%08x\n", name, page << PLATFORM_PAGE_SHIFT);
+            return NULL;
+        }
+    }
+
+    platform_device_t *dev = &plt->devices[plt->n_devices++];
+    dev->name = name;
+    dev->base = base;
+    dev->size = size;
+    dev->read = read;
+    dev->write = write;
+    dev->opaque = opaque;
+    dev->ram = ram;
+
+    for (uint32_t page = first; page <= last; page++) {
+        uint32_t zone = page >> (PLATFORM_BUS_L1_SHIFT - PLATFORM_PAGE_SHIFT);
+        if (plt->bus[zone] == NULL) {
+            plt->bus[zone] = (platform_device_t**) calloc(PLATFORM_BUS_L2_SIZE, sizeof(platform_device_t*));
+        }
+        plt->bus[zone][page & (PLATFORM_BUS_L2_SIZE - 1)] = dev;
+    }
+    return dev;
+}
+
+platform_device_t* platform_add_ram(platform_t *plt, uint32_t base, uint32_t size) {
+    if (plt->n_rams == PLATFORM_MAX_RAMS || size == 0 || size > 0 - PLATFORM_PAGE_SIZE) {
+        fprintf(stderr, "Erreur : region de RAM invalide a 0x%08x\n", base);
+        return NULL;
+    }
+    size = (size + PLATFORM_PAGE_SIZE - 1) & ~(PLATFORM_PAGE_SIZE - 1);
+
+    platform_ram_t *ram = &plt->rams[plt->n_rams];
+    ram->plt = plt;
+    ram->base = base;
+    ram->size = size;
+    ram->host = (uint8_t*) platform_reserve(size);
+    if (ram->host == NULL) {
+        fprintf(stderr, "Erreur : impossible de reserver %u octets de RAM\n", size);
+        return NULL;
+    }
+
+    platform_device_t *dev = platform_add_device(plt, "ram", base, size, ram_read, ram_write, ram, ram->host);
+    if (dev == NULL) {
+        munmap(ram->host, size);
+        return NULL;
+    }
+    plt->n_rams++;
+    return dev;
+}
+
+uint64_t platform_time(platform_t *plt) {
+    return plt->clock != NULL ? plt->clock(plt->core_opaque) : 0;
+}
+
+void platform_set_irq(platform_t *plt, int line, int level) {
+    uint32_t pending = level ? plt->irq_pending | (1u << line) : plt->irq_pending & ~(1u << line);
+    if (pending != plt->irq_pending) {
+        plt->irq_pending = pending;
+        platform_kick(plt);
+    }
+}
+
+void platform_schedule(platform_t *plt, sched_event_t *event, uint64_t time) {
+    sched_add(plt->sched, event, time);
+    if (sched_next(plt->sched) == time) {
+        platform_kick(plt);
     }
+}
+
+void platform_cancel(platform_t *plt, sched_event_t *event) {
+    sched_remove(plt->sched, event);
+}
+
+void platform_kick(platform_t *plt) {
+    if (plt->kick != NULL) {
+        plt->kick(plt->core_opaque);
+    }
+}
+
+void platform_tlb_flush(platform_t *plt) {
+    for (int i = 0; i < PLATFORM_TLB_SIZE; i++) {
+        plt->tlb_read[i].page = PLATFORM_TLB_INVALID;
+        plt->tlb_write[i].page = PLATFORM_TLB_INVALID;
+    }
+}
+
+/**
+ * Installe dans le TLB la page contenant addr, qui appartient au peripherique
+ * de RAM dev.
+ */
+static void platform_tlb_fill(platform_tlb_entry_t *tlb, const platform_device_t *dev, uint32_t addr) {
+    uint32_t page = addr & ~(PLATFORM_PAGE_SIZE - 1);
+    platform_tlb_entry_t *entry = &tlb[(addr >> PLATFORM_PAGE_SHIFT) & (PLATFORM_TLB_SIZE - 1)];
+    entry->page = page;
+    entry->host = dev->ram + (page - dev->base);
+}
+
+void platform_set_code_page(platform_t *plt, uint32_t page) {
+    uint32_t addr = page << PLATFORM_PAGE_SHIFT;
+    platform_tlb_entry_t *entry = &plt->tlb_write[page & (PLATFORM_TLB_SIZE - 1)];
 
-    if (addr < 0x80000000 || addr >= (0x80000000 + 0x2000000)) return -1; // On est hors champ
+    plt->code_pages[page] = 1;
+    if (entry->page == addr) {
+        entry->page = PLATFORM_TLB_INVALID; // Les ecritures doivent maintenant etre vues par code_write
+    }
+}
+
+static int ram_read(void *opaque, access_type_t access_type, uint32_t offset, uint32_t *data) {
+    platform_ram_t *ram = (platform_ram_t*) opaque;
 
-    uint32_t offset = addr - 0x80000000;
     switch (access_type)
     {
     case ACCESS_WORD :
-        if (addr % 4 != 0)
+        if (offset % 4 != 0)
             return -1;
-        *data = plt->memory[offset/4];
+        *data = *(uint32_t*)(ram->host + offset);
         break;
     case ACCESS_HALF :
-        if (addr % 2 != 0)
+        if (offset % 2 != 0)
             return -1;
-        *data = (uint32_t) *(int16_t*)((uint8_t*)plt->memory + offset); // On se deplace octets par octets. On change le type en pointeur d'un entier signé sur 16 bits qu'on déréférence. À l'issue on convertit finalement en un uint32. De cette maniere on conserve le signe et on a donc des 1 sur les bits rajoutés.
+        *data = (uint32_t) *(int16_t*)(ram->host + offset); // On se deplace octets par octets. On change le type en pointeur d'un entier signé sur 16 bits qu'on déréférence. À l'issue on convertit finalement en un uint32. De cette maniere on conserve le signe et on a donc des 1 sur les bits rajoutés.
         break;
     case ACCESS_BYTE :
-        *data = (uint32_t) *(int8_t*)((uint8_t*)plt->memory + offset);
+        *data = (uint32_t) *(int8_t*)(ram->host + offset);
         break;
     default:
         return -1;
@@ -47,38 +226,31 @@ int platform_read(platform_t *plt, access_type_t access_type, uint32_t addr, uin
 
 }
 
-int platform_write(platform_t *plt, access_type_t access_type, uint32_t addr, uint32_t data) {
-    
-    switch (addr) {
-        case 0x10000000:
-            printf("%c", (char)data);
-            return 0;
-        case 0x10000004:
-            printf("%d", (int32_t)data);
-            return 0;
-        case 0x10000008:
-            printf("%x", data);
-            return 0;
-        default:
-            break;
+static int ram_write(void *opaque, access_type_t access_type, uint32_t offset, uint32_t data) {
+    platform_ram_t *ram = (platform_ram_t*) opaque;
+    platform_t *plt = ram->plt;
+    uint32_t addr = ram->base + offset;
+
+    if (plt->dirty_pages != NULL && !plt->dirty_pages[addr >> PLATFORM_PAGE_SHIFT]) {
+        platform_mark_dirty(plt, addr, access_type + 1);
+    }
+    if (plt->code_pages[addr >> PLATFORM_PAGE_SHIFT]) {
+        // La page contient du code deja decode par le processeur : on le previent.
+        plt->code_write(plt->code_opaque, addr, access_type + 1); // access_type vaut taille - 1
     }
-    
-    if (addr < 0x80000000 || addr >= (0x80000000 + 0x2000000)) return -1; // On est hors champ
-    
-    uint32_t offset = addr - 0x80000000;
     switch (access_type) {
     case ACCESS_WORD :
-        if (addr % 4 != 0)
+        if (offset % 4 != 0)
             return -1;
-        plt->memory[offset/4] = data;
+        *(uint32_t*)(ram->host + offset) = data;
         break;
     case ACCESS_HALF :
-        if (addr % 2 != 0)
+        if (offset % 2 != 0)
             return -1;
-        *((uint16_t*)((uint8_t*)plt->memory + offset)) = (uint16_t)data;
+        *((uint16_t*)(ram->host + offset)) = (uint16_t)data;
         break;
     case ACCESS_BYTE :
-        *((uint8_t*)plt->memory + offset) = (uint8_t)data;
+        *(ram->host + offset) = (uint8_t)data;
         break;
     default:
         break;
@@ -88,11 +260,223 @@ int platform_write(platform_t *plt, access_type_t access_type, uint32_t addr, ui
 
 }
 
-void platform_load_program(platform_t *plt, const char *file_name) {
+int platform_read(platform_t *plt, access_type_t access_type, uint32_t addr, uint32_t *data) {
+    platform_device_t *dev = platform_find_device(plt, addr);
+    if (dev == NULL || addr - dev->base >= dev->size) return -1; // On est hors champ
+
+    if (dev->read(dev->opaque, access_type, addr - dev->base, data) != 0) {
+        return -1;
+    }
+    if (dev->ram != NULL) {
+        platform_tlb_fill(plt->tlb_read, dev, addr);
+    }
+    else {
+        plt->mmio_accesses++;
+    }
+    return 0;
+}
+
+int platform_write(platform_t *plt, access_type_t access_type, uint32_t addr, uint32_t data) {
+    platform_device_t *dev = platform_find_device(plt, addr);
+    if (dev == NULL || addr - dev->base >= dev->size) return -1; // On est hors champ
+
+    if (dev->write(dev->opaque, access_type, addr - dev->base, data) != 0) {
+        return -1;
+    }
+    if (dev->ram == NULL) {
+        plt->mmio_accesses++;
+    }
+    else if (!plt->code_pages[addr >> PLATFORM_PAGE_SHIFT]) {
+        platform_tlb_fill(plt->tlb_write, dev, addr);
+    }
+    return 0;
+}
+
+void platform_mark_dirty(platform_t *plt, uint32_t addr, uint32_t size) {
+    if (plt->dirty_pages == NULL || size == 0) {
+        return;
+    }
+    uint32_t last = (uint32_t) (((uint64_t) addr + size - 1) >> PLATFORM_PAGE_SHIFT);
+    for (uint32_t page = addr >> PLATFORM_PAGE_SHIFT; page <= last; page++) {
+        if (plt->dirty_pages[page]) {
+            continue;
+        }
+        if (plt->n_dirty == plt->dirty_capacity) {
+            plt->dirty_capacity = plt->dirty_capacity ? 2 * plt->dirty_capacity : 64;
+            plt->dirty_list = (uint32_t*) realloc(plt->dirty_list, plt->dirty_capacity * sizeof(uint32_t));
+        }
+        plt->dirty_pages[page] = 1;
+        plt->dirty_list[plt->n_dirty++] = page;
+    }
+}
+
+/**
+ * Ecriture directe d'un peripherique en RAM : marque les pages sales et
+ * previent code_write si l'une d'elles contient du code decode.
+ */
+void platform_host_written(platform_t *plt, uint32_t addr, uint32_t size) {
+    if (size == 0) {
+        return;
+    }
+    platform_mark_dirty(plt, addr, size);
+    if (plt->code_write == NULL) {
+        return;
+    }
+    uint32_t last = (uint32_t) (((uint64_t) addr + size - 1) >> PLATFORM_PAGE_SHIFT);
+    for (uint32_t page = addr >> PLATFORM_PAGE_SHIFT; page <= last; page++) {
+        if (plt->code_pages[page]) {
+            plt->code_write(plt->code_opaque, addr, size);
+            return;
+        }
+    }
+}
+
+/**
+ * Oublie les pages sales et vide le TLB d'ecriture : la premiere ecriture
+ * sur chaque page repasse par platform_write(), qui la marque.
+ */
+static void platform_dirty_reset(platform_t *plt, const platform_snapshot_t *base) {
+    for (uint32_t i = 0; i < plt->n_dirty; i++) {
+        plt->dirty_pages[plt->dirty_list[i]] = 0;
+    }
+    plt->n_dirty = 0;
+    plt->dirty_base = base;
+    for (int i = 0; i < PLATFORM_TLB_SIZE; i++) {
+        plt->tlb_write[i].page = PLATFORM_TLB_INVALID;
+    }
+}
+
+static int platform_page_is_zero(const uint8_t *page) {
+    const uint64_t *p = (const uint64_t*) page;
+    for (uint32_t i = 0; i < PLATFORM_PAGE_SIZE / 8; i++) {
+        if (p[i] != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Recopie une page de la sauvegarde dans la RAM et previent le processeur
+ * si elle contenait du code decode.
+ */
+static void platform_restore_page(platform_t *plt, const platform_ram_t *ram, const uint8_t *copy, uint32_t page) {
+    uint32_t offset = (page << PLATFORM_PAGE_SHIFT) - ram->base;
+    memcpy(ram->host + offset, copy + offset, PLATFORM_PAGE_SIZE);
+    if (plt->code_pages[page]) {
+        plt->code_write(plt->code_opaque, page << PLATFORM_PAGE_SHIFT, PLATFORM_PAGE_SIZE);
+    }
+}
+
+platform_snapshot_t* platform_snapshot(platform_t *plt) {
+    if (plt->dirty_pages == NULL) {
+        plt->dirty_pages = (uint8_t*) platform_reserve(PLATFORM_PAGES);
+        if (plt->dirty_pages == NULL) {
+            return NULL;
+        }
+    }
+
+    platform_snapshot_t *snap = (platform_snapshot_t*) malloc(sizeof(platform_snapshot_t));
+    snap->n_rams = plt->n_rams;
+    snap->irq_pending = plt->irq_pending;
+    snap->timer = NULL;
+    snap->dma = NULL;
+    if (plt->timer != NULL) {
+        snap->timer = (timer_device_t*) malloc(sizeof(timer_device_t));
+        *snap->timer = *plt->timer;
+    }
+    if (plt->dma != NULL) {
+        snap->dma = (dma_device_t*) malloc(sizeof(dma_device_t));
+        *snap->dma = *plt->dma;
+    }
+    for (int i = 0; i < plt->n_rams; i++) {
+        const platform_ram_t *ram = &plt->rams[i];
+        snap->copies[i] = (uint8_t*) platform_reserve(ram->size);
+        if (snap->copies[i] == NULL) {
+            snap->n_rams = i;
+            platform_snapshot_free(plt, snap);
+            return NULL;
+        }
+        // Les pages nulles (dont toutes celles jamais touchees) ne sont pas
+        // copiees : la copie reste alors une page non allouee.
+        for (uint32_t offset = 0; offset < ram->size; offset += PLATFORM_PAGE_SIZE) {
+            if (!platform_page_is_zero(ram->host + offset)) {
+                memcpy(snap->copies[i] + offset, ram->host + offset, PLATFORM_PAGE_SIZE);
+            }
+        }
+    }
+    platform_dirty_reset(plt, snap);
+    return snap;
+}
+
+void platform_restore(platform_t *plt, const platform_snapshot_t *snap) {
+    if (plt->dirty_base == snap) {
+        for (uint32_t i = 0; i < plt->n_dirty; i++) {
+            uint32_t page = plt->dirty_list[i];
+            platform_device_t *dev = platform_find_device(plt, page << PLATFORM_PAGE_SHIFT);
+            if (dev == NULL || dev->ram == NULL) {
+                continue; // Marquee par platform_mark_dirty() hors de la RAM
+            }
+            const platform_ram_t *ram = (const platform_ram_t*) dev->opaque;
+            platform_restore_page(plt, ram, snap->copies[ram - plt->rams], page);
+        }
+    }
+    else {
+        // Les pages sales sont relatives a une autre sauvegarde : on compare tout.
+        for (int i = 0; i < snap->n_rams; i++) {
+            const platform_ram_t *ram = &plt->rams[i];
+            for (uint32_t offset = 0; offset < ram->size; offset += PLATFORM_PAGE_SIZE) {
+                if (memcmp(ram->host + offset, snap->copies[i] + offset, PLATFORM_PAGE_SIZE) != 0) {
+                    platform_restore_page(plt, ram, snap->copies[i], (ram->base + offset) >> PLATFORM_PAGE_SHIFT);
+                }
+            }
+        }
+    }
+    platform_dirty_reset(plt, snap);
+
+    // Les evenements en attente appartiennent a l'etat abandonne : chaque
+    // peripherique reprogramme les siens depuis ses registres restaures.
+    sched_clear(plt->sched);
+    plt->irq_pending = snap->irq_pending;
+    if (plt->timer != NULL && snap->timer != NULL) {
+        timer_restore(plt->timer, snap->timer);
+    }
+    if (plt->dma != NULL && snap->dma != NULL) {
+        dma_restore(plt->dma, snap->dma);
+    }
+    platform_kick(plt);
+}
+
+int platform_snapshot_compare(platform_t *plt, const platform_snapshot_t *snap, uint32_t *addr) {
+    for (int i = 0; i < snap->n_rams; i++) {
+        const platform_ram_t *ram = &plt->rams[i];
+        for (uint32_t offset = 0; offset < ram->size; offset += PLATFORM_PAGE_SIZE) {
+            if (memcmp(ram->host + offset, snap->copies[i] + offset, PLATFORM_PAGE_SIZE) != 0) {
+                *addr = ram->base + offset;
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+void platform_snapshot_free(platform_t *plt, platform_snapshot_t *snap) {
+    for (int i = 0; i < snap->n_rams; i++) {
+        munmap(snap->copies[i], plt->rams[i].size);
+    }
+    free(snap->timer);
+    free(snap->dma);
+    if (plt->dirty_base == snap) {
+        plt->dirty_base = NULL;
+    }
+    free(snap);
+}
+
+int platform_load_program(platform_t *plt, const char *file_name) {
     FILE* program = fopen(file_name,"rb");
     if (program == NULL) {
         fprintf(stderr, "Erreur: Fichier programme non trouvé ou chemin incorrect: %s\n", file_name);
-        return;
+        return -1;
     }
 
     // Permet de connaitre la taille du fichier en se mettant a la fin puis en revenant au debut avant de lire.
@@ -100,23 +484,22 @@ void platform_load_program(platform_t *plt, const char *file_name) {
     long program_size = ftell(program);
     fseek(program, 0, SEEK_SET);
 
-    fread(plt->memory,1,program_size,program);
+    uint8_t *host = platform_host_ptr(plt, PLATFORM_RAM_BASE, (uint32_t) program_size);
+    if (host == NULL) {
+        fprintf(stderr, "Erreur: programme trop grand pour la RAM: %s\n", file_name);
+        fclose(program);
+        return -1;
+    }
+    size_t read_size = fread(host,1,program_size,program);
     fclose(program);
-}
-
 
-void platform_test() {
-    platform_t* platformTest = platform_new();
-    platform_load_program(platformTest,"/home/wizhack/Document/ensta/architectureordinateurs/embedded_software/test1/build/esw.bin");
-    uint32_t* dataTest = (uint32_t*) malloc(sizeof(uint32_t));
-    platform_read(platformTest,ACCESS_WORD,0x80000000,dataTest);
-    printf("Valeur du premier Word: %x\n",*dataTest);
-    if (*dataTest == 0x00000502) printf("Fichier chargé et lu correctement.\n");
-    else printf("Erreur de chargement ou de lecture\n");
-
-    platform_write(platformTest,ACCESS_WORD,0x80000004,0x10101010);
-    platform_read(platformTest,ACCESS_WORD,0x80000004,dataTest);
-    printf("Valeur du mot lu à l'addresse 0x80000004: %x\n",*dataTest);
-    if (*dataTest == 0x10101010) printf("Lecture effectué correctement.\n");
-    platform_free(platformTest);
-} 
\ No newline at end of file
+    platform_mark_dirty(plt, PLATFORM_RAM_BASE, (uint32_t) program_size);
+    if (plt->code_write != NULL) {
+        plt->code_write(plt->code_opaque, PLATFORM_RAM_BASE, (uint32_t) program_size);
+    }
+    if (read_size != (size_t) program_size) {
+        fprintf(stderr, "Erreur: lecture incomplete du programme: %s\n", file_name);
+        return -1;
+    }
+    return 0;
+}
@@ -3,9 +3,29 @@
 #include <inttypes.h>
 #include <stdio.h>
 
-typedef struct {
-    uint32_t *memory;
-} platform_t;
+#define PLATFORM_RAM_BASE  0x80000000 // Region de RAM creee par platform_new()
+#define PLATFORM_RAM_SIZE  0x2000000
+#define PLATFORM_PAGE_SHIFT 12 // Pages de 4 Ko
+#define PLATFORM_PAGE_SIZE (1u << PLATFORM_PAGE_SHIFT)
+#define PLATFORM_PAGES     (1u << (32 - PLATFORM_PAGE_SHIFT)) // Pages de l'espace d'adressage 32 bits
+
+/**
+ * Called when the guest (or the loader) writes to a RAM page flagged in
+ * `code_pages`, so that the core can drop what it decoded from it.
+ */
+typedef void (*platform_code_write_t)(void *opaque, uint32_t addr, uint32_t size);
+
+/**
+ * Virtual time of the core connected to the platform: instructions retired
+ * plus the time skipped while waiting for an interrupt (WFI).
+ */
+typedef uint64_t (*platform_clock_t)(void *opaque);
+
+/**
+ * Called by devices when an interrupt line or their next deadline changes,
+ * so that the core re-examines them before its next instruction.
+ */
+typedef void (*platform_kick_t)(void *opaque);
 
 /**
  * Type of memory acess
@@ -16,6 +36,104 @@ typedef enum {
     ACCESS_WORD = 3  // 32 bits
 } access_type_t;
 
+/**
+ * Callbacks of a memory-mapped device. `offset` is relative to the base
+ * address of the device.
+ * @return 0 on success, -1 on error (illegal or misaligned access)
+ */
+typedef int (*platform_device_read_t)(void *opaque, access_type_t access_type, uint32_t offset, uint32_t *data);
+typedef int (*platform_device_write_t)(void *opaque, access_type_t access_type, uint32_t offset, uint32_t data);
+
+/**
+ * Peripherique (ou zone de RAM) branche sur le bus.
+ */
+typedef struct {
+    const char *name;
+    uint32_t base;                 // Adresse de base, alignee sur une page
+    uint32_t size;                 // Taille en octets
+    platform_device_read_t  read;
+    platform_device_write_t write;
+    void     *opaque;              // Argument donne aux callbacks
+    uint8_t  *ram;                 // Memoire hote si le peripherique est de la RAM (accessible via le TLB), NULL sinon
+} platform_device_t;
+
+#define PLATFORM_MAX_DEVICES 16
+// Table du bus a deux niveaux : 1024 zones de 4 Mo, puis 1024 pages de 4 Ko.
+#define PLATFORM_BUS_L1_SHIFT 22
+#define PLATFORM_BUS_L2_SIZE  (1u << (PLATFORM_BUS_L1_SHIFT - PLATFORM_PAGE_SHIFT))
+
+#define PLATFORM_TLB_SIZE    64         // Entrees par TLB (puissance de 2)
+#define PLATFORM_TLB_INVALID 0xFFFFFFFF // Ne correspond a aucune adresse de page
+
+/**
+ * Entree de TLB logiciel : une page guest et l'adresse hote de son debut.
+ */
+typedef struct {
+    uint32_t page; // Adresse guest de la page, PLATFORM_TLB_INVALID si l'entree est vide
+    uint8_t  *host;
+} platform_tlb_entry_t;
+
+#define PLATFORM_MAX_RAMS 8
+
+struct platform;
+struct console;
+struct timer;
+struct dma;
+struct sched;
+struct sched_event;
+
+/**
+ * Region de RAM. La zone hote est reservee avec MAP_NORESERVE : le noyau
+ * n'alloue une page qu'au premier acces, une region jamais touchee ne coute
+ * rien en memoire residente.
+ */
+typedef struct {
+    struct platform *plt;
+    uint8_t  *host;
+    uint32_t base;
+    uint32_t size;
+} platform_ram_t;
+
+/**
+ * Etat pris par platform_snapshot() : une copie de chaque region de RAM,
+ * dont seules les pages non nulles occupent de la memoire, et l'etat des
+ * peripheriques.
+ */
+typedef struct {
+    uint8_t *copies[PLATFORM_MAX_RAMS];
+    int n_rams;
+    uint32_t irq_pending;
+    struct timer *timer; // Copie du timer (registres et evenement), NULL si la plateforme n'en a pas
+    struct dma *dma;     // Copie du DMA (registres et transfert en cours), NULL si la plateforme n'en a pas
+} platform_snapshot_t;
+
+typedef struct platform {
+    platform_ram_t rams[PLATFORM_MAX_RAMS]; // RAM regions, also registered as devices
+    int n_rams;
+    uint8_t  *code_pages;              // One flag per guest page (PLATFORM_PAGES): 1 if the core cached code from it
+    uint8_t  *dirty_pages;             // One flag per guest page written since dirty_base was taken or restored (NULL: no tracking)
+    uint32_t *dirty_list;              // Pages flagged in dirty_pages
+    uint32_t n_dirty;
+    uint32_t dirty_capacity;
+    const platform_snapshot_t *dirty_base; // Snapshot the dirty pages are relative to
+    platform_code_write_t code_write;  // Invalidation callback for flagged pages
+    void     *code_opaque;             // Argument given to code_write
+    platform_tlb_entry_t tlb_read[PLATFORM_TLB_SIZE];  // RAM pages readable without platform_read()
+    platform_tlb_entry_t tlb_write[PLATFORM_TLB_SIZE]; // RAM pages writable without platform_write() (never code pages)
+    platform_device_t devices[PLATFORM_MAX_DEVICES];    // Devices registered on the bus
+    int n_devices;
+    struct console *console;           // Console mapped at CONSOLE_BASE (see console.h), NULL if none
+    struct timer *timer;               // Timer mapped at TIMER_BASE (see timer.h), NULL if none
+    struct dma *dma;                   // DMA controller mapped at DMA_BASE (see dma.h), NULL if none
+    struct sched *sched;               // Event queue of the devices, keyed by virtual time (see sched.h)
+    uint32_t irq_pending;              // Interrupt lines raised by the devices (bit n: line n), level-triggered
+    platform_clock_t clock;            // Virtual time source (NULL: time stands still at 0)
+    platform_kick_t kick;              // Interrupt/deadline change callback (NULL if no core)
+    void     *core_opaque;             // Argument given to clock and kick
+    uint64_t mmio_accesses;            // Successful platform_read()/platform_write() calls on devices other than RAM
+    platform_device_t **bus[1u << (32 - PLATFORM_BUS_L1_SHIFT)]; // Device mapped on each page, allocated per 4 MB zone
+} platform_t;
+
 /** 
  * Allocates an initializes a new platform and its memory.
  */
@@ -26,6 +144,45 @@ platform_t* platform_new();
  */
 void platform_free(platform_t *platform);
 
+/**
+ * Map a device on the bus at [base, base + size[. `base` must be page
+ * aligned; the range is rounded up to whole pages and must not overlap
+ * another device.
+ * @param ram Host memory backing the range if the device is plain RAM
+ *            (its pages then go through the TLB), NULL otherwise.
+ * @return    The registered device, or NULL on error.
+ */
+platform_device_t* platform_add_device(platform_t *plt, const char *name, uint32_t base, uint32_t size,
+                                       platform_device_read_t read, platform_device_write_t write,
+                                       void *opaque, uint8_t *ram);
+
+/**
+ * Add a RAM region of `size` bytes (rounded up to whole pages) at `base`,
+ * which must be page aligned. Host pages are only allocated when first touched.
+ * @return The registered device, or NULL on error.
+ */
+platform_device_t* platform_add_ram(platform_t *plt, uint32_t base, uint32_t size);
+
+/**
+ * Device mapped at addr, or NULL. Constant time: two table lookups.
+ */
+static inline platform_device_t* platform_find_device(platform_t *plt, uint32_t addr) {
+    platform_device_t **pages = plt->bus[addr >> PLATFORM_BUS_L1_SHIFT];
+    return pages != NULL ? pages[(addr >> PLATFORM_PAGE_SHIFT) & (PLATFORM_BUS_L2_SIZE - 1)] : NULL;
+}
+
+/**
+ * Host address of [addr, addr + size[ if the whole range lies in one RAM
+ * region, NULL otherwise.
+ */
+static inline uint8_t* platform_host_ptr(platform_t *plt, uint32_t addr, uint32_t size) {
+    platform_device_t *dev = platform_find_device(plt, addr);
+    if (dev == NULL || dev->ram == NULL || (uint64_t) (addr - dev->base) + size > dev->size) {
+        return NULL;
+    }
+    return dev->ram + (addr - dev->base);
+}
+
 /**
  * Read one item from the platform.
  * @param platform The platform object
@@ -47,13 +204,146 @@ int platform_read(platform_t *plt, access_type_t access_type, uint32_t addr, uin
 int platform_write(platform_t *plt, access_type_t access_type, uint32_t addr, uint32_t data);
 
 /**
- * Read the file named file_name and write its content
- * in the platform's memory.
+ * Read one item, through the TLB when the page is already mapped.
+ * Same contract as platform_read(), which handles the misses (MMIO,
+ * unmapped or misaligned addresses) and fills the TLB.
+ */
+static inline int platform_read_fast(platform_t *plt, access_type_t access_type, uint32_t addr, uint32_t *data) {
+    const platform_tlb_entry_t *entry = &plt->tlb_read[(addr >> PLATFORM_PAGE_SHIFT) & (PLATFORM_TLB_SIZE - 1)];
+    // access_type vaut taille - 1 : une adresse mal alignee ne correspond a aucune page.
+    if (entry->page == (addr & (~(PLATFORM_PAGE_SIZE - 1) | access_type))) {
+        const uint8_t *host = entry->host + (addr & (PLATFORM_PAGE_SIZE - 1));
+        switch (access_type) {
+        case ACCESS_WORD :
+            *data = *(const uint32_t*) host;
+            break;
+        case ACCESS_HALF :
+            *data = (uint32_t) *(const int16_t*) host;
+            break;
+        default :
+            *data = (uint32_t) *(const int8_t*) host;
+            break;
+        }
+        return 0;
+    }
+    return platform_read(plt, access_type, addr, data);
+}
+
+/**
+ * Write one item, through the TLB when the page is already mapped.
+ * Same contract as platform_write(), which handles the misses.
+ */
+static inline int platform_write_fast(platform_t *plt, access_type_t access_type, uint32_t addr, uint32_t data) {
+    const platform_tlb_entry_t *entry = &plt->tlb_write[(addr >> PLATFORM_PAGE_SHIFT) & (PLATFORM_TLB_SIZE - 1)];
+    if (entry->page == (addr & (~(PLATFORM_PAGE_SIZE - 1) | access_type))) {
+        uint8_t *host = entry->host + (addr & (PLATFORM_PAGE_SIZE - 1));
+        switch (access_type) {
+        case ACCESS_WORD :
+            *(uint32_t*) host = data;
+            break;
+        case ACCESS_HALF :
+            *(uint16_t*) host = (uint16_t) data;
+            break;
+        default :
+            *host = (uint8_t) data;
+            break;
+        }
+        return 0;
+    }
+    return platform_write(plt, access_type, addr, data);
+}
+
+/**
+ * Current virtual time of the core (see platform_clock_t), 0 without core.
+ */
+uint64_t platform_time(platform_t *plt);
+
+/**
+ * Raise (level != 0) or lower the interrupt line `line` (0 to 31). The core
+ * is kicked when the line changes.
+ */
+void platform_set_irq(platform_t *plt, int line, int level);
+
+/**
+ * Queue a device's event at virtual time `time` (or move it there) on the
+ * platform's scheduler. The core is kicked if the event becomes the
+ * earliest one.
+ */
+void platform_schedule(platform_t *plt, struct sched_event *event, uint64_t time);
+
+/**
+ * Remove a device's event from the platform's scheduler, if it is queued.
+ */
+void platform_cancel(platform_t *plt, struct sched_event *event);
+
+/**
+ * Ask the core to re-examine the interrupt lines and the devices' deadlines
+ * before its next instruction.
+ */
+void platform_kick(platform_t *plt);
+
+/**
+ * Empty both TLBs.
  */
-void platform_load_program(platform_t *plt, const char *file_name);
+void platform_tlb_flush(platform_t *plt);
 
 /**
- * Lance un test pour voir le bon fonctionnement de platform.c
+ * Flag a RAM page (guest address >> PLATFORM_PAGE_SHIFT) as holding code cached
+ * by the core: its writes then go through platform_write(), which calls code_write.
+ */
+void platform_set_code_page(platform_t *plt, uint32_t page);
+
+/**
+ * Record that the host wrote [addr, addr + size[ behind the platform's back
+ * (loaders, devices writing RAM directly). Guest writes are tracked by
+ * platform_write() itself.
+ */
+void platform_mark_dirty(platform_t *plt, uint32_t addr, uint32_t size);
+
+/**
+ * Record that a device wrote [addr, addr + size[ of RAM directly through
+ * its host pointer: the pages are marked dirty and the core is told (via
+ * code_write) if some of them hold code it cached.
+ */
+void platform_host_written(platform_t *plt, uint32_t addr, uint32_t size);
+
+/**
+ * Copy the content of every RAM region and the state of the devices
+ * (registers, pending interrupt lines, queued events). From then on, the
+ * platform tracks the pages written so that platform_restore() only copies
+ * those back.
+ * @return The snapshot, or NULL if memory cannot be reserved for it.
+ */
+platform_snapshot_t* platform_snapshot(platform_t *plt);
+
+/**
+ * Put the RAM and the devices back in the state saved by snap. Only the
+ * pages dirtied since snap was taken (or last restored) are copied, unless
+ * another snapshot was taken or restored in between, in which case every
+ * page that differs is. Pages holding decoded code are reported through
+ * code_write. Every queued event is cancelled, then the devices queue
+ * theirs again: the core's clock (see platform_time()) must already be back
+ * to the instant snap was taken. The RAM regions must be the same as when
+ * snap was taken.
+ */
+void platform_restore(platform_t *plt, const platform_snapshot_t *snap);
+
+/**
+ * Compare the RAM with the image saved by snap.
+ * @return 0 if every RAM region holds what it held when snap was taken,
+ *         -1 otherwise, with *addr the address of the first page that differs.
+ */
+int platform_snapshot_compare(platform_t *plt, const platform_snapshot_t *snap, uint32_t *addr);
+
+/**
+ * Free a snapshot taken on plt.
+ */
+void platform_snapshot_free(platform_t *plt, platform_snapshot_t *snap);
+
+/**
+ * Read the file named file_name and write its content
+ * in the platform's memory.
+ * @return 0 on success, -1 on error (message printed on stderr)
  */
-void platform_test();
+int platform_load_program(platform_t *plt, const char *file_name);
 #endif
\ No newline at end of file
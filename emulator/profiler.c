@@ -0,0 +1,395 @@
+#define _GNU_SOURCE // gettid()
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "profiler.h"
+#include "minirisc.h"
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+// Le timer vise le thread d'emulation : son gestionnaire y retrouve le profileur.
+static __thread profiler_t *profiler_current;
+
+profiler_t* profiler_new(struct minirisc *mr, const char *elf_file) {
+    profiler_t *p = (profiler_t*) calloc(1, sizeof(profiler_t));
+    p->mr = mr;
+    if (elf_file != NULL) {
+        p->n_symbols = elf_loader_symbols(elf_file, &p->symbols);
+        if (p->n_symbols < 0) {
+            free(p);
+            return NULL;
+        }
+    }
+    // Comme le cache d'instructions : seuls les noeuds crees occupent de la memoire.
+    p->nodes = (profiler_node_t*) mmap(NULL, PROFILER_MAX_NODES * sizeof(profiler_node_t), PROT_READ | PROT_WRITE,
+                                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p->nodes == MAP_FAILED) {
+        fprintf(stderr, "Erreur: memoire insuffisante pour le profileur\n");
+        elf_loader_free_symbols(p->symbols, p->n_symbols);
+        free(p);
+        return NULL;
+    }
+    return p;
+}
+
+void profiler_free(profiler_t *p) {
+    munmap(p->nodes, PROFILER_MAX_NODES * sizeof(profiler_node_t));
+    elf_loader_free_symbols(p->symbols, p->n_symbols);
+    free(p);
+}
+
+/**
+ * Debut du symbole contenant addr, addr lui-meme s'il n'y en a pas.
+ */
+static uint32_t profiler_symbol(const profiler_t *p, uint32_t addr) {
+    const elf_symbol_t *sym = elf_loader_find_symbol(p->symbols, p->n_symbols, addr);
+    return sym != NULL ? sym->addr : addr;
+}
+
+/**
+ * Fils de parent pour key, cree au besoin. Le fils trouve passe en tete de
+ * liste : les appels repetes depuis une boucle le retrouvent aussitot.
+ * Arbre plein : renvoie parent, l'appel est confondu avec l'appelant.
+ */
+static uint32_t profiler_child(profiler_t *p, uint32_t parent, uint32_t key) {
+    profiler_node_t *nodes = p->nodes;
+    uint32_t prev = 0;
+    for (uint32_t i = nodes[parent].child; i != 0; prev = i, i = nodes[i].sibling) {
+        if (nodes[i].key == key) {
+            if (prev != 0) {
+                nodes[prev].sibling = nodes[i].sibling;
+                nodes[i].sibling = nodes[parent].child;
+                nodes[parent].child = i;
+            }
+            return i;
+        }
+    }
+    if (p->n_nodes == PROFILER_MAX_NODES) {
+        return parent;
+    }
+    uint32_t i = p->n_nodes++;
+    nodes[i].key = key;
+    nodes[i].symbol = profiler_symbol(p, key);
+    nodes[i].parent = parent;
+    nodes[i].child = 0;
+    nodes[i].sibling = nodes[parent].child;
+    nodes[i].samples = 0;
+    nodes[parent].child = i;
+    return i;
+}
+
+/**
+ * Compte un echantillon pris a PC avec node au sommet de la pile d'appels.
+ */
+static void profiler_record(profiler_t *p, uint32_t PC, uint32_t node) {
+    uint32_t leaf = profiler_symbol(p, PC);
+    if (p->nodes[node].symbol != leaf) {
+        node = profiler_child(p, node, leaf);
+    }
+    p->nodes[node].samples++;
+    p->samples++;
+}
+
+static void profiler_signal(int sig, siginfo_t *info, void *context) {
+    (void) sig;
+    (void) info;
+    (void) context;
+    profiler_t *p = profiler_current;
+    if (p == NULL) {
+        return;
+    }
+    uint32_t depth = p->depth;
+    uint32_t node = depth > 0 ? p->frames[depth - 1] : 0;
+    if (!p->busy) {
+        profiler_record(p, p->mr->PC, node);
+    }
+    else if (p->n_pending < PROFILER_PENDING) {
+        // Arbre en cours de modification : l'echantillon sera compte a la fin de l'appel
+        p->pending[p->n_pending].PC = p->mr->PC;
+        p->pending[p->n_pending].node = node;
+        __atomic_signal_fence(__ATOMIC_SEQ_CST);
+        p->n_pending++;
+    }
+    else {
+        p->lost++;
+    }
+}
+
+static void profiler_lock(profiler_t *p) {
+    p->busy = 1;
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+}
+
+/**
+ * Compte les echantillons mis en attente pendant la modification, puis
+ * rend l'arbre au gestionnaire de signal.
+ */
+static void profiler_unlock(profiler_t *p) {
+    uint32_t n;
+    while ((n = __atomic_load_n(&p->n_pending, __ATOMIC_RELAXED)) > 0) {
+        profiler_sample_t sample = p->pending[n - 1];
+        // Echoue si le gestionnaire a ajoute un echantillon entre-temps
+        if (__atomic_compare_exchange_n(&p->n_pending, &n, n - 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            profiler_record(p, sample.PC, sample.node);
+        }
+    }
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    p->busy = 0;
+}
+
+int profiler_start(profiler_t *p, uint32_t period_us) {
+    struct sigaction action;
+    struct sigevent event;
+    struct itimerspec spec;
+
+    if (p->n_nodes == 0) {
+        p->nodes[0].key = p->mr->PC;
+        p->nodes[0].symbol = profiler_symbol(p, p->mr->PC);
+        p->n_nodes = 1;
+    }
+    p->depth = 0;
+    p->extra = 0;
+    p->period_us = period_us;
+    profiler_current = p;
+
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = profiler_signal;
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, &p->old_action) != 0) {
+        profiler_current = NULL;
+        return -1;
+    }
+
+    memset(&event, 0, sizeof(event));
+    event.sigev_notify = SIGEV_THREAD_ID;
+    event.sigev_signo = SIGPROF;
+    event.sigev_notify_thread_id = gettid();
+    if (timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &p->timer) != 0) {
+        sigaction(SIGPROF, &p->old_action, NULL);
+        profiler_current = NULL;
+        return -1;
+    }
+    spec.it_interval.tv_sec = period_us / 1000000;
+    spec.it_interval.tv_nsec = (period_us % 1000000) * 1000;
+    spec.it_value = spec.it_interval;
+    timer_settime(p->timer, 0, &spec, NULL);
+    p->running = 1;
+    return 0;
+}
+
+void profiler_stop(profiler_t *p) {
+    if (!p->running) {
+        return;
+    }
+    timer_delete(p->timer);
+    sigaction(SIGPROF, &p->old_action, NULL);
+    profiler_current = NULL;
+    p->running = 0;
+    profiler_lock(p);
+    profiler_unlock(p);
+}
+
+void profiler_call(profiler_t *p, uint32_t target, uint32_t return_addr) {
+    uint32_t depth = p->depth;
+    if (depth == PROFILER_MAX_DEPTH) {
+        p->extra++;
+        p->overflows++;
+        return;
+    }
+    profiler_lock(p);
+    p->frames[depth] = profiler_child(p, depth > 0 ? p->frames[depth - 1] : 0, target);
+    p->returns[depth] = return_addr;
+    __atomic_signal_fence(__ATOMIC_SEQ_CST); // Le gestionnaire ne doit voir la profondeur qu'une fois le noeud en place
+    p->depth = depth + 1;
+    profiler_unlock(p);
+}
+
+void profiler_return(profiler_t *p, uint32_t target) {
+    if (p->extra > 0) {
+        p->extra--;
+        return;
+    }
+    for (uint32_t i = p->depth; i > 0; i--) {
+        if (p->returns[i - 1] == target) {
+            p->depth = i - 1;
+            break;
+        }
+    }
+    if (p->n_pending > 0) {
+        profiler_lock(p);
+        profiler_unlock(p);
+    }
+}
+
+/**
+ * Nom du symbole commencant a addr, ou l'adresse en hexadecimal.
+ */
+static const char* profiler_name(const profiler_t *p, uint32_t addr, char *buf, size_t size) {
+    const elf_symbol_t *sym = elf_loader_find_symbol(p->symbols, p->n_symbols, addr);
+    if (sym != NULL && sym->addr == addr) {
+        return sym->name;
+    }
+    snprintf(buf, size, "0x%08x", addr);
+    return buf;
+}
+
+typedef struct {
+    uint32_t symbol;
+    uint64_t self;  // Echantillons dans le symbole
+    uint64_t total; // Echantillons avec le symbole sur la pile
+} profiler_entry_t;
+
+static int profiler_entry_by_symbol(const void *a, const void *b) {
+    const profiler_entry_t *x = (const profiler_entry_t*) a;
+    const profiler_entry_t *y = (const profiler_entry_t*) b;
+    return x->symbol < y->symbol ? -1 : x->symbol > y->symbol;
+}
+
+static int profiler_entry_by_count(const void *a, const void *b) {
+    const profiler_entry_t *x = (const profiler_entry_t*) a;
+    const profiler_entry_t *y = (const profiler_entry_t*) b;
+    if (x->self != y->self) {
+        return x->self < y->self ? 1 : -1;
+    }
+    if (x->total != y->total) {
+        return x->total < y->total ? 1 : -1;
+    }
+    return profiler_entry_by_symbol(a, b);
+}
+
+void profiler_report(const profiler_t *p, FILE *out) {
+    const profiler_node_t *nodes = p->nodes;
+    profiler_entry_t *entries = (profiler_entry_t*) calloc(p->n_nodes + 1, sizeof(profiler_entry_t));
+    uint32_t n = 0;
+    char buf[16];
+
+    // Un symbole par entree
+    for (uint32_t i = 0; i < p->n_nodes; i++) {
+        entries[i].symbol = nodes[i].symbol;
+    }
+    qsort(entries, p->n_nodes, sizeof(profiler_entry_t), profiler_entry_by_symbol);
+    for (uint32_t i = 0; i < p->n_nodes; i++) {
+        if (n == 0 || entries[n - 1].symbol != entries[i].symbol) {
+            entries[n++] = entries[i];
+        }
+    }
+
+    uint32_t *seen = (uint32_t*) malloc((p->n_nodes + 1) * sizeof(uint32_t));
+    for (uint32_t i = 0; i < p->n_nodes; i++) {
+        if (nodes[i].samples == 0) {
+            continue;
+        }
+        profiler_entry_t key = { nodes[i].symbol, 0, 0 };
+        profiler_entry_t *self = (profiler_entry_t*) bsearch(&key, entries, n, sizeof(profiler_entry_t), profiler_entry_by_symbol);
+        self->self += nodes[i].samples;
+
+        // Total : une fois par symbole sur le chemin, meme en cas de recursion
+        uint32_t n_seen = 0;
+        for (uint32_t j = i;; j = nodes[j].parent) {
+            key.symbol = nodes[j].symbol;
+            profiler_entry_t *entry = (profiler_entry_t*) bsearch(&key, entries, n, sizeof(profiler_entry_t), profiler_entry_by_symbol);
+            uint32_t index = (uint32_t) (entry - entries);
+            uint32_t k = 0;
+            while (k < n_seen && seen[k] != index) {
+                k++;
+            }
+            if (k == n_seen) {
+                seen[n_seen++] = index;
+                entry->total += nodes[i].samples;
+            }
+            if (j == 0) {
+                break;
+            }
+        }
+    }
+    free(seen);
+    qsort(entries, n, sizeof(profiler_entry_t), profiler_entry_by_count);
+
+    fprintf(out, "Profil : %" PRIu64 " echantillons (periode %u us)", p->samples, p->period_us);
+    if (p->lost > 0) {
+        fprintf(out, ", %" PRIu64 " perdus", p->lost);
+    }
+    if (p->overflows > 0) {
+        fprintf(out, ", %" PRIu64 " appels au-dela de %d niveaux", p->overflows, PROFILER_MAX_DEPTH);
+    }
+    if (p->n_nodes == PROFILER_MAX_NODES) {
+        fprintf(out, ", arbre d'appels plein");
+    }
+    fprintf(out, "\n  %%self  %%total  echantillons  symbole\n");
+    for (uint32_t i = 0; i < n && entries[i].total > 0; i++) {
+        fprintf(out, "%6.2f  %6.2f  %12" PRIu64 "  %s\n",
+                p->samples ? 100.0 * entries[i].self / p->samples : 0.0,
+                p->samples ? 100.0 * entries[i].total / p->samples : 0.0,
+                entries[i].self, profiler_name(p, entries[i].symbol, buf, sizeof(buf)));
+    }
+    free(entries);
+}
+
+typedef struct {
+    char *stack;
+    uint64_t count;
+} profiler_folded_t;
+
+static int profiler_folded_compare(const void *a, const void *b) {
+    return strcmp(((const profiler_folded_t*) a)->stack, ((const profiler_folded_t*) b)->stack);
+}
+
+void profiler_write_folded(const profiler_t *p, FILE *out) {
+    const profiler_node_t *nodes = p->nodes;
+    profiler_folded_t *lines = (profiler_folded_t*) malloc((p->n_nodes + 1) * sizeof(profiler_folded_t));
+    uint32_t *path = (uint32_t*) malloc((p->n_nodes + 1) * sizeof(uint32_t));
+    uint32_t n = 0;
+    char buf[16];
+
+    for (uint32_t i = 0; i < p->n_nodes; i++) {
+        if (nodes[i].samples == 0) {
+            continue;
+        }
+        uint32_t depth = 0;
+        for (uint32_t j = i;; j = nodes[j].parent) {
+            path[depth++] = j;
+            if (j == 0) {
+                break;
+            }
+        }
+
+        size_t length = 0;
+        for (uint32_t k = 0; k < depth; k++) {
+            length += strlen(profiler_name(p, nodes[path[k]].symbol, buf, sizeof(buf))) + 1;
+        }
+        char *stack = (char*) malloc(length);
+        char *s = stack;
+        for (uint32_t k = depth; k > 0; k--) {
+            const char *name = profiler_name(p, nodes[path[k - 1]].symbol, buf, sizeof(buf));
+            size_t size = strlen(name);
+            memcpy(s, name, size);
+            s += size;
+            *s++ = k > 1 ? ';' : '\0';
+        }
+        lines[n].stack = stack;
+        lines[n].count = nodes[i].samples;
+        n++;
+    }
+    free(path);
+
+    // Deux chemins peuvent s'ecrire pareil (cibles d'appel dans un meme symbole) : on les fusionne.
+    qsort(lines, n, sizeof(profiler_folded_t), profiler_folded_compare);
+    for (uint32_t i = 0; i < n;) {
+        uint64_t count = 0;
+        uint32_t j = i;
+        while (j < n && strcmp(lines[j].stack, lines[i].stack) == 0) {
+            count += lines[j].count;
+            j++;
+        }
+        fprintf(out, "%s %" PRIu64 "\n", lines[i].stack, count);
+        for (; i < j; i++) {
+            free(lines[i].stack);
+        }
+    }
+    free(lines);
+}
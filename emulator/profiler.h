@@ -0,0 +1,113 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <time.h>
+#include "elf_loader.h"
+
+/*
+ * Profileur par echantillonnage du code guest : un timer sur le temps CPU
+ * du thread d'emulation interrompt l'execution a intervalle regulier et le
+ * gestionnaire de signal note la fonction en cours et la pile d'appels.
+ *
+ * La pile d'appels est deduite des sauts : JAL/JALR avec rd = ra est un
+ * appel, JALR x0, 0(ra) un retour. Les moteurs n'appellent le profileur que
+ * sur ces sauts, le reste de l'execution n'est pas ralenti.
+ */
+
+#define PROFILER_MAX_DEPTH 256      // Appels imbriques suivis au-dela : ignores
+#define PROFILER_MAX_NODES (1 << 20) // Noeuds de l'arbre d'appels (reserve, alloue a l'usage)
+#define PROFILER_PENDING 1024       // Echantillons pris pendant la mise a jour de la pile
+
+struct minirisc;
+
+/**
+ * Call tree node: one per distinct call path. The samples taken while the
+ * innermost symbol was `symbol` on this path are counted in `samples`.
+ */
+typedef struct {
+    uint32_t key;     // Cible de l'appel (ou debut du symbole pour une feuille)
+    uint32_t symbol;  // Debut du symbole contenant key (key sans symbole)
+    uint32_t parent;
+    uint32_t child;   // Premier fils, 0 si aucun (0 est la racine)
+    uint32_t sibling;
+    uint64_t samples;
+} profiler_node_t;
+
+typedef struct {
+    uint32_t PC;
+    uint32_t node;
+} profiler_sample_t;
+
+typedef struct profiler {
+    struct minirisc *mr;
+    elf_symbol_t *symbols;      // Symboles du programme, tries par adresse
+    int n_symbols;
+    profiler_node_t *nodes;     // PROFILER_MAX_NODES reserves, la racine est nodes[0]
+    uint32_t n_nodes;
+    uint32_t frames[PROFILER_MAX_DEPTH];  // Noeud de chaque appel en cours
+    uint32_t returns[PROFILER_MAX_DEPTH]; // Adresse de retour de chaque appel en cours
+    uint32_t depth;
+    uint32_t extra;             // Appels en cours au-dela de PROFILER_MAX_DEPTH
+    int busy;                   // Pile ou arbre en cours de modification hors du gestionnaire
+    profiler_sample_t pending[PROFILER_PENDING];
+    uint32_t n_pending;
+    uint64_t samples;           // Echantillons comptes
+    uint64_t lost;              // Echantillons perdus (attente pleine, arbre plein)
+    uint64_t overflows;         // Appels au-dela de PROFILER_MAX_DEPTH
+    uint32_t period_us;
+    timer_t timer;
+    int running;
+    struct sigaction old_action;
+} profiler_t;
+
+/**
+ * Create a profiler for mr. Symbols are read from elf_file when it is not
+ * NULL; without them samples are reported by address.
+ * @return The profiler, or NULL on error (message printed on stderr).
+ */
+profiler_t* profiler_new(struct minirisc *mr, const char *elf_file);
+
+/**
+ * Free the profiler. It must be stopped.
+ */
+void profiler_free(profiler_t *p);
+
+/**
+ * Start sampling every period_us microseconds of CPU time of the calling
+ * thread, which must be the one running mr. The call stack starts empty,
+ * rooted at the symbol of mr->PC.
+ * @return 0 on success, -1 if the timer cannot be created.
+ */
+int profiler_start(profiler_t *p, uint32_t period_us);
+
+/**
+ * Stop sampling.
+ */
+void profiler_stop(profiler_t *p);
+
+/**
+ * Record a call to target, returning to return_addr.
+ */
+void profiler_call(profiler_t *p, uint32_t target, uint32_t return_addr);
+
+/**
+ * Record a return to target: the innermost call returning there is popped,
+ * with the calls it left unterminated (tail calls, longjmp...). A return
+ * matching no call is ignored.
+ */
+void profiler_return(profiler_t *p, uint32_t target);
+
+/**
+ * Print the flat profile: samples per symbol, where execution was (self)
+ * and on the call stack (total).
+ */
+void profiler_report(const profiler_t *p, FILE *out);
+
+/**
+ * Write the samples as folded stacks ("_start;main;fibo 42" per line), the
+ * input format of flamegraph.pl and similar tools.
+ */
+void profiler_write_folded(const profiler_t *p, FILE *out);
+#endif
@@ -0,0 +1,113 @@
+#include <stdlib.h>
+
+#include "sched.h"
+
+sched_t* sched_new(void) {
+    sched_t *sched = (sched_t*) malloc(sizeof(sched_t));
+    sched->heap = NULL;
+    sched->n_events = 0;
+    sched->capacity = 0;
+    return sched;
+}
+
+void sched_free(sched_t *sched) {
+    free(sched->heap);
+    free(sched);
+}
+
+void sched_event_init(sched_event_t *event, sched_callback_t callback, void *opaque) {
+    event->time = SCHED_NEVER;
+    event->callback = callback;
+    event->opaque = opaque;
+    event->index = -1;
+}
+
+static void sched_place(sched_t *sched, sched_event_t *event, uint32_t i) {
+    sched->heap[i] = event;
+    event->index = (int32_t) i;
+}
+
+/**
+ * Remonte l'evenement en position i tant qu'il est plus proche que son parent.
+ */
+static void sched_sift_up(sched_t *sched, uint32_t i) {
+    sched_event_t *event = sched->heap[i];
+    while (i > 0 && sched->heap[(i - 1) / 2]->time > event->time) {
+        sched_place(sched, sched->heap[(i - 1) / 2], i);
+        i = (i - 1) / 2;
+    }
+    sched_place(sched, event, i);
+}
+
+/**
+ * Descend l'evenement en position i tant qu'un de ses fils est plus proche.
+ */
+static void sched_sift_down(sched_t *sched, uint32_t i) {
+    sched_event_t *event = sched->heap[i];
+    for (;;) {
+        uint32_t child = 2 * i + 1;
+        if (child >= sched->n_events) {
+            break;
+        }
+        if (child + 1 < sched->n_events && sched->heap[child + 1]->time < sched->heap[child]->time) {
+            child++;
+        }
+        if (sched->heap[child]->time >= event->time) {
+            break;
+        }
+        sched_place(sched, sched->heap[child], i);
+        i = child;
+    }
+    sched_place(sched, event, i);
+}
+
+void sched_add(sched_t *sched, sched_event_t *event, uint64_t time) {
+    if (event->index >= 0) {
+        uint64_t old = event->time;
+        event->time = time;
+        if (time < old) {
+            sched_sift_up(sched, (uint32_t) event->index);
+        }
+        else {
+            sched_sift_down(sched, (uint32_t) event->index);
+        }
+        return;
+    }
+    if (sched->n_events == sched->capacity) {
+        sched->capacity = sched->capacity ? 2 * sched->capacity : 16;
+        sched->heap = (sched_event_t**) realloc(sched->heap, sched->capacity * sizeof(sched_event_t*));
+    }
+    event->time = time;
+    sched->heap[sched->n_events] = event;
+    sched_sift_up(sched, sched->n_events++);
+}
+
+void sched_remove(sched_t *sched, sched_event_t *event) {
+    if (event->index < 0) {
+        return;
+    }
+    uint32_t i = (uint32_t) event->index;
+    sched_event_t *last = sched->heap[--sched->n_events];
+    event->index = -1;
+    if (last != event) {
+        // Le dernier evenement prend la place libre, puis monte ou descend.
+        sched_place(sched, last, i);
+        sched_sift_up(sched, i);
+        sched_sift_down(sched, (uint32_t) last->index);
+    }
+}
+
+void sched_clear(sched_t *sched) {
+    for (uint32_t i = 0; i < sched->n_events; i++) {
+        sched->heap[i]->index = -1;
+    }
+    sched->n_events = 0;
+}
+
+void sched_run(sched_t *sched, uint64_t now) {
+    while (sched->n_events != 0 && sched->heap[0]->time <= now) {
+        sched_event_t *event = sched->heap[0];
+        sched_remove(sched, event);
+        event->callback(event->opaque, now);
+    }
+}
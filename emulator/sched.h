@@ -0,0 +1,82 @@
+#ifndef SCHED_H
+#define SCHED_H
+#include <inttypes.h>
+
+#define SCHED_NEVER UINT64_MAX // Instant d'un evenement qui n'arrive jamais
+
+/**
+ * Called when the virtual time reaches the event's deadline. `now` is the
+ * current virtual time, which may be later than the deadline by up to one
+ * check interval of the execution engine (see minirisc_run()).
+ */
+typedef void (*sched_callback_t)(void *opaque, uint64_t now);
+
+/**
+ * Event owned by a device (usually embedded in its state) and queued on
+ * the scheduler. An event is queued at most once: scheduling it again
+ * moves it.
+ */
+typedef struct sched_event {
+    uint64_t time;             // Instant de declenchement (temps virtuel)
+    sched_callback_t callback;
+    void     *opaque;          // Argument donne a callback
+    int32_t  index;            // Position dans le tas, -1 si l'evenement n'est pas en attente
+} sched_event_t;
+
+/**
+ * Central event queue of a platform, keyed by virtual time: a binary
+ * min-heap, so that the core only has to compare its clock with the
+ * earliest deadline, whatever the number of devices and pending events.
+ */
+typedef struct sched {
+    sched_event_t **heap;
+    uint32_t n_events;
+    uint32_t capacity;
+} sched_t;
+
+/**
+ * Allocate an empty scheduler.
+ */
+sched_t* sched_new(void);
+
+/**
+ * Free the scheduler. The events belong to their devices and are not freed:
+ * they must not be used with it anymore.
+ */
+void sched_free(sched_t *sched);
+
+/**
+ * Initialize an event, not queued yet.
+ */
+void sched_event_init(sched_event_t *event, sched_callback_t callback, void *opaque);
+
+/**
+ * Queue event at virtual time `time`, or move it there if it is already
+ * queued.
+ */
+void sched_add(sched_t *sched, sched_event_t *event, uint64_t time);
+
+/**
+ * Remove event from the queue, if it is queued.
+ */
+void sched_remove(sched_t *sched, sched_event_t *event);
+
+/**
+ * Remove every queued event.
+ */
+void sched_clear(sched_t *sched);
+
+/**
+ * Virtual time of the earliest queued event, SCHED_NEVER if none.
+ */
+static inline uint64_t sched_next(const sched_t *sched) {
+    return sched->n_events != 0 ? sched->heap[0]->time : SCHED_NEVER;
+}
+
+/**
+ * Dequeue and call, in deadline order, every event due at `now`. A
+ * callback may queue events, including itself; those due at `now` are
+ * also called.
+ */
+void sched_run(sched_t *sched, uint64_t now);
+#endif
@@ -0,0 +1,149 @@
+#ifdef MINIRISC_STATS
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include "stats.h"
+#include "minirisc.h"
+
+#define STATS_PAGE_WORDS (PLATFORM_PAGE_SIZE / 4)
+
+stats_t* stats_new(void) {
+    stats_t *stats = (stats_t*) calloc(1, sizeof(stats_t));
+    // Comme le cache d'instructions : table de 8 Mo dont seules les entrees touchees occupent de la memoire.
+    stats->pcs = (uint64_t**) mmap(NULL, PLATFORM_PAGES * sizeof(uint64_t*), PROT_READ | PROT_WRITE,
+                                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return stats;
+}
+
+void stats_free(stats_t *stats) {
+    for (uint32_t i = 0; i < stats->n_pages; i++) {
+        free(stats->pcs[stats->pages[i]]);
+    }
+    munmap(stats->pcs, PLATFORM_PAGES * sizeof(uint64_t*));
+    free(stats->pages);
+    free(stats);
+}
+
+uint64_t* stats_add_page(stats_t *stats, uint32_t PC) {
+    uint32_t page = PC >> PLATFORM_PAGE_SHIFT;
+    if (stats->n_pages == stats->capacity) {
+        stats->capacity = stats->capacity ? 2 * stats->capacity : 16;
+        stats->pages = (uint32_t*) realloc(stats->pages, stats->capacity * sizeof(uint32_t));
+    }
+    stats->pages[stats->n_pages++] = page;
+    stats->pcs[page] = (uint64_t*) calloc(STATS_PAGE_WORDS, sizeof(uint64_t));
+    return stats->pcs[page];
+}
+
+typedef struct {
+    uint32_t key;   // Opcode, PC ou classe
+    uint64_t count;
+} stats_entry_t;
+
+static int stats_entry_compare(const void *a, const void *b) {
+    const stats_entry_t *x = (const stats_entry_t*) a;
+    const stats_entry_t *y = (const stats_entry_t*) b;
+    if (x->count != y->count) {
+        return x->count < y->count ? 1 : -1;
+    }
+    return x->key < y->key ? -1 : x->key > y->key;
+}
+
+/**
+ * Insere entry a sa place dans top (n_top entrees triees, au plus STATS_TOP).
+ * Renvoie le nouveau nombre d'entrees.
+ */
+static uint32_t stats_top(stats_entry_t *top, uint32_t n_top, const stats_entry_t *entry) {
+    uint32_t i;
+    if (n_top == STATS_TOP && stats_entry_compare(entry, &top[n_top - 1]) >= 0) {
+        return n_top;
+    }
+    if (n_top < STATS_TOP) {
+        n_top++;
+    }
+    for (i = n_top - 1; i > 0 && stats_entry_compare(entry, &top[i - 1]) < 0; i--) {
+        top[i] = top[i - 1];
+    }
+    top[i] = *entry;
+    return n_top;
+}
+
+// Classes du melange dynamique, par plages d'opcodes
+static const struct {
+    const char *name;
+    uint32_t first, last;
+} stats_classes[] = {
+    { "lui/auipc",       1,  2 },
+    { "sauts",           3,  4 },
+    { "branchements",    5, 10 },
+    { "chargements",    11, 15 },
+    { "stockages",      16, 18 },
+    { "alu immediat",   19, 27 },
+    { "alu registres",  28, 37 },
+    { "systeme",        38, 41 },
+    { "csr",            42, 47 },
+    { "extension M",    56, 63 },
+};
+
+#define STATS_CLASSES (sizeof(stats_classes) / sizeof(stats_classes[0]))
+
+static double stats_percent(uint64_t count, uint64_t total) {
+    return total != 0 ? 100.0 * (double) count / (double) total : 0.0;
+}
+
+void stats_report(const stats_t *stats, FILE *out) {
+    stats_entry_t top[STATS_TOP];
+    stats_entry_t entry;
+    uint32_t n_top = 0;
+    uint64_t total = 0;
+    uint64_t classified = 0;
+
+    for (int op = 0; op < 128; op++) {
+        total += stats->opcodes[op];
+    }
+    fprintf(out, "=== Statistiques d'execution : %" PRIu64 " instructions ===\n", total);
+
+    fprintf(out, "\nOpcodes les plus executes :\n");
+    for (uint32_t op = 0; op < 128; op++) {
+        if (stats->opcodes[op] != 0) {
+            entry.key = op;
+            entry.count = stats->opcodes[op];
+            n_top = stats_top(top, n_top, &entry);
+        }
+    }
+    for (uint32_t i = 0; i < n_top; i++) {
+        fprintf(out, "  %3u %-8s %14" PRIu64 " %6.2f%%\n", top[i].key, minirisc_opcode_name(top[i].key),
+                top[i].count, stats_percent(top[i].count, total));
+    }
+
+    fprintf(out, "\nPC les plus executes :\n");
+    n_top = 0;
+    for (uint32_t i = 0; i < stats->n_pages; i++) {
+        const uint64_t *counts = stats->pcs[stats->pages[i]];
+        for (uint32_t word = 0; word < STATS_PAGE_WORDS; word++) {
+            if (counts[word] != 0) {
+                entry.key = (stats->pages[i] << PLATFORM_PAGE_SHIFT) | (word << 2);
+                entry.count = counts[word];
+                n_top = stats_top(top, n_top, &entry);
+            }
+        }
+    }
+    for (uint32_t i = 0; i < n_top; i++) {
+        fprintf(out, "  0x%08x %14" PRIu64 " %6.2f%%\n", top[i].key, top[i].count, stats_percent(top[i].count, total));
+    }
+
+    fprintf(out, "\nMelange dynamique :\n");
+    for (uint32_t c = 0; c < STATS_CLASSES; c++) {
+        uint64_t count = 0;
+        for (uint32_t op = stats_classes[c].first; op <= stats_classes[c].last; op++) {
+            count += stats->opcodes[op];
+        }
+        classified += count;
+        fprintf(out, "  %-14s %14" PRIu64 " %6.2f%%\n", stats_classes[c].name, count, stats_percent(count, total));
+    }
+    if (total != classified) {
+        fprintf(out, "  %-14s %14" PRIu64 " %6.2f%%\n", "illegales", total - classified,
+                stats_percent(total - classified, total));
+    }
+}
+#endif
@@ -0,0 +1,61 @@
+#ifndef STATS_H
+#define STATS_H
+#ifdef MINIRISC_STATS
+#include <inttypes.h>
+#include <stdio.h>
+#include "platform.h"
+
+/*
+ * Histogrammes d'execution, compiles seulement avec MINIRISC_STATS
+ * (make STATS=1) : sans cette option, ni les compteurs ni les appels
+ * n'existent dans l'emulateur.
+ */
+
+#define STATS_TOP 20 // Lignes des classements du rapport
+
+/**
+ * Executions per opcode and per guest PC.
+ */
+typedef struct stats {
+    uint64_t opcodes[128];   // Executions par opcode
+    uint64_t **pcs;          // PLATFORM_PAGES entrees : compteurs par mot, alloues par page executee
+    uint32_t *pages;         // Pages allouees dans pcs
+    uint32_t n_pages;
+    uint32_t capacity;
+} stats_t;
+
+/**
+ * Allocate empty histograms.
+ */
+stats_t* stats_new(void);
+
+/**
+ * Free the histograms.
+ */
+void stats_free(stats_t *stats);
+
+/**
+ * Allocate the counters of the page holding PC (used by stats_count()).
+ */
+uint64_t* stats_add_page(stats_t *stats, uint32_t PC);
+
+/**
+ * Record n executions of the instruction at PC. n may be "negative"
+ * (modulo 2^64) to cancel executions counted in advance.
+ */
+static inline void stats_count(stats_t *stats, uint32_t PC, uint32_t opcode, uint64_t n) {
+    uint64_t *page = stats->pcs[PC >> PLATFORM_PAGE_SHIFT];
+    if (page == NULL) {
+        page = stats_add_page(stats, PC);
+    }
+    page[(PC & (PLATFORM_PAGE_SIZE - 1)) >> 2] += n;
+    stats->opcodes[opcode & 0x7F] += n;
+}
+
+/**
+ * Print the most executed opcodes, the most executed PCs and the dynamic
+ * instruction mix.
+ */
+void stats_report(const stats_t *stats, FILE *out);
+#endif
+#endif
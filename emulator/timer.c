@@ -0,0 +1,88 @@
+#include <stdlib.h>
+
+#include "timer.h"
+
+/**
+ * Met a jour la ligne d'interruption a l'instant now et programme sa montee
+ * si mtimecmp est dans le futur.
+ */
+static void timer_arm(timer_device_t *timer, uint64_t now) {
+    uint64_t mtime = now - timer->offset;
+    if (mtime >= timer->mtimecmp) {
+        platform_cancel(timer->plt, &timer->compare);
+        platform_set_irq(timer->plt, TIMER_IRQ, 1);
+        return;
+    }
+    platform_set_irq(timer->plt, TIMER_IRQ, 0);
+    uint64_t delay = timer->mtimecmp - mtime;
+    if (delay > SCHED_NEVER - 1 - now) {
+        platform_cancel(timer->plt, &timer->compare); // Au-dela de la fin des temps
+    }
+    else {
+        platform_schedule(timer->plt, &timer->compare, now + delay);
+    }
+}
+
+static void timer_compare(void *opaque, uint64_t now) {
+    timer_arm((timer_device_t*) opaque, now);
+}
+
+static int timer_read(void *opaque, access_type_t access_type, uint32_t offset, uint32_t *data) {
+    timer_device_t *timer = (timer_device_t*) opaque;
+    uint64_t mtime = platform_time(timer->plt) - timer->offset;
+    if (access_type != ACCESS_WORD) {
+        return -1;
+    }
+    switch (offset) {
+        case TIMER_MTIME_LO:    *data = (uint32_t) mtime; return 0;
+        case TIMER_MTIME_HI:    *data = (uint32_t) (mtime >> 32); return 0;
+        case TIMER_MTIMECMP_LO: *data = (uint32_t) timer->mtimecmp; return 0;
+        case TIMER_MTIMECMP_HI: *data = (uint32_t) (timer->mtimecmp >> 32); return 0;
+        default: return -1;
+    }
+}
+
+static int timer_write(void *opaque, access_type_t access_type, uint32_t offset, uint32_t data) {
+    timer_device_t *timer = (timer_device_t*) opaque;
+    uint64_t now = platform_time(timer->plt);
+    uint64_t mtime = now - timer->offset;
+    if (access_type != ACCESS_WORD) {
+        return -1;
+    }
+    switch (offset) {
+        case TIMER_MTIME_LO:    mtime = (mtime & ~(uint64_t) 0xFFFFFFFFu) | data; break;
+        case TIMER_MTIME_HI:    mtime = (mtime & 0xFFFFFFFFu) | ((uint64_t) data << 32); break;
+        case TIMER_MTIMECMP_LO: timer->mtimecmp = (timer->mtimecmp & ~(uint64_t) 0xFFFFFFFFu) | data; break;
+        case TIMER_MTIMECMP_HI: timer->mtimecmp = (timer->mtimecmp & 0xFFFFFFFFu) | ((uint64_t) data << 32); break;
+        default: return -1;
+    }
+    timer->offset = now - mtime;
+    // L'echeance a change : la ligne et l'evenement sont mis a jour.
+    timer_arm(timer, now);
+    return 0;
+}
+
+timer_device_t* timer_init(platform_t *plt) {
+    timer_device_t *timer = (timer_device_t*) malloc(sizeof(timer_device_t));
+    timer->plt = plt;
+    timer->offset = 0;
+    timer->mtimecmp = UINT64_MAX;
+    sched_event_init(&timer->compare, timer_compare, timer);
+    if (platform_add_device(plt, "timer", TIMER_BASE, TIMER_SIZE, timer_read, timer_write, timer, NULL) == NULL) {
+        free(timer);
+        return NULL;
+    }
+    plt->timer = timer;
+    return timer;
+}
+
+void timer_restore(timer_device_t *timer, const timer_device_t *saved) {
+    timer->offset = saved->offset;
+    timer->mtimecmp = saved->mtimecmp;
+    timer_arm(timer, platform_time(timer->plt));
+}
+
+void timer_free(timer_device_t *timer) {
+    platform_cancel(timer->plt, &timer->compare);
+    free(timer);
+}
@@ -0,0 +1,55 @@
+#ifndef TIMER_H
+#define TIMER_H
+#include <inttypes.h>
+#include "platform.h"
+#include "sched.h"
+
+#define TIMER_BASE 0x10001000
+#define TIMER_SIZE 0x1000
+#define TIMER_IRQ  7 // Ligne d'interruption (mcause = 0x80000007, comme l'interruption timer de RISC-V)
+
+// Registres du timer (offsets depuis TIMER_BASE), acces en mots
+#define TIMER_MTIME_LO    0x0 // Temps courant, 32 bits de poids faible
+#define TIMER_MTIME_HI    0x4 // Temps courant, 32 bits de poids fort
+#define TIMER_MTIMECMP_LO 0x8 // Echeance, 32 bits de poids faible
+#define TIMER_MTIMECMP_HI 0xC // Echeance, 32 bits de poids fort
+
+/**
+ * Machine timer of the platform, in the style of the RISC-V mtime/mtimecmp
+ * pair. mtime counts the core's virtual time (platform_t.clock: one tick
+ * per instruction retired, plus the time skipped by WFI); the interrupt
+ * line TIMER_IRQ is raised while mtime >= mtimecmp. The guest acknowledges
+ * the interrupt by writing a later mtimecmp. At reset, mtimecmp is the
+ * largest value: the timer never fires. The timer is not polled: it queues
+ * an event on the platform's scheduler for the instant mtime reaches
+ * mtimecmp.
+ *
+ * The block engine counts the instructions of a block when entering it:
+ * mtime read in the middle of a block is ahead by the rest of the block.
+ */
+typedef struct timer {
+    platform_t *plt;
+    uint64_t offset;   // mtime = temps virtuel - offset
+    uint64_t mtimecmp;
+    sched_event_t compare; // Montee de la ligne quand mtime atteint mtimecmp
+} timer_device_t;
+
+/**
+ * Map the timer on the platform's bus at TIMER_BASE. The platform owns it
+ * and frees it in platform_free().
+ * @return The timer, or NULL on error.
+ */
+timer_device_t* timer_init(platform_t *plt);
+
+/**
+ * Put the timer back in the state saved in `saved` (only its registers are
+ * used) and update its interrupt line and event at the current virtual
+ * time, which must be the time the state was saved at.
+ */
+void timer_restore(timer_device_t *timer, const timer_device_t *saved);
+
+/**
+ * Free the timer and cancel its event.
+ */
+void timer_free(timer_device_t *timer);
+#endif
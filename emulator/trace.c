@@ -0,0 +1,307 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+#define TRACE_HEADER_SIZE (8 + 4 + 4 + 32 * 4)
+
+static inline uint8_t* trace_put_varint(uint8_t *p, uint32_t value) {
+    while (value >= 0x80) {
+        *p++ = (uint8_t) (value | 0x80);
+        value >>= 7;
+    }
+    *p++ = (uint8_t) value;
+    return p;
+}
+
+// Zigzag : les petites differences, positives ou negatives, tiennent en peu d'octets.
+static inline uint8_t* trace_put_delta(uint8_t *p, uint32_t delta) {
+    return trace_put_varint(p, (delta << 1) ^ (uint32_t) ((int32_t) delta >> 31));
+}
+
+static inline uint8_t* trace_put_u32(uint8_t *p, uint32_t value) {
+    p[0] = (uint8_t) value;
+    p[1] = (uint8_t) (value >> 8);
+    p[2] = (uint8_t) (value >> 16);
+    p[3] = (uint8_t) (value >> 24);
+    return p + 4;
+}
+
+static void* trace_writer(void *arg) {
+    trace_t *trace = (trace_t*) arg;
+
+    pthread_mutex_lock(&trace->lock);
+    for (;;) {
+        while (trace->tail == trace->head && !trace->stop) {
+            pthread_cond_wait(&trace->filled, &trace->lock);
+        }
+        if (trace->tail == trace->head) {
+            break; // Arret demande et tout est ecrit
+        }
+        uint32_t index = trace->tail % TRACE_CHUNKS;
+        pthread_mutex_unlock(&trace->lock);
+
+        // La compression se fait hors du verrou, pendant que le coeur remplit les autres tampons
+        if (!trace->error && gzwrite(trace->file, trace->chunks[index], trace->lengths[index]) != (int) trace->lengths[index]) {
+            trace->error = 1;
+        }
+
+        pthread_mutex_lock(&trace->lock);
+        trace->tail++;
+        pthread_cond_signal(&trace->drained);
+    }
+    pthread_mutex_unlock(&trace->lock);
+    return NULL;
+}
+
+/**
+ * Confie le tampon courant au thread et passe au suivant, en attendant
+ * qu'il soit libre.
+ */
+static void trace_submit(trace_t *trace) {
+    uint32_t index = trace->head % TRACE_CHUNKS;
+    trace->lengths[index] = (uint32_t) (trace->p - trace->chunks[index]);
+
+    pthread_mutex_lock(&trace->lock);
+    trace->head++;
+    pthread_cond_signal(&trace->filled);
+    while (trace->head - trace->tail == TRACE_CHUNKS) {
+        pthread_cond_wait(&trace->drained, &trace->lock);
+    }
+    pthread_mutex_unlock(&trace->lock);
+
+    trace->p = trace->chunks[trace->head % TRACE_CHUNKS];
+    trace->end = trace->p + TRACE_CHUNK_SIZE - TRACE_MAX_ENTRY;
+}
+
+trace_t* trace_new(const char *file_name, uint32_t PC, const uint32_t regs[32]) {
+    trace_t *trace = (trace_t*) calloc(1, sizeof(trace_t));
+
+    // Niveau 1 : la compression doit suivre le debit de l'emulateur
+    trace->file = gzopen(file_name, "wb1");
+    if (trace->file == NULL) {
+        fprintf(stderr, "Impossible de creer la trace : %s\n", file_name);
+        free(trace);
+        return NULL;
+    }
+    for (int i = 0; i < TRACE_CHUNKS; i++) {
+        trace->chunks[i] = (uint8_t*) malloc(TRACE_CHUNK_SIZE);
+    }
+    pthread_mutex_init(&trace->lock, NULL);
+    pthread_cond_init(&trace->filled, NULL);
+    pthread_cond_init(&trace->drained, NULL);
+    if (pthread_create(&trace->writer, NULL, trace_writer, trace) != 0) {
+        fprintf(stderr, "Impossible de lancer le thread de la trace\n");
+        pthread_cond_destroy(&trace->drained);
+        pthread_cond_destroy(&trace->filled);
+        pthread_mutex_destroy(&trace->lock);
+        for (int i = 0; i < TRACE_CHUNKS; i++) {
+            free(trace->chunks[i]);
+        }
+        gzclose(trace->file);
+        free(trace);
+        return NULL;
+    }
+
+    uint8_t *p = trace->chunks[0];
+    memcpy(p, TRACE_MAGIC, 8);
+    p = trace_put_u32(p + 8, TRACE_VERSION);
+    p = trace_put_u32(p, PC);
+    for (int i = 0; i < 32; i++) {
+        p = trace_put_u32(p, regs[i]);
+    }
+    trace->p = p;
+    trace->end = trace->chunks[0] + TRACE_CHUNK_SIZE - TRACE_MAX_ENTRY;
+    trace->PC = PC - 4; // Le premier enregistrement est "sequentiel"
+    memcpy(trace->regs, regs, sizeof(trace->regs));
+    return trace;
+}
+
+void trace_write(trace_t *trace, const trace_entry_t *entry) {
+    uint8_t *tag = trace->p;
+    uint8_t *p = tag + 1;
+    uint8_t flags = entry->flags & (TRACE_REG | TRACE_LOAD | TRACE_STORE);
+
+    if (entry->PC != trace->PC + 4) {
+        flags |= TRACE_JUMP;
+        p = trace_put_delta(p, entry->PC - (trace->PC + 4));
+    }
+    trace->PC = entry->PC;
+    if (flags & TRACE_REG) {
+        *p++ = entry->rd;
+        p = trace_put_delta(p, entry->value - trace->regs[entry->rd]);
+        trace->regs[entry->rd] = entry->value;
+    }
+    if (flags & (TRACE_LOAD | TRACE_STORE)) {
+        flags |= (entry->size == 4 ? 2 : entry->size == 2 ? 1 : 0) << 4;
+        p = trace_put_delta(p, entry->addr - trace->addr);
+        trace->addr = entry->addr;
+        if (flags & TRACE_STORE) {
+            p = trace_put_varint(p, entry->data);
+        }
+    }
+    *tag = flags;
+    trace->p = p;
+    trace->entries++;
+    if (p >= trace->end) {
+        trace_submit(trace);
+    }
+}
+
+int trace_close(trace_t *trace) {
+    *trace->p++ = TRACE_END;
+    trace_submit(trace);
+
+    pthread_mutex_lock(&trace->lock);
+    trace->stop = 1;
+    pthread_cond_signal(&trace->filled);
+    pthread_mutex_unlock(&trace->lock);
+    pthread_join(trace->writer, NULL);
+
+    int status = trace->error ? -1 : 0;
+    if (gzclose(trace->file) != Z_OK) {
+        status = -1;
+    }
+    if (status != 0) {
+        fprintf(stderr, "Erreur: trace incomplete (ecriture impossible)\n");
+    }
+    pthread_cond_destroy(&trace->drained);
+    pthread_cond_destroy(&trace->filled);
+    pthread_mutex_destroy(&trace->lock);
+    for (int i = 0; i < TRACE_CHUNKS; i++) {
+        free(trace->chunks[i]);
+    }
+    free(trace);
+    return status;
+}
+
+static int trace_get_varint(gzFile file, uint32_t *value) {
+    uint32_t result = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        int c = gzgetc(file);
+        if (c < 0) {
+            return -1;
+        }
+        result |= (uint32_t) (c & 0x7F) << shift;
+        if (!(c & 0x80)) {
+            *value = result;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int trace_get_delta(gzFile file, uint32_t *delta) {
+    uint32_t zigzag;
+    if (trace_get_varint(file, &zigzag) != 0) {
+        return -1;
+    }
+    *delta = (zigzag >> 1) ^ (0 - (zigzag & 1));
+    return 0;
+}
+
+static uint32_t trace_get_u32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+trace_reader_t* trace_open(const char *file_name) {
+    uint8_t header[TRACE_HEADER_SIZE];
+    trace_reader_t *reader = (trace_reader_t*) calloc(1, sizeof(trace_reader_t));
+
+    reader->file = gzopen(file_name, "rb");
+    if (reader->file == NULL) {
+        fprintf(stderr, "Trace non trouvee : %s\n", file_name);
+        free(reader);
+        return NULL;
+    }
+    gzbuffer(reader->file, 256 * 1024);
+    if (gzread(reader->file, header, sizeof(header)) != (int) sizeof(header)
+        || memcmp(header, TRACE_MAGIC, 8) != 0 || trace_get_u32(header + 8) != TRACE_VERSION) {
+        fprintf(stderr, "%s n'est pas une trace (version %d)\n", file_name, TRACE_VERSION);
+        trace_reader_free(reader);
+        return NULL;
+    }
+    reader->start_PC = trace_get_u32(header + 12);
+    reader->PC = reader->start_PC - 4;
+    for (int i = 0; i < 32; i++) {
+        reader->regs[i] = trace_get_u32(header + 16 + 4 * i);
+    }
+    return reader;
+}
+
+int trace_read(trace_reader_t *reader, trace_entry_t *entry) {
+    int flags = gzgetc(reader->file);
+    uint32_t delta;
+
+    if (flags < 0) {
+        return -1; // Fin du fichier sans TRACE_END : trace tronquee
+    }
+    if (flags == TRACE_END) {
+        return 0;
+    }
+    entry->flags = (uint8_t) (flags & (TRACE_REG | TRACE_LOAD | TRACE_STORE));
+    entry->PC = reader->PC + 4;
+    if (flags & TRACE_JUMP) {
+        if (trace_get_delta(reader->file, &delta) != 0) {
+            return -1;
+        }
+        entry->PC += delta;
+    }
+    reader->PC = entry->PC;
+    if (flags & TRACE_REG) {
+        int rd = gzgetc(reader->file);
+        if (rd < 0 || rd >= 32 || trace_get_delta(reader->file, &delta) != 0) {
+            return -1;
+        }
+        entry->rd = (uint8_t) rd;
+        entry->value = reader->regs[rd] + delta;
+        reader->regs[rd] = entry->value;
+    }
+    if (flags & (TRACE_LOAD | TRACE_STORE)) {
+        if (trace_get_delta(reader->file, &delta) != 0) {
+            return -1;
+        }
+        entry->size = (uint8_t) (1 << TRACE_SIZE(flags));
+        entry->addr = reader->addr + delta;
+        reader->addr = entry->addr;
+        if ((flags & TRACE_STORE) && trace_get_varint(reader->file, &entry->data) != 0) {
+            return -1;
+        }
+    }
+    return 1;
+}
+
+void trace_reader_free(trace_reader_t *reader) {
+    gzclose(reader->file);
+    free(reader);
+}
+
+int trace_dump(const char *file_name, FILE *out) {
+    trace_reader_t *reader = trace_open(file_name);
+    trace_entry_t entry;
+    uint64_t n = 0;
+    int status;
+
+    if (reader == NULL) {
+        return -1;
+    }
+    fprintf(out, "# PC initial %08x\n", reader->start_PC);
+    while ((status = trace_read(reader, &entry)) > 0) {
+        fprintf(out, "%" PRIu64 " %08x", n++, entry.PC);
+        if (entry.flags & TRACE_REG) {
+            fprintf(out, " x%u=%08x", entry.rd, entry.value);
+        }
+        if (entry.flags & TRACE_LOAD) {
+            fprintf(out, " L%u[%08x]", entry.size, entry.addr);
+        }
+        if (entry.flags & TRACE_STORE) {
+            fprintf(out, " S%u[%08x]=%08x", entry.size, entry.addr, entry.data);
+        }
+        fputc('\n', out);
+    }
+    if (status < 0) {
+        fprintf(stderr, "Trace tronquee ou corrompue apres %" PRIu64 " instructions\n", n);
+    }
+    trace_reader_free(reader);
+    return status;
+}
@@ -0,0 +1,133 @@
+#ifndef TRACE_H
+#define TRACE_H
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <zlib.h>
+
+/*
+ * Trace d'execution binaire : pour chaque instruction executee, son PC, le
+ * registre qu'elle ecrit et l'acces memoire qu'elle fait.
+ *
+ * Format (flux gzip, lisible par zcat) :
+ *   en-tete : "MRTRACE\0", version (u32), PC initial (u32), x0..x31 (u32),
+ *             entiers little-endian ;
+ *   puis un enregistrement par instruction, qui commence par un octet de
+ *   drapeaux (TRACE_*) suivi, dans l'ordre, des champs presents :
+ *     TRACE_JUMP  : PC - (PC precedent + 4), zigzag varint
+ *     TRACE_REG   : rd (octet), nouvelle valeur - ancienne valeur de rd, zigzag varint
+ *     TRACE_LOAD/TRACE_STORE : adresse - adresse de l'acces precedent, zigzag varint
+ *     TRACE_STORE : valeur ecrite, varint
+ *   La taille de l'acces (1, 2 ou 4 octets) est 1 << TRACE_SIZE(drapeaux).
+ *   Un octet TRACE_END termine la trace.
+ * Les varint sont en LEB128 : 7 bits par octet, poids faibles d'abord.
+ */
+
+#define TRACE_MAGIC   "MRTRACE"
+#define TRACE_VERSION 1
+
+#define TRACE_JUMP  0x01 // PC non sequentiel
+#define TRACE_REG   0x02 // Ecriture d'un registre
+#define TRACE_LOAD  0x04 // Lecture en memoire
+#define TRACE_STORE 0x08 // Ecriture en memoire
+#define TRACE_SIZE(flags) (((flags) >> 4) & 3)
+#define TRACE_END   0x80 // Fin de la trace
+
+#define TRACE_CHUNK_SIZE (1 << 20) // Octets encodes confies d'un coup au thread de compression
+#define TRACE_CHUNKS     4         // Tampons en rotation entre le coeur et le thread
+#define TRACE_MAX_ENTRY  32        // Taille maximale d'un enregistrement encode
+
+/**
+ * One executed instruction.
+ */
+typedef struct {
+    uint32_t PC;
+    uint8_t  flags;  // TRACE_REG, TRACE_LOAD, TRACE_STORE (the size bits are set by trace_write())
+    uint8_t  rd;     // Register written (TRACE_REG)
+    uint8_t  size;   // Access size in bytes: 1, 2 or 4 (TRACE_LOAD, TRACE_STORE)
+    uint32_t value;  // New value of rd (TRACE_REG)
+    uint32_t addr;   // Accessed address (TRACE_LOAD, TRACE_STORE)
+    uint32_t data;   // Value stored (TRACE_STORE)
+} trace_entry_t;
+
+/**
+ * Trace writer. The core encodes records into chunks[head % TRACE_CHUNKS];
+ * full chunks are compressed and written to the file by a host thread, so
+ * that compression runs alongside emulation. The core waits only when all
+ * the chunks are waiting for the thread.
+ */
+typedef struct trace {
+    uint8_t  *chunks[TRACE_CHUNKS];
+    uint32_t lengths[TRACE_CHUNKS]; // Octets encodes dans chaque tampon
+    uint8_t  *p;        // Position d'ecriture dans le tampon courant
+    uint8_t  *end;      // Limite : au-dela, le tampon courant est confie au thread
+    uint64_t head;      // Tampons remplis par le coeur depuis le debut
+    uint64_t tail;      // Tampons ecrits par le thread depuis le debut
+    uint32_t PC;        // PC de l'enregistrement precedent
+    uint32_t addr;      // Adresse de l'acces precedent
+    uint32_t regs[32];  // Valeurs des registres vues par le lecteur
+    uint64_t entries;   // Instructions enregistrees
+    int      stop;
+    int      error;     // Ecriture ou compression en echec (le reste de la trace est perdu)
+    gzFile   file;
+    pthread_t writer;
+    pthread_mutex_t lock;
+    pthread_cond_t  filled;  // Un tampon attend le thread (ou arret demande)
+    pthread_cond_t  drained; // Le thread a libere un tampon
+} trace_t;
+
+/**
+ * Trace reader.
+ */
+typedef struct {
+    gzFile   file;
+    uint32_t start_PC;  // PC initial (en-tete)
+    uint32_t PC;        // PC de l'enregistrement precedent
+    uint32_t addr;
+    uint32_t regs[32];  // Registres initiaux, puis valeurs apres l'enregistrement precedent
+} trace_reader_t;
+
+/**
+ * Create the trace file and start its writer thread. The header records
+ * PC and regs, the state the trace starts from.
+ * @return The writer, or NULL on error (message printed on stderr).
+ */
+trace_t* trace_new(const char *file_name, uint32_t PC, const uint32_t regs[32]);
+
+/**
+ * Record an executed instruction.
+ */
+void trace_write(trace_t *trace, const trace_entry_t *entry);
+
+/**
+ * End the trace, wait until the writer thread has written everything, and
+ * free the writer.
+ * @return 0 on success, -1 if part of the trace could not be written.
+ */
+int trace_close(trace_t *trace);
+
+/**
+ * Open a trace file and read its header (initial PC and registers in
+ * reader->start_PC and reader->regs).
+ * @return The reader, or NULL on error (message printed on stderr).
+ */
+trace_reader_t* trace_open(const char *file_name);
+
+/**
+ * Read the next record.
+ * @return 1 if entry was filled, 0 at the end of the trace, -1 if the
+ *         trace is truncated or corrupt.
+ */
+int trace_read(trace_reader_t *reader, trace_entry_t *entry);
+
+/**
+ * Close a reader.
+ */
+void trace_reader_free(trace_reader_t *reader);
+
+/**
+ * Print a trace in text form, one instruction per line.
+ * @return 0 on success, -1 on error.
+ */
+int trace_dump(const char *file_name, FILE *out);
+#endif